@@ -0,0 +1,355 @@
+#include "lib-header/ahci.h"
+#include "lib-header/pci.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+
+static struct AHCIDriverState ahci_driver_state;
+
+// Command list, received FIS area and command tables of the drive port. HBA
+// access them by physical address, kernel memory is mapped linearly
+static struct AHCICommandHeader ahci_command_list[AHCI_SLOT_COUNT] __attribute__((aligned(1024)));
+static uint8_t ahci_received_fis[256] __attribute__((aligned(256)));
+static struct AHCICommandTable ahci_command_table[AHCI_SLOT_COUNT];
+static uint16_t ahci_identify[BLOCK_SIZE / 2];
+
+static void ahci_stop_port(volatile struct AHCIPortRegister *port)
+{
+  port->command &= ~AHCI_PORT_CMD_ST;
+  while (port->command & AHCI_PORT_CMD_CR)
+    ;
+  port->command &= ~AHCI_PORT_CMD_FRE;
+  while (port->command & AHCI_PORT_CMD_FR)
+    ;
+}
+
+static void ahci_start_port(volatile struct AHCIPortRegister *port)
+{
+  port->sata_error = 0xFFFFFFFF;
+  port->interrupt_status = 0xFFFFFFFF;
+  port->command |= AHCI_PORT_CMD_FRE;
+  while (port->task_file_data & (AHCI_PORT_TFD_BSY | AHCI_PORT_TFD_DRQ))
+    ;
+  port->command |= AHCI_PORT_CMD_ST;
+}
+
+// Get unused command slot, -1 if every usable slot is outstanding
+static int8_t ahci_find_free_slot(void)
+{
+  // Non-queued command must run alone on the port
+  if (!ahci_driver_state.ncq && ahci_driver_state.outstanding)
+    return -1;
+  for (uint32_t slot = 0; slot < ahci_driver_state.slot_count; slot++)
+    if ((ahci_driver_state.outstanding & (1u << slot)) == 0)
+      return slot;
+  return -1;
+}
+
+/**
+ * Poll until every outstanding slot is completed, then finish bounced reads.
+ * On task file error the drive abort all outstanding commands, port is
+ * restarted and those commands are reported failed to the block layer
+ *
+ * @return True if every outstanding command completed without error
+ */
+static bool ahci_reap(void)
+{
+  volatile struct AHCIPortRegister *port = ahci_driver_state.port;
+  bool ok = TRUE;
+  while ((port->command_issue | port->sata_active) & ahci_driver_state.outstanding)
+  {
+    if (port->interrupt_status & AHCI_PORT_IS_TFES)
+    {
+      ahci_driver_state.error_count++;
+      ahci_stop_port(port);
+      ahci_start_port(port);
+      ok = FALSE;
+      break;
+    }
+  }
+
+  if (!ok && (ahci_driver_state.outstanding & ~ahci_driver_state.outstanding_write))
+    block_device_report_error(FALSE);
+  if (!ok && ahci_driver_state.outstanding_write)
+    block_device_report_error(TRUE);
+  ahci_driver_state.outstanding = 0;
+  ahci_driver_state.outstanding_write = 0;
+  block_bounce_release();
+  return ok;
+}
+
+static void ahci_wait(void)
+{
+  ahci_reap();
+}
+
+/**
+ * Fill command header of slot and return its zeroed register FIS
+ *
+ * @param slot        Command slot
+ * @param prdt_length Filled PRDT entries of the slot command table
+ * @param is_write    Whether data flow from memory to device
+ */
+static struct AHCIFISRegisterH2D *ahci_prepare_slot(uint32_t slot, uint16_t prdt_length, bool is_write)
+{
+  struct AHCICommandHeader *header = &ahci_command_list[slot];
+  header->flag = AHCI_COMMAND_FIS_DWORD_COUNT | (is_write ? AHCI_COMMAND_HEADER_FLAG_WRITE : 0);
+  header->prdt_length = prdt_length;
+  header->prd_byte_count = 0;
+
+  struct AHCIFISRegisterH2D *fis = (struct AHCIFISRegisterH2D *)ahci_command_table[slot].command_fis;
+  memset(fis, 0, sizeof(struct AHCIFISRegisterH2D));
+  fis->type = AHCI_FIS_TYPE_REG_H2D;
+  fis->flag = AHCI_FIS_COMMAND;
+  return fis;
+}
+
+static void ahci_issue_slot(uint32_t slot, bool queued, bool is_write)
+{
+  uint32_t bit = 1u << slot;
+  __asm__ volatile("" : /* <Empty> */ : /* <Empty> */ : "memory");
+  ahci_driver_state.outstanding |= bit;
+  if (is_write)
+    ahci_driver_state.outstanding_write |= bit;
+  if (queued)
+    ahci_driver_state.port->sata_active = bit;
+  ahci_driver_state.port->command_issue = bit;
+}
+
+/**
+ * Issue commands transferring consecutive blocks described by segment list,
+ * without waiting. With NCQ, commands occupy free slots and run concurrently,
+ * ahci_wait() is only called when slots or bounce buffer run out.
+ * Each command scatter-gather through block_bounce_map()
+ *
+ * @param segment               Segment list, read into if is_write is false
+ * @param segment_count         Number of segments
+ * @param logical_block_address First block of the transfer
+ * @param is_write              Transfer direction
+ */
+static void ahci_transfer(const struct BlockSegment *segment, uint32_t segment_count,
+                          uint32_t logical_block_address, bool is_write)
+{
+  uint32_t index = 0;
+  uint32_t block_offset = 0;
+
+  while (index < segment_count)
+  {
+    if (block_offset == segment[index].block_count)
+    {
+      index++;
+      block_offset = 0;
+      continue;
+    }
+    int8_t slot = ahci_find_free_slot();
+    if (slot < 0)
+    {
+      ahci_wait();
+      continue;
+    }
+
+    struct AHCICommandTable *table = &ahci_command_table[slot];
+    uint32_t command_block = 0;
+    uint16_t prdt_length = 0;
+    while (index < segment_count && prdt_length < AHCI_PRDT_PER_COMMAND &&
+           command_block < AHCI_MAX_BLOCK_PER_COMMAND)
+    {
+      if (block_offset == segment[index].block_count)
+      {
+        index++;
+        block_offset = 0;
+        continue;
+      }
+
+      // Read target is the caller buffer, const only hold for write
+      uint8_t *buf = (uint8_t *)segment[index].buf + block_offset * BLOCK_SIZE;
+      uint32_t piece = segment[index].block_count - block_offset;
+      if (piece > AHCI_MAX_BLOCK_PER_COMMAND - command_block)
+        piece = AHCI_MAX_BLOCK_PER_COMMAND - command_block;
+
+      buf = block_bounce_map(buf, &piece, is_write);
+      if (!buf)
+        break;
+
+      table->prdt[prdt_length].data_base = KERNEL_VIRTUAL_TO_PHYSICAL(buf);
+      table->prdt[prdt_length].data_base_upper = 0;
+      table->prdt[prdt_length].reserved = 0;
+      table->prdt[prdt_length].byte_count = piece * BLOCK_SIZE - 1;
+      prdt_length++;
+      command_block += piece;
+      block_offset += piece;
+    }
+
+    // Bounce buffer exhausted before any data, drain and retry
+    if (command_block == 0)
+    {
+      ahci_wait();
+      continue;
+    }
+
+    struct AHCIFISRegisterH2D *fis = ahci_prepare_slot(slot, prdt_length, is_write);
+    fis->device = AHCI_DEVICE_LBA;
+    fis->lba_low[0] = (uint8_t)logical_block_address;
+    fis->lba_low[1] = (uint8_t)(logical_block_address >> 8);
+    fis->lba_low[2] = (uint8_t)(logical_block_address >> 16);
+    if (ahci_driver_state.lba48)
+      fis->lba_high[0] = (uint8_t)(logical_block_address >> 24);
+    else
+      fis->device |= (uint8_t)((logical_block_address >> 24) & 0x0F);
+    if (ahci_driver_state.ncq)
+    {
+      // NCQ carry block count in feature and tag in count bit 3-7
+      fis->command = is_write ? AHCI_CMD_WRITE_FPDMA_QUEUED : AHCI_CMD_READ_FPDMA_QUEUED;
+      fis->feature_low = (uint8_t)command_block;
+      fis->feature_high = (uint8_t)(command_block >> 8);
+      fis->count = (uint16_t)(slot << 3);
+    }
+    else if (ahci_driver_state.lba48)
+    {
+      fis->command = is_write ? AHCI_CMD_WRITE_DMA_EXT : AHCI_CMD_READ_DMA_EXT;
+      fis->count = (uint16_t)command_block;
+    }
+    else
+    {
+      fis->command = is_write ? AHCI_CMD_WRITE_DMA : AHCI_CMD_READ_DMA;
+      fis->count = (uint16_t)command_block;
+    }
+    ahci_issue_slot(slot, ahci_driver_state.ncq, is_write);
+    logical_block_address += command_block;
+  }
+}
+
+static void ahci_read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  struct BlockSegment segment = {.buf = ptr, .block_count = block_count};
+  ahci_transfer(&segment, 1, logical_block_address, FALSE);
+  ahci_wait();
+}
+
+static void ahci_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                      uint32_t logical_block_address)
+{
+  ahci_transfer(segment, segment_count, logical_block_address, TRUE);
+  ahci_wait();
+}
+
+// Issued writes are reaped by the next ahci_wait()
+static void ahci_submit_write_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                       uint32_t logical_block_address)
+{
+  ahci_transfer(segment, segment_count, logical_block_address, TRUE);
+}
+
+static uint32_t ahci_get_block_count(void)
+{
+  return ahci_driver_state.block_count;
+}
+
+/**
+ * Issue IDENTIFY DEVICE on slot 0 and wait. Fill block_count, enable NCQ and
+ * cap its depth when both HBA and drive support it
+ *
+ * @param capability HBA capability register
+ * @return           True if drive answered without error
+ */
+static bool ahci_identify_drive(uint32_t capability)
+{
+  struct AHCICommandTable *table = &ahci_command_table[0];
+  table->prdt[0].data_base = KERNEL_VIRTUAL_TO_PHYSICAL(ahci_identify);
+  table->prdt[0].data_base_upper = 0;
+  table->prdt[0].reserved = 0;
+  table->prdt[0].byte_count = BLOCK_SIZE - 1;
+
+  struct AHCIFISRegisterH2D *fis = ahci_prepare_slot(0, 1, FALSE);
+  fis->command = AHCI_CMD_IDENTIFY;
+  ahci_issue_slot(0, FALSE, FALSE);
+  if (!ahci_reap() || (ahci_driver_state.port->task_file_data & AHCI_PORT_TFD_ERR))
+    return FALSE;
+
+  // Clamp 48-bit count into 32-bit LBA used by the kernel, drive without
+  // LBA48 report its count in the LBA28 words
+  ahci_driver_state.lba48 = (ahci_identify[AHCI_IDENTIFY_COMMAND_SET_2] & AHCI_IDENTIFY_LBA48_SUPPORTED) != 0;
+  if (ahci_driver_state.lba48)
+  {
+    bool above_32_bit = ahci_identify[AHCI_IDENTIFY_LBA48_BLOCK_COUNT + 2] ||
+                        ahci_identify[AHCI_IDENTIFY_LBA48_BLOCK_COUNT + 3];
+    ahci_driver_state.block_count = above_32_bit ? 0xFFFFFFFF
+                                                 : (ahci_identify[AHCI_IDENTIFY_LBA48_BLOCK_COUNT] |
+                                                    ((uint32_t)ahci_identify[AHCI_IDENTIFY_LBA48_BLOCK_COUNT + 1] << 16));
+  }
+  else
+    ahci_driver_state.block_count = ahci_identify[AHCI_IDENTIFY_LBA28_BLOCK_COUNT] |
+                                    ((uint32_t)ahci_identify[AHCI_IDENTIFY_LBA28_BLOCK_COUNT + 1] << 16);
+
+  // FPDMA commands carry 48-bit LBA
+  if (ahci_driver_state.lba48 && (capability & AHCI_CAP_SNCQ) &&
+      (ahci_identify[AHCI_IDENTIFY_SATA_CAPABILITY] & AHCI_IDENTIFY_NCQ_SUPPORTED))
+  {
+    uint32_t queue_depth = (ahci_identify[AHCI_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1;
+    if (queue_depth < ahci_driver_state.slot_count)
+      ahci_driver_state.slot_count = queue_depth;
+    ahci_driver_state.ncq = TRUE;
+  }
+  return TRUE;
+}
+
+/**
+ * Find AHCI controller, map its registers and take the first implemented
+ * port with an ATA drive attached. Command list, FIS area and command tables
+ * are installed on that port, completion is polled without interrupt
+ */
+static bool ahci_probe(void)
+{
+  struct PCIDevice controller;
+  if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA, &controller) ||
+      pci_config_read8(controller, PCI_PROG_IF) != PCI_PROG_IF_AHCI)
+    return FALSE;
+
+  // ABAR must be memory space
+  uint32_t bar5 = pci_config_read32(controller, PCI_BAR5);
+  if (bar5 & 0x1)
+    return FALSE;
+  pci_enable_bus_master(controller);
+  volatile struct AHCIHostRegister *host = map_kernel_mmio(bar5 & 0xFFFFFFF0);
+  host->global_control |= AHCI_GHC_AE;
+
+  volatile struct AHCIPortRegister *port = 0;
+  for (uint32_t i = 0; i < AHCI_PORT_COUNT && !port; i++)
+  {
+    if ((host->port_implemented & (1u << i)) == 0)
+      continue;
+    if ((host->port[i].sata_status & AHCI_PORT_SSTS_DET_MASK) == AHCI_PORT_SSTS_DET_PRESENT &&
+        host->port[i].signature == AHCI_PORT_SIG_ATA)
+      port = &host->port[i];
+  }
+  if (!port)
+    return FALSE;
+
+  memset(&ahci_driver_state, 0, sizeof(ahci_driver_state));
+  ahci_driver_state.port = port;
+  ahci_driver_state.slot_count = ((host->capability >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+
+  ahci_stop_port(port);
+  memset(ahci_command_list, 0, sizeof(ahci_command_list));
+  memset(ahci_received_fis, 0, sizeof(ahci_received_fis));
+  memset(ahci_command_table, 0, sizeof(ahci_command_table));
+  for (uint32_t slot = 0; slot < AHCI_SLOT_COUNT; slot++)
+    ahci_command_list[slot].command_table_base = KERNEL_VIRTUAL_TO_PHYSICAL(&ahci_command_table[slot]);
+  port->command_list_base = KERNEL_VIRTUAL_TO_PHYSICAL(ahci_command_list);
+  port->command_list_base_upper = 0;
+  port->fis_base = KERNEL_VIRTUAL_TO_PHYSICAL(ahci_received_fis);
+  port->fis_base_upper = 0;
+  port->interrupt_enable = 0;
+  ahci_start_port(port);
+
+  return ahci_identify_drive(host->capability);
+}
+
+const struct BlockDeviceOperation ahci_block_device = {
+    .name = "ahci",
+    .probe = ahci_probe,
+    .get_block_count = ahci_get_block_count,
+    .read_blocks = ahci_read_blocks,
+    .write_block_segments = ahci_write_block_segments,
+    .submit_write_segments = ahci_submit_write_segments,
+    .wait = ahci_wait,
+};
@@ -0,0 +1,380 @@
+#include "lib-header/blockcache.h"
+#include "lib-header/iosched.h"
+#include "lib-header/stdmem.h"
+
+static struct BlockCacheState block_cache_state;
+
+// Read-ahead span is read at once here, then split into cache lines
+static uint8_t read_ahead_buffer[BLOCK_CACHE_READ_AHEAD_LINE_COUNT * BLOCK_CACHE_LINE_SIZE];
+
+static uint32_t block_cache_hash(uint32_t line_number)
+{
+  return line_number % BLOCK_CACHE_HASH_SIZE;
+}
+
+static void lru_unlink(int16_t index)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  if (line->lru_prev != BLOCK_CACHE_NONE)
+    block_cache_state.line[line->lru_prev].lru_next = line->lru_next;
+  else
+    block_cache_state.lru_head = line->lru_next;
+
+  if (line->lru_next != BLOCK_CACHE_NONE)
+    block_cache_state.line[line->lru_next].lru_prev = line->lru_prev;
+  else
+    block_cache_state.lru_tail = line->lru_prev;
+}
+
+static void lru_push_back(int16_t index)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  line->lru_next = BLOCK_CACHE_NONE;
+  line->lru_prev = block_cache_state.lru_tail;
+  if (block_cache_state.lru_tail != BLOCK_CACHE_NONE)
+    block_cache_state.line[block_cache_state.lru_tail].lru_next = index;
+  else
+    block_cache_state.lru_head = index;
+  block_cache_state.lru_tail = index;
+}
+
+static void lru_push_front(int16_t index)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  line->lru_prev = BLOCK_CACHE_NONE;
+  line->lru_next = block_cache_state.lru_head;
+  if (block_cache_state.lru_head != BLOCK_CACHE_NONE)
+    block_cache_state.line[block_cache_state.lru_head].lru_prev = index;
+  else
+    block_cache_state.lru_tail = index;
+  block_cache_state.lru_head = index;
+}
+
+static void hash_unlink(int16_t index)
+{
+  int16_t *link = &block_cache_state.hash_head[block_cache_hash(block_cache_state.line[index].line_number)];
+  while (*link != index)
+    link = &block_cache_state.line[*link].hash_next;
+  *link = block_cache_state.line[index].hash_next;
+}
+
+static void hash_insert(int16_t index)
+{
+  uint32_t bucket = block_cache_hash(block_cache_state.line[index].line_number);
+  block_cache_state.line[index].hash_next = block_cache_state.hash_head[bucket];
+  block_cache_state.hash_head[bucket] = index;
+}
+
+static int16_t find_line(uint32_t line_number)
+{
+  int16_t index = block_cache_state.hash_head[block_cache_hash(line_number)];
+  while (index != BLOCK_CACHE_NONE && block_cache_state.line[index].line_number != line_number)
+    index = block_cache_state.line[index].hash_next;
+  return index;
+}
+
+// Queue dirty line write, line buffer must not be reused before io_unplug()
+static void write_back_line(int16_t index)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  if (!line->dirty || line->writing)
+    return;
+  io_submit_write(line->buf, line->line_number * BLOCK_CACHE_LINE_BLOCK_COUNT, BLOCK_CACHE_LINE_BLOCK_COUNT);
+  line->writing = TRUE;
+  line->write_sequence = io_get_unplug_count();
+  block_cache_state.dirty_count--;
+  block_cache_state.statistic.write_back++;
+}
+
+// Line become clean once the dispatch carrying its queued write completed
+static void retire_line(int16_t index)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  if (line->writing && line->write_sequence != io_get_unplug_count())
+  {
+    line->writing = FALSE;
+    line->dirty = FALSE;
+  }
+}
+
+// Line about to be modified or reused must not have write in the queue
+static void settle_line(int16_t index)
+{
+  retire_line(index);
+  if (block_cache_state.line[index].writing)
+  {
+    io_unplug();
+    retire_line(index);
+  }
+}
+
+// Whether valid line hold any block in [logical_block_address, end)
+static bool is_line_in_range(int16_t index, uint32_t logical_block_address, uint32_t end)
+{
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  uint32_t line_lba = line->line_number * BLOCK_CACHE_LINE_BLOCK_COUNT;
+  return line->valid && line_lba + BLOCK_CACHE_LINE_BLOCK_COUNT > logical_block_address && line_lba < end;
+}
+
+/**
+ * Pick line to reuse, least recently used clean line first. When every line
+ * is dirty, all of them are written in single elevator sweep
+ */
+static int16_t find_victim_line(void)
+{
+  for (int16_t index = block_cache_state.lru_tail; index != BLOCK_CACHE_NONE;
+       index = block_cache_state.line[index].lru_prev)
+  {
+    retire_line(index);
+    if (!block_cache_state.line[index].valid || !block_cache_state.line[index].dirty)
+      return index;
+  }
+
+  block_cache_flush();
+  return block_cache_state.lru_tail;
+}
+
+/**
+ * Reuse least recently used clean line for line_number. Line is marked most
+ * recently used, its content is not loaded
+ */
+static int16_t allocate_line(uint32_t line_number)
+{
+  int16_t index = find_victim_line();
+  struct BlockCacheLine *line = &block_cache_state.line[index];
+  if (line->valid)
+  {
+    block_cache_state.statistic.evict++;
+    hash_unlink(index);
+  }
+
+  line->line_number = line_number;
+  line->valid = TRUE;
+  hash_insert(index);
+  lru_unlink(index);
+  lru_push_front(index);
+  return index;
+}
+
+/**
+ * Get line index holding line_number and mark it most recently used.
+ * On miss, least recently used line is written back if dirty and reused
+ *
+ * @param line_number Line to get
+ * @param fill        Whether line content is read from disk on miss. Caller
+ * overwriting the whole line may skip the read
+ * @return            Line index, BLOCK_CACHE_NONE if the read failed
+ */
+static int16_t get_line(uint32_t line_number, bool fill)
+{
+  int16_t index = find_line(line_number);
+  if (index != BLOCK_CACHE_NONE)
+  {
+    block_cache_state.statistic.hit++;
+    lru_unlink(index);
+    lru_push_front(index);
+    return index;
+  }
+
+  block_cache_state.statistic.miss++;
+  index = allocate_line(line_number);
+  if (fill && !io_read(block_cache_state.line[index].buf, line_number * BLOCK_CACHE_LINE_BLOCK_COUNT,
+                       BLOCK_CACHE_LINE_BLOCK_COUNT))
+  {
+    // Failed line is not kept, next access read the disk again
+    hash_unlink(index);
+    block_cache_state.line[index].valid = FALSE;
+    lru_unlink(index);
+    lru_push_back(index);
+    return BLOCK_CACHE_NONE;
+  }
+  return index;
+}
+
+void initialize_block_cache(void)
+{
+  // Zeroed state on first call hold no dirty line, flush is no-op
+  block_cache_flush();
+  memset(&block_cache_state, 0, sizeof(block_cache_state));
+  for (int16_t i = 0; i < BLOCK_CACHE_HASH_SIZE; i++)
+    block_cache_state.hash_head[i] = BLOCK_CACHE_NONE;
+
+  block_cache_state.lru_head = BLOCK_CACHE_NONE;
+  block_cache_state.lru_tail = BLOCK_CACHE_NONE;
+  for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+  {
+    block_cache_state.line[i].hash_next = BLOCK_CACHE_NONE;
+    lru_push_front(i);
+  }
+}
+
+bool block_cache_read(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  uint8_t *target = (uint8_t *)ptr;
+  uint32_t end = logical_block_address + block_count;
+
+  if (block_count >= BLOCK_CACHE_BYPASS_BLOCK_COUNT)
+  {
+    // Disk may be stale for dirty lines, overlay every cached block in range
+    block_cache_state.statistic.bypass++;
+    if (!io_read(target, logical_block_address, block_count))
+      return FALSE;
+    for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+    {
+      struct BlockCacheLine *line = &block_cache_state.line[i];
+      if (!line->valid || !line->dirty)
+        continue;
+      uint32_t line_lba = line->line_number * BLOCK_CACHE_LINE_BLOCK_COUNT;
+      for (uint32_t j = 0; j < BLOCK_CACHE_LINE_BLOCK_COUNT; j++)
+        if (line_lba + j >= logical_block_address && line_lba + j < end)
+          memcpy(target + (line_lba + j - logical_block_address) * BLOCK_SIZE,
+                 line->buf + j * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    return TRUE;
+  }
+
+  while (logical_block_address < end)
+  {
+    uint32_t offset = logical_block_address % BLOCK_CACHE_LINE_BLOCK_COUNT;
+    uint32_t count = BLOCK_CACHE_LINE_BLOCK_COUNT - offset;
+    if (count > end - logical_block_address)
+      count = end - logical_block_address;
+
+    int16_t index = get_line(logical_block_address / BLOCK_CACHE_LINE_BLOCK_COUNT, TRUE);
+    if (index == BLOCK_CACHE_NONE)
+      return FALSE;
+    memcpy(target, block_cache_state.line[index].buf + offset * BLOCK_SIZE, count * BLOCK_SIZE);
+
+    target += count * BLOCK_SIZE;
+    logical_block_address += count;
+  }
+  return TRUE;
+}
+
+bool block_cache_write(const void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  const uint8_t *source = (const uint8_t *)ptr;
+  uint32_t end = logical_block_address + block_count;
+
+  if (block_count >= BLOCK_CACHE_BYPASS_BLOCK_COUNT)
+  {
+    // Keep cached copy coherent, fully overwritten line become clean
+    block_cache_state.statistic.bypass++;
+    // Queued line write inside the range hold older data. Scheduler sort by
+    // LBA and device may run commands concurrently, so it is completed first
+    // instead of racing with the bypass write
+    for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+      if (is_line_in_range(i, logical_block_address, end))
+        settle_line(i);
+
+    // Source is borrowed from caller, so it is written before return. Other
+    // queued line writes go in the same sweep
+    io_submit_write(source, logical_block_address, block_count);
+    io_unplug();
+    for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+    {
+      struct BlockCacheLine *line = &block_cache_state.line[i];
+      retire_line(i);
+      if (!is_line_in_range(i, logical_block_address, end))
+        continue;
+      uint32_t line_lba = line->line_number * BLOCK_CACHE_LINE_BLOCK_COUNT;
+      for (uint32_t j = 0; j < BLOCK_CACHE_LINE_BLOCK_COUNT; j++)
+        if (line_lba + j >= logical_block_address && line_lba + j < end)
+          memcpy(line->buf + j * BLOCK_SIZE,
+                 source + (line_lba + j - logical_block_address) * BLOCK_SIZE, BLOCK_SIZE);
+      if (line->dirty && line_lba >= logical_block_address && line_lba + BLOCK_CACHE_LINE_BLOCK_COUNT <= end)
+      {
+        line->dirty = FALSE;
+        block_cache_state.dirty_count--;
+      }
+    }
+    return io_take_write_status();
+  }
+
+  while (logical_block_address < end)
+  {
+    uint32_t offset = logical_block_address % BLOCK_CACHE_LINE_BLOCK_COUNT;
+    uint32_t count = BLOCK_CACHE_LINE_BLOCK_COUNT - offset;
+    if (count > end - logical_block_address)
+      count = end - logical_block_address;
+
+    // Partial line write need the rest of the line from disk
+    bool partial = count != BLOCK_CACHE_LINE_BLOCK_COUNT;
+    int16_t index = get_line(logical_block_address / BLOCK_CACHE_LINE_BLOCK_COUNT, partial);
+    if (index == BLOCK_CACHE_NONE)
+      return FALSE;
+    struct BlockCacheLine *line = &block_cache_state.line[index];
+    settle_line(index);
+    memcpy(line->buf + offset * BLOCK_SIZE, source, count * BLOCK_SIZE);
+    if (!line->dirty)
+    {
+      line->dirty = TRUE;
+      block_cache_state.dirty_count++;
+    }
+
+    source += count * BLOCK_SIZE;
+    logical_block_address += count;
+  }
+
+  // Dirty lines are queued, dispatched later by the scheduler
+  if (block_cache_state.dirty_count >= BLOCK_CACHE_DIRTY_THRESHOLD)
+    for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+      if (block_cache_state.line[i].valid)
+        write_back_line(i);
+  return TRUE;
+}
+
+void block_cache_prefetch(uint32_t logical_block_address, uint32_t block_count)
+{
+  uint32_t line_number = logical_block_address / BLOCK_CACHE_LINE_BLOCK_COUNT;
+  uint32_t end_line = (logical_block_address + block_count + BLOCK_CACHE_LINE_BLOCK_COUNT - 1) /
+                      BLOCK_CACHE_LINE_BLOCK_COUNT;
+
+  while (line_number < end_line)
+  {
+    if (find_line(line_number) != BLOCK_CACHE_NONE)
+    {
+      line_number++;
+      continue;
+    }
+
+    // Longest span of missing lines, read with single command
+    uint32_t span = 0;
+    while (line_number + span < end_line && span < BLOCK_CACHE_READ_AHEAD_LINE_COUNT &&
+           find_line(line_number + span) == BLOCK_CACHE_NONE)
+      span++;
+
+    // Read-ahead is only a hint, failed span is left for the demand read
+    if (!io_read(read_ahead_buffer, line_number * BLOCK_CACHE_LINE_BLOCK_COUNT,
+                 span * BLOCK_CACHE_LINE_BLOCK_COUNT))
+    {
+      line_number += span;
+      continue;
+    }
+    for (uint32_t i = 0; i < span; i++)
+    {
+      int16_t index = allocate_line(line_number + i);
+      memcpy(block_cache_state.line[index].buf, read_ahead_buffer + i * BLOCK_CACHE_LINE_SIZE,
+             BLOCK_CACHE_LINE_SIZE);
+    }
+    block_cache_state.statistic.read_ahead += span;
+    line_number += span;
+  }
+}
+
+bool block_cache_flush(void)
+{
+  // Every dirty line is queued first, so the scheduler sort and merge them
+  for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+    if (block_cache_state.line[i].valid)
+      write_back_line(i);
+  io_unplug();
+  for (int16_t i = 0; i < BLOCK_CACHE_LINE_COUNT; i++)
+    retire_line(i);
+  return io_take_write_status();
+}
+
+void get_block_cache_statistic(struct BlockCacheStatistic *statistic)
+{
+  *statistic = block_cache_state.statistic;
+}
@@ -0,0 +1,168 @@
+#include "lib-header/blockdev.h"
+#include "lib-header/disk.h"
+#include "lib-header/ramdisk.h"
+#include "lib-header/nvme.h"
+#include "lib-header/virtio.h"
+#include "lib-header/ahci.h"
+#include "lib-header/raid.h"
+#include "lib-header/iostat.h"
+#include "lib-header/portio.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+
+uint8_t block_device_bounce_buffer[DMA_BOUNCE_BUFFER_SIZE] __attribute__((aligned(DMA_BOUNCE_BUFFER_SIZE)));
+static struct BlockBounceState block_bounce_state;
+
+// Errors reported by the active backend, cleared when returned to caller
+static bool block_device_read_failed;
+static bool block_device_write_failed;
+
+// Probe order, RAM disk only exist when GRUB load the image module, ATA is
+// last as it always accept the legacy primary channel
+static const struct BlockDeviceOperation *block_device_list[] = {
+    &ramdisk_block_device,
+    &nvme_block_device,
+    &virtio_blk_block_device,
+    &ahci_block_device,
+    &raid0_block_device,
+    &ata_block_device,
+};
+
+static const struct BlockDeviceOperation *block_device = &ata_block_device;
+
+void *block_bounce_map(void *buf, uint32_t *block_count, bool is_write)
+{
+  // Only kernel higher half is linear mapped
+  if ((uint32_t)buf >= KERNEL_VIRTUAL_BASE)
+    return buf;
+
+  uint32_t free_block = (DMA_BOUNCE_BUFFER_SIZE - block_bounce_state.offset) / BLOCK_SIZE;
+  if (free_block == 0 || block_bounce_state.copy_count == BLOCK_BOUNCE_COPY_COUNT)
+    return 0;
+  if (*block_count > free_block)
+    *block_count = free_block;
+
+  uint8_t *bounce = block_device_bounce_buffer + block_bounce_state.offset;
+  if (is_write)
+    memcpy(bounce, buf, *block_count * BLOCK_SIZE);
+  else
+  {
+    struct BlockBounceCopy *copy = &block_bounce_state.copy[block_bounce_state.copy_count++];
+    copy->target = (uint8_t *)buf;
+    copy->source = bounce;
+    copy->size = *block_count * BLOCK_SIZE;
+  }
+  block_bounce_state.offset += *block_count * BLOCK_SIZE;
+  return bounce;
+}
+
+void block_bounce_release(void)
+{
+  for (uint32_t i = 0; i < block_bounce_state.copy_count; i++)
+    memcpy(block_bounce_state.copy[i].target, block_bounce_state.copy[i].source, block_bounce_state.copy[i].size);
+  block_bounce_state.offset = 0;
+  block_bounce_state.copy_count = 0;
+}
+
+void block_device_report_error(bool is_write)
+{
+  if (is_write)
+    block_device_write_failed = TRUE;
+  else
+    block_device_read_failed = TRUE;
+}
+
+// Take write error reported since the last call
+static bool take_write_status(void)
+{
+  bool ok = !block_device_write_failed;
+  block_device_write_failed = FALSE;
+  return ok;
+}
+
+void initialize_disk(void)
+{
+  for (uint32_t i = 0; i < sizeof(block_device_list) / sizeof(block_device_list[0]); i++)
+  {
+    if (block_device_list[i]->probe())
+    {
+      block_device = block_device_list[i];
+      return;
+    }
+  }
+}
+
+const char *get_block_device_name(void)
+{
+  return block_device->name;
+}
+
+uint32_t get_disk_block_count(void)
+{
+  return block_device->get_block_count();
+}
+
+bool read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  uint64_t start_cycle = read_tsc();
+  block_device_read_failed = FALSE;
+  block_device->read_blocks(ptr, logical_block_address, block_count);
+  iostat_record(IOSTAT_READ_BLOCKS, block_count * BLOCK_SIZE, read_tsc() - start_cycle);
+  return !block_device_read_failed;
+}
+
+// Blocking write, error is kept for write_block_segments() or wait_blocks()
+static void issue_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                 uint32_t logical_block_address)
+{
+  uint64_t start_cycle = read_tsc();
+  uint32_t block_count = 0;
+  for (uint32_t i = 0; i < segment_count; i++)
+    block_count += segment[i].block_count;
+  block_device->write_block_segments(segment, segment_count, logical_block_address);
+  iostat_record(IOSTAT_WRITE_BLOCKS, block_count * BLOCK_SIZE, read_tsc() - start_cycle);
+}
+
+bool write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                          uint32_t logical_block_address)
+{
+  issue_block_segments(segment, segment_count, logical_block_address);
+  return take_write_status();
+}
+
+void submit_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                           uint32_t logical_block_address)
+{
+  if (!block_device->submit_write_segments)
+  {
+    issue_block_segments(segment, segment_count, logical_block_address);
+    return;
+  }
+
+  // Latency only cover submission, completion is awaited by wait_blocks()
+  uint64_t start_cycle = read_tsc();
+  uint32_t block_count = 0;
+  for (uint32_t i = 0; i < segment_count; i++)
+    block_count += segment[i].block_count;
+  block_device->submit_write_segments(segment, segment_count, logical_block_address);
+  iostat_record(IOSTAT_WRITE_BLOCKS, block_count * BLOCK_SIZE, read_tsc() - start_cycle);
+}
+
+bool wait_blocks(void)
+{
+  if (block_device->wait)
+    block_device->wait();
+  return take_write_status();
+}
+
+void shutdown_disk(void)
+{
+  if (block_device->shutdown)
+    block_device->shutdown();
+}
+
+bool write_blocks(const void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  struct BlockSegment segment = {.buf = ptr, .block_count = block_count};
+  return write_block_segments(&segment, 1, logical_block_address);
+}
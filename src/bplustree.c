@@ -8,6 +8,12 @@ static uint32_t node_index = 0; // Current index in the buffer nodes
 static struct PCNode pcNodes[MAX_NODES]; // Static buffer to hold PCNodes
 static uint32_t pc_node_index = 0; // Current index in the buffer PCNodes
 
+// Nodes and PCNodes released by deletion, reused before the buffers grow
+static struct NodeFileSystem *free_nodes[MAX_NODES];
+static uint32_t free_node_count = 0;
+static struct PCNode *free_pcnodes[MAX_NODES];
+static uint32_t free_pcnode_count = 0;
+
 struct NodeFileSystem *make_tree(char *file_name, char* ext, uint32_t parent_cluster_number){
     // Malloc new leaf
     struct NodeFileSystem *newTree = make_leaf();
@@ -28,9 +34,14 @@ struct NodeFileSystem *make_tree(char *file_name, char* ext, uint32_t parent_clu
 }
 
 struct PCNode *make_pcnode(uint32_t parent_cluster_number, char *ext){
-    // Create a new Parent Cluster Node
-    struct PCNode *node = &pcNodes[pc_node_index];
-    pc_node_index++;
+    // Create a new Parent Cluster Node, released one first
+    struct PCNode *node;
+    if(free_pcnode_count > 0){
+        node = free_pcnodes[--free_pcnode_count];
+    } else {
+        node = &pcNodes[pc_node_index];
+        pc_node_index++;
+    }
 
     // Insert parent_cluster_number and extension
     node->parent_cluster_number[0] = parent_cluster_number;
@@ -41,14 +52,22 @@ struct PCNode *make_pcnode(uint32_t parent_cluster_number, char *ext){
 }
 
 struct NodeFileSystem *make_node(){
-    // Create a new node
-    struct NodeFileSystem *node = &nodes[node_index];
-    node_index++;
+    // Create a new node, released one first
+    struct NodeFileSystem *node;
+    if(free_node_count > 0){
+        node = free_nodes[--free_node_count];
+    } else {
+        node = &nodes[node_index];
+        node_index++;
+    }
 
     // Initialize node's attributes
     node->leaf = FALSE;
     node->number_of_keys = 0;
     node->parent = NULL;
+    for(uint32_t i = 0; i < MAX_CHILDREN + 1; i++){
+        node->children[i] = NULL;
+    }
 
     return node;
 }
@@ -113,9 +132,19 @@ struct NodeFileSystem *insert(struct NodeFileSystem *root, char *file_name, char
     // Search if key already exists
     newPCN = find_pcn(root, file_name);
     if(newPCN != NULL){
+        // Full PCNode drop the item, whereis list the first MAX_SAME_TARGET only
+        if(newPCN->n_of_items == MAX_SAME_TARGET){
+            return root;
+        }
         return insert_another_pcn(root, newPCN, parent_cluster_number, ext);
     }
 
+    // Pools are static, name left out once they run low is not found by whereis
+    if((pc_node_index == MAX_NODES && free_pcnode_count == 0) ||
+       node_index + MAX_SPLIT_NODES > MAX_NODES + free_node_count){
+        return root;
+    }
+
     // Create new PCNode
     newPCN = make_pcnode(parent_cluster_number, ext);
 
@@ -377,43 +406,287 @@ uint32_t get_left_index(struct NodeFileSystem *parent, struct NodeFileSystem *le
     return left_index;
 }
 
-void initialize_b_tree(struct NodeFileSystem *root, char *dir_name, uint32_t parent_cluster_number, uint32_t dir_cluster_number){
-    struct FAT32DirectoryTable dir_table[10];
-    struct FAT32DriverRequest read_folder_request = {
-        .buf = dir_table,
-        .ext = "\0\0\0",
-        .parent_cluster_number = parent_cluster_number,
-        .buffer_size = sizeof(struct FAT32DirectoryTable) * 10,
-    };
-    memcpy(read_folder_request.name, dir_name, 8);
-    int tes = read_directory(read_folder_request);
-    if(tes){}
-    for (uint32_t i = 0; i < 10; i++)
+void initialize_b_tree(struct NodeFileSystem *root, uint32_t dir_cluster_number){
+    // Walk the chain one table at a time, directory of any length fit
+    struct FAT32DirectoryTable dir_table;
+    uint32_t table_cluster_number = dir_cluster_number;
+    while (table_cluster_number != FAT32_FAT_END_OF_FILE)
     {
-        uint32_t counter_entry = 0;
-        for (uint32_t j = 1; j < CLUSTER_SIZE / sizeof(struct FAT32DirectoryEntry) && counter_entry < dir_table[0].table[0].n_of_entries; j++)
+        read_directory_table(&dir_table, table_cluster_number);
+        table_cluster_number = get_fat_entry(table_cluster_number);
+
+        // Deleted entries leave holes, every slot is checked
+        for (uint32_t j = 1; j < CLUSTER_SIZE / sizeof(struct FAT32DirectoryEntry); j++)
         {
-            counter_entry++;
-            root = BPlusTree;
-            if (dir_table[i].table[j].attribute == ATTR_SUBDIRECTORY)
-            {
-                BPlusTree = insert(root, dir_table[i].table[j].name, dir_table[i].table[j].ext, dir_cluster_number);
-                root = BPlusTree;
-                if(memcmp(dir_name, "root\0\0\0\0", 8) == 0){
-                    initialize_b_tree(BPlusTree, dir_table[i].table[j].name, (dir_table[i].table[0].cluster_high << 16) + dir_table[i].table[0].cluster_low, (dir_table[i].table[j].cluster_high << 16) + dir_table[i].table[j].cluster_low);
-                } else {
-                    initialize_b_tree(BPlusTree, dir_table[i].table[j].name, dir_cluster_number, (dir_table[i].table[j].cluster_high << 16) + dir_table[i].table[j].cluster_low);
-                }
-            }
-            else if (!is_entry_empty(&dir_table[i].table[j]))
+            struct FAT32DirectoryEntry *entry = &dir_table.table[j];
+            if (is_entry_empty(entry))
+                continue;
+
+            root = insert(root, entry->name, entry->ext, dir_cluster_number);
+            BPlusTree = root;
+            if (entry->attribute == ATTR_SUBDIRECTORY)
             {
-                BPlusTree = insert(root, dir_table[i].table[j].name, dir_table[i].table[j].ext, dir_cluster_number);
+                initialize_b_tree(root, get_entry_cluster_number(entry));
                 root = BPlusTree;
             }
         }
     }
 }
 
+struct NodeFileSystem *remove_from_tree(struct NodeFileSystem *root, char *file_name, char *ext, uint32_t parent_cluster_number){
+    // Find leaf and PCNode of the target name
+    struct NodeFileSystem *leaf = find_leaf(root, file_name);
+    struct PCNode *pcn = find_pcn(root, file_name);
+
+    // Target name not in the tree (dropped when the pools ran low)
+    if(pcn == NULL){
+        return root;
+    }
+
+    // Remove the single item, other targets with the same name stay
+    if(!remove_pcn_item(pcn, parent_cluster_number, ext)){
+        return root;
+    }
+
+    // Key is removed only when no target with its name is left
+    if(pcn->n_of_items > 0){
+        return root;
+    }
+
+    root = delete_key(root, leaf, file_name, pcn);
+    free_pcnodes[free_pcnode_count++] = pcn;
+
+    return root;
+}
+
+bool remove_pcn_item(struct PCNode *node, uint32_t parent_cluster_number, char *ext){
+    // Find item with the same parent cluster number and extension
+    uint32_t i = 0;
+    while(i < node->n_of_items && (node->parent_cluster_number[i] != parent_cluster_number || memcmp(node->ext[i], ext, 3) != 0)){
+        i++;
+    }
+
+    // If item not found
+    if(i == node->n_of_items){
+        return FALSE;
+    }
+
+    // Shift items to left to fill the removed one
+    for(i++; i < node->n_of_items; i++){
+        node->parent_cluster_number[i - 1] = node->parent_cluster_number[i];
+        memcpy(node->ext[i - 1], node->ext[i], 3);
+    }
+    node->n_of_items--;
+
+    return TRUE;
+}
+
+struct NodeFileSystem *delete_key(struct NodeFileSystem *root, struct NodeFileSystem *n, char *file_name, void *child){
+    uint32_t min_keys, capacity;
+    int32_t neighbor_index;
+    uint32_t k_prime_index;
+    struct NodeFileSystem *neighbor;
+    char k_prime[8];
+
+    // Remove key and child from node
+    remove_key_from_node(n, file_name, child);
+
+    // If node is the root, shrink it if needed
+    if(n == root){
+        return adjust_root(root);
+    }
+
+    // Node still has enough keys (balanced)
+    min_keys = n->leaf ? ceil(MAX_CHILDREN - 1, 2) : ceil(MAX_CHILDREN, 2) - 1;
+    if(n->number_of_keys >= min_keys){
+        return root;
+    }
+
+    // Find neighbor and key between node and neighbor in parent
+    neighbor_index = get_neighbor_index(n);
+    k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
+    memcpy(k_prime, n->parent->keys[k_prime_index], 8);
+    neighbor = neighbor_index == -1 ? n->parent->children[1] : n->parent->children[neighbor_index];
+
+    // Merge if both nodes fit into one, else borrow from neighbor
+    capacity = n->leaf ? MAX_CHILDREN : MAX_CHILDREN - 1;
+    if(neighbor->number_of_keys + n->number_of_keys < capacity){
+        return coalesce_nodes(root, n, neighbor, neighbor_index, k_prime);
+    }
+
+    return redistribute_nodes(root, n, neighbor, neighbor_index, k_prime_index, k_prime);
+}
+
+void remove_key_from_node(struct NodeFileSystem *n, char *file_name, void *child){
+    uint32_t i, number_of_children;
+
+    // Remove the key and shift other keys to left
+    i = 0;
+    while(memcmp(n->keys[i], file_name, 8) != 0){
+        i++;
+    }
+    for(i++; i < n->number_of_keys; i++){
+        memcpy(n->keys[i - 1], n->keys[i], 8);
+    }
+
+    // Remove the child and shift other children to left
+    number_of_children = n->leaf ? n->number_of_keys : n->number_of_keys + 1;
+    i = 0;
+    while(n->children[i] != child){
+        i++;
+    }
+    for(i++; i < number_of_children; i++){
+        n->children[i - 1] = n->children[i];
+    }
+
+    // Decrement number of keys
+    n->number_of_keys--;
+
+    // Remove children that have no keys, leaf keep its pointer to next leaf
+    if(n->leaf){
+        for(i = n->number_of_keys; i < MAX_CHILDREN - 1; i++){
+            n->children[i] = NULL;
+        }
+    } else {
+        for(i = n->number_of_keys + 1; i < MAX_CHILDREN; i++){
+            n->children[i] = NULL;
+        }
+    }
+}
+
+struct NodeFileSystem *adjust_root(struct NodeFileSystem *root){
+    // Root still has keys, or root is a leaf (empty leaf stay as root)
+    if(root->number_of_keys > 0 || root->leaf){
+        return root;
+    }
+
+    // Root has no key but one child, the child become the new root
+    struct NodeFileSystem *new_root = root->children[0];
+    new_root->parent = NULL;
+    free_nodes[free_node_count++] = root;
+
+    return new_root;
+}
+
+int32_t get_neighbor_index(struct NodeFileSystem *n){
+    // Index of the left neighbor of node in its parent, -1 if node is the leftmost child
+    uint32_t i = 0;
+    while(i <= n->parent->number_of_keys && n->parent->children[i] != n){
+        i++;
+    }
+
+    return (int32_t)i - 1;
+}
+
+struct NodeFileSystem *coalesce_nodes(struct NodeFileSystem *root, struct NodeFileSystem *n, struct NodeFileSystem *neighbor, int32_t neighbor_index, char *k_prime){
+    uint32_t i, j, neighbor_insertion_index, n_end;
+    struct NodeFileSystem *temp;
+
+    // Node is the leftmost child, merge its right neighbor into it instead
+    if(neighbor_index == -1){
+        temp = n;
+        n = neighbor;
+        neighbor = temp;
+    }
+
+    neighbor_insertion_index = neighbor->number_of_keys;
+
+    if(!n->leaf){
+        // Key from parent goes between the keys of both nodes
+        memcpy(neighbor->keys[neighbor_insertion_index], k_prime, 8);
+        neighbor->number_of_keys++;
+
+        // Append keys and children of node to neighbor
+        n_end = n->number_of_keys;
+        for(i = neighbor_insertion_index + 1, j = 0; j < n_end; i++, j++){
+            memcpy(neighbor->keys[i], n->keys[j], 8);
+            neighbor->children[i] = n->children[j];
+            neighbor->number_of_keys++;
+            n->number_of_keys--;
+        }
+        neighbor->children[i] = n->children[j];
+
+        // Assign children's parent to neighbor
+        for(i = 0; i < neighbor->number_of_keys + 1; i++){
+            temp = (struct NodeFileSystem *) neighbor->children[i];
+            temp->parent = neighbor;
+        }
+    } else {
+        // Append keys and PCNodes of leaf to neighbor
+        for(i = neighbor_insertion_index, j = 0; j < n->number_of_keys; i++, j++){
+            memcpy(neighbor->keys[i], n->keys[j], 8);
+            neighbor->children[i] = n->children[j];
+            neighbor->number_of_keys++;
+        }
+        neighbor->children[MAX_CHILDREN - 1] = n->children[MAX_CHILDREN - 1];
+    }
+
+    // Remove key and pointer of the merged node from parent
+    root = delete_key(root, n->parent, k_prime, n);
+    free_nodes[free_node_count++] = n;
+
+    return root;
+}
+
+struct NodeFileSystem *redistribute_nodes(struct NodeFileSystem *root, struct NodeFileSystem *n, struct NodeFileSystem *neighbor, int32_t neighbor_index, uint32_t k_prime_index, char *k_prime){
+    uint32_t i;
+    struct NodeFileSystem *temp;
+
+    if(neighbor_index != -1){
+        // Neighbor is on the left, move its last key and child to the front of node
+        if(!n->leaf){
+            n->children[n->number_of_keys + 1] = n->children[n->number_of_keys];
+        }
+        for(i = n->number_of_keys; i > 0; i--){
+            memcpy(n->keys[i], n->keys[i - 1], 8);
+            n->children[i] = n->children[i - 1];
+        }
+
+        if(!n->leaf){
+            n->children[0] = neighbor->children[neighbor->number_of_keys];
+            temp = (struct NodeFileSystem *) n->children[0];
+            temp->parent = n;
+            neighbor->children[neighbor->number_of_keys] = NULL;
+            memcpy(n->keys[0], k_prime, 8);
+            memcpy(n->parent->keys[k_prime_index], neighbor->keys[neighbor->number_of_keys - 1], 8);
+        } else {
+            n->children[0] = neighbor->children[neighbor->number_of_keys - 1];
+            neighbor->children[neighbor->number_of_keys - 1] = NULL;
+            memcpy(n->keys[0], neighbor->keys[neighbor->number_of_keys - 1], 8);
+            memcpy(n->parent->keys[k_prime_index], n->keys[0], 8);
+        }
+    } else {
+        // Node is the leftmost child, move first key and child of right neighbor to the end of node
+        if(n->leaf){
+            memcpy(n->keys[n->number_of_keys], neighbor->keys[0], 8);
+            n->children[n->number_of_keys] = neighbor->children[0];
+            memcpy(n->parent->keys[k_prime_index], neighbor->keys[1], 8);
+        } else {
+            memcpy(n->keys[n->number_of_keys], k_prime, 8);
+            n->children[n->number_of_keys + 1] = neighbor->children[0];
+            temp = (struct NodeFileSystem *) n->children[n->number_of_keys + 1];
+            temp->parent = n;
+            memcpy(n->parent->keys[k_prime_index], neighbor->keys[0], 8);
+        }
+
+        // Shift keys and children of neighbor to left
+        for(i = 0; i < neighbor->number_of_keys - 1; i++){
+            memcpy(neighbor->keys[i], neighbor->keys[i + 1], 8);
+            neighbor->children[i] = neighbor->children[i + 1];
+        }
+        if(!n->leaf){
+            neighbor->children[i] = neighbor->children[i + 1];
+        }
+        neighbor->children[neighbor->number_of_keys - 1 + (n->leaf ? 0 : 1)] = NULL;
+    }
+
+    // Update number of keys
+    n->number_of_keys++;
+    neighbor->number_of_keys--;
+
+    return root;
+}
+
 uint8_t whereis_main(struct RequestSearch *request){
     // Find PCNode that has target name
     struct PCNode *result = find_pcn(BPlusTree, request->search);
@@ -431,8 +704,8 @@ uint8_t whereis_main(struct RequestSearch *request){
 void reset_nodes(){
     for(int i = 0; i < MAX_NODES; i++){
         // Reset Nodes
-        for(int j = 0 ; j < MAX_CHILDREN; j++){
-            nodes[i].children[i] = NULL;
+        for(int j = 0 ; j < MAX_CHILDREN + 1; j++){
+            nodes[i].children[j] = NULL;
         }
         nodes[i].number_of_keys = 0;
         nodes[i].leaf = FALSE;
@@ -440,11 +713,17 @@ void reset_nodes(){
 
         // Reset PCNodes
         for(int j = 0; j < MAX_SAME_TARGET; j++){
-            pcNodes[i].parent_cluster_number[i] = 0;
-            memcpy(pcNodes[i].ext, "\0\0\0", 3);
+            pcNodes[i].parent_cluster_number[j] = 0;
+            memcpy(pcNodes[i].ext[j], "\0\0\0", 3);
         }
         pcNodes[i].n_of_items = 0;
     }
+
+    // Rebuilt tree start from the beginning of the pools
+    node_index = 0;
+    pc_node_index = 0;
+    free_node_count = 0;
+    free_pcnode_count = 0;
 }
 
 void create_b_tree(){
@@ -452,5 +731,5 @@ void create_b_tree(){
 
     // Initialize B+ Tree
     BPlusTree = make_tree("root\0\0\0\0", "\0\0\0", 2);
-    initialize_b_tree(BPlusTree, "root\0\0\0\0", 2, 2);
+    initialize_b_tree(BPlusTree, ROOT_CLUSTER_NUMBER);
 }
\ No newline at end of file
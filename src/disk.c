@@ -1,63 +1,446 @@
 #include "lib-header/disk.h"
 #include "lib-header/portio.h"
 #include "lib-header/framebuffer.h"
+#include "lib-header/pci.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+#include "lib-header/interrupt.h"
 
-static void ATA_busy_wait()
+static struct ATADriverState ata_driver_state = {
+    .channel = {
+        {.io_base = ATA_PRIMARY_IO_BASE, .control_base = ATA_PRIMARY_CONTROL, .irq = IRQ_PRIMARY_ATA},
+        {.io_base = ATA_SECONDARY_IO_BASE, .control_base = ATA_SECONDARY_CONTROL, .irq = IRQ_SECOND_ATA},
+    },
+};
+
+// PRD table and DMA buffer must be physically contiguous, kernel memory is
+// mapped linearly so static buffers satisfy this. Single drive DMA use the
+// shared block_device_bounce_buffer, covered by single PRD per channel
+static struct PhysicalRegionDescriptor dma_prd_table[ATA_CHANNEL_COUNT] __attribute__((aligned(0x10)));
+
+static struct ATAChannel *ATA_channel(uint8_t drive)
 {
-  while (in(0x1F7) & ATA_STATUS_BSY)
+  return &ata_driver_state.channel[ATA_DRIVE_CHANNEL(drive)];
+}
+
+static void ATA_busy_wait(struct ATAChannel *channel)
+{
+  while (in(channel->io_base + ATA_REG_STATUS) & ATA_STATUS_BSY)
     ;
 }
 
-static void ATA_DRQ_wait()
+static void ATA_DRQ_wait(struct ATAChannel *channel)
 {
-  while (!(in(0x1F7) & ATA_STATUS_RDY))
+  while (!(in(channel->io_base + ATA_REG_STATUS) & ATA_STATUS_RDY))
     ;
 }
 
-void read_blocks(void *ptr, uint32_t logical_block_address,
-                 uint8_t block_count)
+/**
+ * Sleep with hlt until ata_isr() signal the channel interrupt. Interrupt is enabled
+ * while waiting (syscall is entered with IF cleared) and restored afterwards.
+ * Note : sti delay interrupt until after the next instruction, no wakeup is lost
+ * between checking irq_received and hlt
+ */
+static void ATA_irq_wait(struct ATAChannel *channel)
+{
+  uint32_t eflags;
+  __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : /* <Empty> */ : "memory");
+  while (!channel->irq_received)
+    __asm__ volatile("sti; hlt; cli" : /* <Empty> */ : /* <Empty> */ : "memory");
+  channel->irq_received = FALSE;
+  if (eflags & EFLAGS_IF)
+    __asm__ volatile("sti");
+}
+
+void ata_isr(uint8_t channel_index)
+{
+  struct ATAChannel *channel = &ata_driver_state.channel[channel_index];
+  // Reading status register also acknowledge the drive interrupt
+  channel->irq_status = in(channel->io_base + ATA_REG_STATUS);
+  channel->irq_received = TRUE;
+  pic_ack(channel->irq);
+}
+
+/**
+ * Program drive select, LBA and sector count register. LBA48 write the
+ * high-order byte of each register first, 16-bit sector count 0 means 65536 blocks.
+ * Note : logical_block_address is 32-bit, LBA bit 32-47 always zero
+ */
+static void ATA_select(uint8_t drive, uint32_t logical_block_address, uint32_t block_count, bool lba48)
+{
+  uint16_t io_base = ATA_channel(drive)->io_base;
+  uint8_t slave = ATA_DRIVE_IS_SLAVE(drive) ? ATA_DRIVE_SELECT_SLAVE : 0;
+  if (lba48)
+  {
+    out(io_base + ATA_REG_DRIVE_SELECT, 0x40 | slave);
+    out(io_base + ATA_REG_SECTOR_COUNT, (uint8_t)(block_count >> 8));
+    out(io_base + ATA_REG_LBA_LOW, (uint8_t)(logical_block_address >> 24));
+    out(io_base + ATA_REG_LBA_MID, 0);
+    out(io_base + ATA_REG_LBA_HIGH, 0);
+  }
+  else
+    out(io_base + ATA_REG_DRIVE_SELECT, 0xE0 | slave | ((logical_block_address >> 24) & 0xF));
+  out(io_base + ATA_REG_SECTOR_COUNT, (uint8_t)block_count);
+  out(io_base + ATA_REG_LBA_LOW, (uint8_t)logical_block_address);
+  out(io_base + ATA_REG_LBA_MID, (uint8_t)(logical_block_address >> 8));
+  out(io_base + ATA_REG_LBA_HIGH, (uint8_t)(logical_block_address >> 16));
+}
+
+// LBA28 command only if whole extent is addressable and fit in 8-bit sector count
+static bool ATA_need_lba48(uint8_t drive, uint32_t logical_block_address, uint32_t block_count)
+{
+  return ata_driver_state.drive[drive].lba48_supported &&
+         (block_count > ATA_LBA28_MAX_BLOCK_PER_COMMAND ||
+          logical_block_address + block_count - 1 > ATA_LBA28_MAX_ADDRESS);
+}
+
+/**
+ * Issue IDENTIFY DEVICE with polling, interrupt is not yet enabled.
+ * Fill lba48_supported and block_count of the drive, block_count stay 0
+ * if no ATA drive answer (empty position, floating bus or ATAPI)
+ */
+static void ATA_identify(uint8_t drive)
+{
+  struct ATAChannel *channel = ATA_channel(drive);
+  struct ATADrive *state = &ata_driver_state.drive[drive];
+  uint16_t io_base = channel->io_base;
+  uint16_t identify[HALF_BLOCK_SIZE];
+  state->lba48_supported = FALSE;
+  state->block_count = 0;
+
+  // Alternate status read 4 times give the drive 400 ns to answer selection
+  out(io_base + ATA_REG_DRIVE_SELECT, 0xA0 | (ATA_DRIVE_IS_SLAVE(drive) ? ATA_DRIVE_SELECT_SLAVE : 0));
+  for (uint8_t i = 0; i < 4; i++)
+    in(channel->control_base);
+  out(io_base + ATA_REG_SECTOR_COUNT, 0);
+  out(io_base + ATA_REG_LBA_LOW, 0);
+  out(io_base + ATA_REG_LBA_MID, 0);
+  out(io_base + ATA_REG_LBA_HIGH, 0);
+  out(io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+  // Status 0 means no drive, 0xFF no channel, non-zero LBA mid / high means ATAPI or SATA signature
+  uint8_t status = in(io_base + ATA_REG_STATUS);
+  if (status == 0 || status == 0xFF)
+    return;
+  ATA_busy_wait(channel);
+  if (in(io_base + ATA_REG_LBA_MID) || in(io_base + ATA_REG_LBA_HIGH))
+    return;
+  do
+  {
+    status = in(io_base + ATA_REG_STATUS);
+  } while (!(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR)));
+  if (status & ATA_STATUS_ERR)
+    return;
+
+  for (uint32_t i = 0; i < HALF_BLOCK_SIZE; i++)
+    identify[i] = in16(io_base + ATA_REG_DATA);
+
+  state->block_count = identify[ATA_IDENTIFY_LBA28_BLOCK_COUNT] |
+                       ((uint32_t)identify[ATA_IDENTIFY_LBA28_BLOCK_COUNT + 1] << 16);
+  if (identify[ATA_IDENTIFY_COMMAND_SET_2] & ATA_IDENTIFY_LBA48_SUPPORTED)
+  {
+    state->lba48_supported = TRUE;
+    // Clamp 48-bit count into 32-bit LBA used by the kernel
+    bool above_32_bit = identify[ATA_IDENTIFY_LBA48_BLOCK_COUNT + 2] ||
+                        identify[ATA_IDENTIFY_LBA48_BLOCK_COUNT + 3];
+    state->block_count = above_32_bit ? 0xFFFFFFFF
+                                      : (identify[ATA_IDENTIFY_LBA48_BLOCK_COUNT] |
+                                         ((uint32_t)identify[ATA_IDENTIFY_LBA48_BLOCK_COUNT + 1] << 16));
+  }
+}
+
+static uint32_t ATA_get_block_count(void)
+{
+  return ata_driver_state.drive[0].block_count;
+}
+
+uint32_t ata_get_drive_block_count(uint8_t drive)
+{
+  return ata_driver_state.drive[drive].block_count;
+}
+
+bool ata_dma_available(uint8_t drive)
+{
+  return ATA_channel(drive)->dma_available;
+}
+
+/**
+ * Identify all four drives and enable interrupt of both channels, requests
+ * will sleep with hlt until IRQ 14 / 15. Then detect PCI IDE controller with
+ * bus-master capability, channels it drive use DMA, else keep using PIO.
+ * Legacy ports are assumed present, so probe always succeed
+ */
+static bool ATA_probe(void)
+{
+  struct PCIDevice ide_controller;
+  for (uint8_t drive = 0; drive < ATA_DRIVE_COUNT; drive++)
+    ATA_identify(drive);
+
+  // Clear nIEN (bit 1), drive will raise IRQ on every data block and command completion
+  for (uint8_t i = 0; i < ATA_CHANNEL_COUNT; i++)
+  {
+    struct ATAChannel *channel = &ata_driver_state.channel[i];
+    out(channel->control_base, 0);
+    channel->irq_received = FALSE;
+    channel->irq_enabled = TRUE;
+    channel->dma_available = FALSE;
+  }
+
+  if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &ide_controller))
+    return TRUE;
+
+  // Prog IF bit 7 : bus-master capable, bit 0 / 2 : primary / secondary channel
+  // in PCI native mode. Only compatibility mode (legacy ports) is supported
+  uint8_t prog_if = pci_config_read8(ide_controller, PCI_PROG_IF);
+  uint32_t bar4 = pci_config_read32(ide_controller, PCI_BAR4);
+  if (!(prog_if & 0x80) || !(bar4 & 0x1))
+    return TRUE;
+
+  pci_enable_bus_master(ide_controller);
+  for (uint8_t i = 0; i < ATA_CHANNEL_COUNT; i++)
+  {
+    struct ATAChannel *channel = &ata_driver_state.channel[i];
+    channel->bus_master_base = (uint16_t)(bar4 & 0xFFFC) + i * BM_CHANNEL_STRIDE;
+    channel->dma_available = (prog_if & (1u << (2 * i))) == 0;
+  }
+  return TRUE;
+}
+
+static void ATA_PIO_read_blocks(uint8_t drive, void *ptr, uint32_t logical_block_address,
+                                uint32_t block_count, bool lba48)
 {
-  ATA_busy_wait();
-  out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
-  out(0x1F2, block_count);
-  out(0x1F3, (uint8_t)logical_block_address);
-  out(0x1F4, (uint8_t)(logical_block_address >> 8));
-  out(0x1F5, (uint8_t)(logical_block_address >> 16));
-  out(0x1F7, 0x20);
+  struct ATAChannel *channel = ATA_channel(drive);
+  ATA_busy_wait(channel);
+  ATA_select(drive, logical_block_address, block_count, lba48);
+  channel->irq_received = FALSE;
+  out(channel->io_base + ATA_REG_COMMAND, lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
 
   uint16_t *target = (uint16_t *)ptr;
 
   for (uint32_t i = 0; i < block_count; i++)
   {
-    ATA_busy_wait();
-    ATA_DRQ_wait();
+    // Drive interrupt each time a block is ready in data port
+    if (channel->irq_enabled)
+      ATA_irq_wait(channel);
+    ATA_busy_wait(channel);
+    ATA_DRQ_wait(channel);
     for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-      target[j] = in16(0x1F0);
+      target[j] = in16(channel->io_base + ATA_REG_DATA);
     // Note : uint16_t => 2 bytes, HALF_BLOCK_SIZE*2 = BLOCK_SIZE with pointer
     // arithmetic
     target += HALF_BLOCK_SIZE;
   }
 }
 
-void write_blocks(const void *ptr, uint32_t logical_block_address,
-                  uint8_t block_count)
+/**
+ * BlockSegmentCursor - Position in segment list, advanced block by block
+ *
+ * @param segment      Current segment
+ * @param block_offset Next block index inside current segment
+ */
+struct BlockSegmentCursor
 {
-  ATA_busy_wait();
-  out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
-  out(0x1F2, block_count);
-  out(0x1F3, (uint8_t)logical_block_address);
-  out(0x1F4, (uint8_t)(logical_block_address >> 8));
-  out(0x1F5, (uint8_t)(logical_block_address >> 16));
-  out(0x1F7, 0x30);
+  const struct BlockSegment *segment;
+  uint32_t block_offset;
+};
+
+static const uint8_t *segment_cursor_next(struct BlockSegmentCursor *cursor)
+{
+  while (cursor->block_offset == cursor->segment->block_count)
+  {
+    cursor->segment++;
+    cursor->block_offset = 0;
+  }
+  return (const uint8_t *)cursor->segment->buf + BLOCK_SIZE * cursor->block_offset++;
+}
+
+static void ATA_PIO_write_blocks(uint8_t drive, struct BlockSegmentCursor *cursor,
+                                 uint32_t logical_block_address, uint32_t block_count, bool lba48)
+{
+  struct ATAChannel *channel = ATA_channel(drive);
+  ATA_busy_wait(channel);
+  ATA_select(drive, logical_block_address, block_count, lba48);
+  channel->irq_received = FALSE;
+  out(channel->io_base + ATA_REG_COMMAND, lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
   for (uint32_t i = 0; i < block_count; i++)
   {
 
-    ATA_busy_wait();
-    ATA_DRQ_wait();
-    /* Note : uint16_t => 2 bytes, i is current block number to write
-       HALF_BLOCK_SIZE*i = block_offset with pointer arithmetic
-    */
+    ATA_busy_wait(channel);
+    ATA_DRQ_wait(channel);
+    // Note : uint16_t => 2 bytes, source block may come from any segment
+    const uint16_t *source = (const uint16_t *)segment_cursor_next(cursor);
     for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-      out16(0x1F0, ((uint16_t *)ptr)[HALF_BLOCK_SIZE * i + j]);
+      out16(channel->io_base + ATA_REG_DATA, source[j]);
+
+    // First block is requested with DRQ only, afterward drive interrupt when
+    // each block is committed, the last one signal command completion
+    if (channel->irq_enabled)
+      ATA_irq_wait(channel);
   }
 }
+
+void ata_dma_start(uint8_t drive, void *buffer, uint32_t logical_block_address,
+                   uint32_t block_count, bool is_write)
+{
+  struct ATAChannel *channel = ATA_channel(drive);
+  struct PhysicalRegionDescriptor *prd = &dma_prd_table[ATA_DRIVE_CHANNEL(drive)];
+  uint16_t bus_master = channel->bus_master_base;
+  uint8_t direction = is_write ? 0 : BM_COMMAND_READ;
+  bool lba48 = ATA_need_lba48(drive, logical_block_address, block_count);
+
+  // Note : byte_count is 16-bit, 64 KiB transfer will be truncated into 0,
+  // which is the PRD encoding of 64 KiB
+  prd->physical_address = KERNEL_VIRTUAL_TO_PHYSICAL(buffer);
+  prd->byte_count = (uint16_t)(block_count * BLOCK_SIZE);
+  prd->flag = PRD_END_OF_TABLE;
+
+  // Stop engine, load PRD table, set direction and clear error & interrupt bit
+  out(bus_master + BM_COMMAND, 0);
+  out32(bus_master + BM_PRDT_ADDRESS, KERNEL_VIRTUAL_TO_PHYSICAL(prd));
+  out(bus_master + BM_COMMAND, direction);
+  out(bus_master + BM_STATUS, in(bus_master + BM_STATUS) | BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+  ATA_busy_wait(channel);
+  ATA_select(drive, logical_block_address, block_count, lba48);
+  channel->irq_received = FALSE;
+  if (lba48)
+    out(channel->io_base + ATA_REG_COMMAND, is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+  else
+    out(channel->io_base + ATA_REG_COMMAND, is_write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+  out(bus_master + BM_COMMAND, direction | BM_COMMAND_START);
+}
+
+bool ata_dma_finish(uint8_t drive)
+{
+  struct ATAChannel *channel = ATA_channel(drive);
+  uint16_t bus_master = channel->bus_master_base;
+
+  // Single interrupt after the whole transfer, CPU halted meanwhile
+  if (channel->irq_enabled)
+    ATA_irq_wait(channel);
+
+  // Drive raise interrupt bit after the last byte transferred
+  uint8_t bm_status;
+  do
+  {
+    bm_status = in(bus_master + BM_STATUS);
+  } while (!(bm_status & (BM_STATUS_INTERRUPT | BM_STATUS_ERROR)));
+
+  out(bus_master + BM_COMMAND, 0);
+  ATA_busy_wait(channel);
+  uint8_t ata_status = in(channel->io_base + ATA_REG_STATUS);
+  out(bus_master + BM_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+  return !(bm_status & BM_STATUS_ERROR) && !(ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+}
+
+/**
+ * Largest block count of a single command, capped by the remaining block_count.
+ * DMA is bounded by the bounce buffer, PIO by the sector count register width
+ */
+static uint32_t ATA_max_block_per_command(uint8_t drive, bool use_dma, uint32_t block_count)
+{
+  uint32_t limit;
+  if (use_dma)
+    limit = DMA_MAX_BLOCK_PER_COMMAND;
+  else if (ata_driver_state.drive[drive].lba48_supported)
+    limit = ATA_LBA48_MAX_BLOCK_PER_COMMAND;
+  else
+    limit = ATA_LBA28_MAX_BLOCK_PER_COMMAND;
+  return block_count < limit ? block_count : limit;
+}
+
+void ata_pio_transfer(uint8_t drive, void *buffer, uint32_t logical_block_address,
+                      uint32_t block_count, bool is_write)
+{
+  struct BlockSegment segment = {.buf = buffer, .block_count = block_count};
+  struct BlockSegmentCursor cursor = {.segment = &segment, .block_offset = 0};
+  uint8_t *target = (uint8_t *)buffer;
+  while (block_count > 0)
+  {
+    uint32_t chunk = ATA_max_block_per_command(drive, FALSE, block_count);
+    bool lba48 = ATA_need_lba48(drive, logical_block_address, chunk);
+    if (is_write)
+      ATA_PIO_write_blocks(drive, &cursor, logical_block_address, chunk, lba48);
+    else
+      ATA_PIO_read_blocks(drive, target, logical_block_address, chunk, lba48);
+
+    target += chunk * BLOCK_SIZE;
+    logical_block_address += chunk;
+    block_count -= chunk;
+  }
+}
+
+static void ATA_read_blocks(void *ptr, uint32_t logical_block_address,
+                            uint32_t block_count)
+{
+  uint8_t *target = (uint8_t *)ptr;
+  bool use_dma = ata_dma_available(0);
+
+  // Split into the largest commands the transfer method allow
+  while (block_count > 0)
+  {
+    uint32_t chunk = ATA_max_block_per_command(0, use_dma, block_count);
+    bool lba48 = ATA_need_lba48(0, logical_block_address, chunk);
+
+    bool read = FALSE;
+    if (use_dma)
+    {
+      ata_dma_start(0, block_device_bounce_buffer, logical_block_address, chunk, FALSE);
+      read = ata_dma_finish(0);
+    }
+    if (read)
+      memcpy(target, block_device_bounce_buffer, chunk * BLOCK_SIZE);
+    else
+      ATA_PIO_read_blocks(0, target, logical_block_address, chunk, lba48);
+
+    target += chunk * BLOCK_SIZE;
+    logical_block_address += chunk;
+    block_count -= chunk;
+  }
+}
+
+static void ATA_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                     uint32_t logical_block_address)
+{
+  uint32_t block_count = 0;
+  for (uint32_t i = 0; i < segment_count; i++)
+    block_count += segment[i].block_count;
+
+  bool use_dma = ata_dma_available(0);
+  struct BlockSegmentCursor cursor = {.segment = segment, .block_offset = 0};
+  while (block_count > 0)
+  {
+    uint32_t chunk = ATA_max_block_per_command(0, use_dma, block_count);
+    bool lba48 = ATA_need_lba48(0, logical_block_address, chunk);
+
+    // Segments are gathered into the bounce buffer, single command per chunk
+    struct BlockSegmentCursor chunk_start = cursor;
+    bool written = FALSE;
+    if (use_dma)
+    {
+      for (uint32_t i = 0; i < chunk; i++)
+        memcpy(block_device_bounce_buffer + i * BLOCK_SIZE, segment_cursor_next(&cursor), BLOCK_SIZE);
+      ata_dma_start(0, block_device_bounce_buffer, logical_block_address, chunk, TRUE);
+      written = ata_dma_finish(0);
+    }
+
+    // Fallback into PIO if DMA not available or failed
+    if (!written)
+    {
+      cursor = chunk_start;
+      ATA_PIO_write_blocks(0, &cursor, logical_block_address, chunk, lba48);
+    }
+
+    logical_block_address += chunk;
+    block_count -= chunk;
+  }
+}
+
+const struct BlockDeviceOperation ata_block_device = {
+    .name = "ata",
+    .probe = ATA_probe,
+    .get_block_count = ATA_get_block_count,
+    .read_blocks = ATA_read_blocks,
+    .write_block_segments = ATA_write_block_segments,
+};
@@ -1,59 +1,62 @@
 #include <stdio.h>
 #include <stdlib.h>
-// #include "lib-header/stdtype.h"
-
-// Usual gcc fixed width integer type 
-typedef u_int32_t uint32_t;
-typedef u_int8_t  uint8_t;
-
-// Manual import from fat32.h, disk.h, & stdmem.h due some issue with size_t
-#define BLOCK_SIZE      512
-
-struct FAT32DriverRequest {
-    void     *buf;
-    char      name[8];
-    char      ext[3];
-    uint32_t  parent_cluster_number;
-    uint32_t  buffer_size;
-} __attribute__((packed));
-
-void*  memcpy(void* restrict dest, const void* restrict src, size_t n);
-
-void   initialize_filesystem_fat32(void);
-int8_t read(struct FAT32DriverRequest request);
-int8_t read_directory(struct FAT32DriverRequest request);
-int8_t write(struct FAT32DriverRequest request);
-int8_t delete(struct FAT32DriverRequest request);
-
-
-
+#include "lib-header/stdmem.h"
+#include "lib-header/fat32.h"
 
 // Global variable
 uint8_t *image_storage;
 uint8_t *file_buffer;
+size_t   image_size;
 
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count) {
-    for (int i = 0; i < block_count; i++)
+// Block layer of the kernel, image in memory never fail
+bool read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count) {
+    for (uint32_t i = 0; i < block_count; i++)
         memcpy((uint8_t*) ptr + BLOCK_SIZE*i, image_storage + BLOCK_SIZE*(logical_block_address+i), BLOCK_SIZE);
+    return TRUE;
 }
 
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count) {
-    for (int i = 0; i < block_count; i++)
+bool write_blocks(const void *ptr, uint32_t logical_block_address, uint32_t block_count) {
+    for (uint32_t i = 0; i < block_count; i++)
         memcpy(image_storage + BLOCK_SIZE*(logical_block_address+i), (uint8_t*) ptr + BLOCK_SIZE*i, BLOCK_SIZE);
+    return TRUE;
+}
+
+bool write_block_segments(const struct BlockSegment *segment, uint32_t segment_count, uint32_t logical_block_address) {
+    for (uint32_t i = 0; i < segment_count; i++) {
+        write_blocks(segment[i].buf, logical_block_address, segment[i].block_count);
+        logical_block_address += segment[i].block_count;
+    }
+    return TRUE;
+}
+
+void submit_block_segments(const struct BlockSegment *segment, uint32_t segment_count, uint32_t logical_block_address) {
+    write_block_segments(segment, segment_count, logical_block_address);
+}
+
+bool wait_blocks(void) {
+    return TRUE;
+}
+
+// File system geometry is sized from the image when it is created
+uint32_t get_disk_block_count(void) {
+    return image_size / BLOCK_SIZE;
 }
 
 
 int main(int argc, char *argv[]) {
     if (argc < 4) {
-        fprintf(stderr, "inserter: ./inserter <file to insert> <parent cluster index> <storage>\n");
+        fprintf(stderr, "inserter: ./inserter <file to insert> <parent cluster index> <storage> [cluster size]\n");
         exit(1);
     }
 
-    // Read storage into memory, requiring 4 MB memory
-    image_storage     = malloc(4*1024*1024);
-    file_buffer       = malloc(4*1024*1024);
+    // Read whole storage into memory, image size decide the volume size
     FILE *fptr        = fopen(argv[3], "r");
-    fread(image_storage, 4*1024*1024, 1, fptr);
+    fseek(fptr, 0, SEEK_END);
+    image_size        = ftell(fptr);
+    fseek(fptr, 0, SEEK_SET);
+    image_storage     = malloc(image_size);
+    file_buffer       = malloc(4*1024*1024);
+    fread(image_storage, image_size, 1, fptr);
     fclose(fptr);
 
     // Read target file, assuming file is less than 4 MiB
@@ -72,7 +75,14 @@ int main(int argc, char *argv[]) {
     printf("Filename : %s\n",  argv[1]);
     printf("Filesize : %ld bytes\n", filesize);
 
-    // FAT32 operations
+    // FAT32 operations, blank storage is formatted with requested cluster size
+    if (argc > 4) {
+        uint32_t cluster_size = 0;
+        sscanf(argv[4], "%u", &cluster_size);
+        initialize_block_cache();
+        if (is_empty_storage())
+            create_fat32(cluster_size / BLOCK_SIZE);
+    }
     initialize_filesystem_fat32();
     struct FAT32DriverRequest request = {
         .buf         = file_buffer,
@@ -91,9 +101,10 @@ int main(int argc, char *argv[]) {
     else
         puts("Error: Unknown error");
 
-    // Write image in memory into original, overwrite them
+    // Write dirty FAT and cached blocks into image, then image into original, overwrite them
+    sync_filesystem_fat32();
     fptr              = fopen(argv[3], "w");
-    fwrite(image_storage, 4*1024*1024, 1, fptr);
+    fwrite(image_storage, image_size, 1, fptr);
     fclose(fptr);
 
     return 0;
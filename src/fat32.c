@@ -1,6 +1,8 @@
 #include "lib-header/fat32.h"
 #include "lib-header/stdmem.h"
 #include "lib-header/stdtype.h"
+#include "lib-header/portio.h"
+#include "lib-header/iostat.h"
 
 const uint8_t fs_signature[BLOCK_SIZE] = {
     'C',
@@ -88,103 +90,1874 @@ const uint8_t fs_signature[BLOCK_SIZE] = {
 };
 
 static struct FAT32DriverState driver_state;
-static char empty_cluster_value[CLUSTER_SIZE];
+static char empty_cluster_value[MAX_CLUSTER_SIZE];
 struct NodeFileSystem *BPlusTree;
 
 uint32_t cluster_to_lba(uint32_t cluster)
 {
-  return cluster * CLUSTER_BLOCK_COUNT + BOOT_SECTOR;
+  return cluster * driver_state.geometry.cluster_block_count + BOOT_SECTOR;
 }
 
-void create_fat32(void)
+uint32_t get_cluster_size(void)
 {
-  // Copy fs_signature
-  write_blocks(fs_signature, BOOT_SECTOR, 1);
+  return driver_state.geometry.cluster_block_count * BLOCK_SIZE;
+}
+
+// Cluster holding the index-th cluster of the FAT
+static uint32_t fat_cluster_number(uint32_t index)
+{
+  return index == 0 ? FAT_CLUSTER_NUMBER : ROOT_CLUSTER_NUMBER + index;
+}
+
+static uint32_t fat_sector_to_lba(uint32_t sector)
+{
+  uint32_t cluster_block_count = driver_state.geometry.cluster_block_count;
+  return cluster_to_lba(fat_cluster_number(sector / cluster_block_count)) + sector % cluster_block_count;
+}
+
+static bool is_valid_cluster_block_count(uint32_t cluster_block_count)
+{
+  return cluster_block_count >= CLUSTER_BLOCK_COUNT && cluster_block_count <= MAX_CLUSTER_BLOCK_COUNT &&
+         (cluster_block_count & (cluster_block_count - 1)) == 0;
+}
+
+/**
+ * Size the volume from the disk, clamped by free cluster bitmap. Disk
+ * reporting no size get legacy volume size
+ */
+static void size_fat32_geometry(struct FAT32Geometry *geometry, uint32_t cluster_block_count)
+{
+  uint32_t block_count = get_disk_block_count();
+  if (block_count == 0)
+    block_count = FAT32_LEGACY_CLUSTER_COUNT * CLUSTER_BLOCK_COUNT;
+  uint32_t cluster_count = block_count / cluster_block_count;
+  if (cluster_count > FAT32_MAX_CLUSTER_COUNT)
+    cluster_count = FAT32_MAX_CLUSTER_COUNT;
+
+  uint32_t fat_cluster_entry_count = cluster_block_count * FAT_SECTOR_ENTRY_COUNT;
+  geometry->magic = FAT32_GEOMETRY_MAGIC;
+  geometry->cluster_count = cluster_count;
+  geometry->fat_cluster_count = (cluster_count + fat_cluster_entry_count - 1) / fat_cluster_entry_count;
+  geometry->cluster_block_count = cluster_block_count;
+}
+
+// Volume created before geometry was recorded has single cluster FAT and 2 KiB cluster
+static void read_fat32_geometry(void)
+{
+  uint8_t boot_sector[BLOCK_SIZE];
+  block_cache_read(boot_sector, BOOT_SECTOR, 1);
+  memcpy(&driver_state.geometry, boot_sector + FAT32_GEOMETRY_OFFSET, sizeof(struct FAT32Geometry));
+  if (driver_state.geometry.magic != FAT32_GEOMETRY_MAGIC ||
+      driver_state.geometry.cluster_count > FAT32_MAX_CLUSTER_COUNT)
+  {
+    driver_state.geometry.magic = 0;
+    driver_state.geometry.cluster_count = FAT32_LEGACY_CLUSTER_COUNT;
+    driver_state.geometry.fat_cluster_count = 1;
+  }
+  if (!is_valid_cluster_block_count(driver_state.geometry.cluster_block_count))
+    driver_state.geometry.cluster_block_count = CLUSTER_BLOCK_COUNT;
+}
+
+// Forget cached FAT sectors without writing them back
+static void invalidate_fat_cache(void)
+{
+  for (uint32_t i = 0; i < FAT_CACHE_SECTOR_COUNT; i++)
+  {
+    driver_state.fat_cache_sector[i] = FAT_CACHE_NONE;
+    driver_state.fat_cache_dirty[i] = FALSE;
+    driver_state.fat_cache_last_use[i] = 0;
+  }
+  driver_state.fat_cache_clock = 0;
+  driver_state.fat_dirty_count = 0;
+}
+
+/**
+ * Write FSInfo from driver state into block cache. Reservations and delayed
+ * files are memory only, their clusters are counted free as they will be
+ * after remount
+ *
+ * @param state FAT32_FSINFO_CLEAN or FAT32_FSINFO_DIRTY
+ */
+static void write_fsinfo(uint32_t state)
+{
+  struct FAT32FSInfo fsinfo = {
+      .lead_signature = FAT32_FSINFO_LEAD_SIGNATURE,
+      .state = state,
+      .free_cluster_count = driver_state.free_cluster_count,
+      .next_free_hint = driver_state.next_free_hint,
+      .file_count = driver_state.file_count,
+      .directory_count = driver_state.directory_count,
+      .trail_signature = FAT32_FSINFO_TRAIL_SIGNATURE,
+  };
+  fsinfo.free_cluster_count += driver_state.delayed_cluster_count;
+  for (uint32_t i = 0; i < FAT32_RESERVATION_COUNT; i++)
+  {
+    struct FAT32Reservation *reservation = &driver_state.reservation[i];
+    if (!reservation->valid)
+      continue;
+    fsinfo.free_cluster_count += reservation->cluster_count;
+    if (reservation->first_cluster_number < fsinfo.next_free_hint)
+      fsinfo.next_free_hint = reservation->first_cluster_number;
+  }
+
+  uint8_t sector[BLOCK_SIZE] = {0};
+  memcpy(sector, &fsinfo, sizeof(struct FAT32FSInfo));
+  block_cache_write(sector, FAT32_FSINFO_SECTOR, 1);
+}
+
+// FSInfo on storage must be dirty before the first modification following a sync reach storage
+static void mark_fsinfo_dirty(void)
+{
+  if (driver_state.fsinfo_dirty)
+    return;
+  write_fsinfo(FAT32_FSINFO_DIRTY);
+  block_cache_flush();
+  driver_state.fsinfo_dirty = TRUE;
+}
+
+static bool is_fsinfo_valid(const struct FAT32FSInfo *fsinfo)
+{
+  uint32_t cluster_count = driver_state.geometry.cluster_count;
+  return fsinfo->lead_signature == FAT32_FSINFO_LEAD_SIGNATURE &&
+         fsinfo->trail_signature == FAT32_FSINFO_TRAIL_SIGNATURE &&
+         fsinfo->state == FAT32_FSINFO_CLEAN &&
+         fsinfo->next_free_hint >= FIRST_ALLOCATABLE_CLUSTER && fsinfo->next_free_hint <= cluster_count &&
+         fsinfo->free_cluster_count <= cluster_count - fsinfo->next_free_hint;
+}
+
+/**
+ * Count files and directories below a directory, used when FSInfo can not be
+ * trusted. dir_table_buf is reloaded after each subdirectory so only the
+ * recursion depth is kept on the stack
+ *
+ * @param cluster_number First cluster of the directory
+ * @param depth          Recursion depth, subdirectories below MAX_RECURSIVE_OP_DEPTH are not entered
+ */
+static void count_directory_entries(uint32_t cluster_number, uint8_t depth)
+{
+  uint32_t now_cluster_number = cluster_number;
+  bool end_of_directory = FALSE;
+  while (!end_of_directory)
+  {
+    read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+    for (uint8_t i = 1; i < CLUSTER_SIZE / sizeof(struct FAT32DirectoryEntry); i++)
+    {
+      struct FAT32DirectoryEntry *entry = &driver_state.dir_table_buf.table[i];
+      if (is_entry_empty(entry))
+        continue;
+      if (!is_subdirectory(entry))
+      {
+        driver_state.file_count++;
+        continue;
+      }
+      driver_state.directory_count++;
+      if (depth < MAX_RECURSIVE_OP_DEPTH)
+      {
+        count_directory_entries(get_entry_cluster_number(entry), depth + 1);
+        read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+      }
+    }
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
+    now_cluster_number = get_fat_entry(now_cluster_number);
+  }
+}
+
+/**
+ * Load free space at mount. Cleanly synced volume is trusted and its bitmap
+ * filled lazily from next_free_hint by find_free_extent(), otherwise the FAT
+ * is scanned and entries counted, FSInfo then get rewritten on next sync
+ */
+static void load_free_space(void)
+{
+  uint64_t start = read_tsc();
+  uint8_t sector[BLOCK_SIZE];
+  struct FAT32FSInfo fsinfo;
+  block_cache_read(sector, FAT32_FSINFO_SECTOR, 1);
+  memcpy(&fsinfo, sector, sizeof(struct FAT32FSInfo));
+
+  if (!is_fsinfo_valid(&fsinfo))
+  {
+    build_free_cluster_bitmap();
+    driver_state.file_count = 0;
+    driver_state.directory_count = 0;
+    count_directory_entries(ROOT_CLUSTER_NUMBER, 0);
+    driver_state.fsinfo_dirty = TRUE;
+    return;
+  }
+
+  // Bits below next_free_hint stay clear, they are all used
+  memset(driver_state.free_cluster_bitmap, 0, (driver_state.geometry.cluster_count + 31) / 32 * sizeof(uint32_t));
+  driver_state.free_bitmap_limit = fsinfo.next_free_hint - fsinfo.next_free_hint % FAT_SECTOR_ENTRY_COUNT;
+  driver_state.free_cluster_count = fsinfo.free_cluster_count;
+  driver_state.next_free_hint = fsinfo.next_free_hint;
+  driver_state.file_count = fsinfo.file_count;
+  driver_state.directory_count = fsinfo.directory_count;
+  driver_state.fsinfo_dirty = FALSE;
+  driver_state.free_bitmap_build_cycles = read_tsc() - start;
+}
+
+void create_fat32(uint32_t cluster_block_count)
+{
+  if (!is_valid_cluster_block_count(cluster_block_count))
+    cluster_block_count = CLUSTER_BLOCK_COUNT;
+
+  // Copy fs_signature and geometry, volume layout area written by the block layer is kept
+  struct FAT32Geometry geometry;
+  size_fat32_geometry(&geometry, cluster_block_count);
+  uint8_t boot_sector[BLOCK_SIZE];
+  block_cache_read(boot_sector, BOOT_SECTOR, 1);
+  memcpy(boot_sector, fs_signature, BLOCK_VOLUME_LAYOUT_OFFSET);
+  memcpy(boot_sector + FAT32_GEOMETRY_OFFSET, &geometry, sizeof(struct FAT32Geometry));
+  memcpy(boot_sector + FAT32_SIGNATURE_TAIL_OFFSET, fs_signature + FAT32_SIGNATURE_TAIL_OFFSET,
+         BLOCK_SIZE - FAT32_SIGNATURE_TAIL_OFFSET);
+  block_cache_write(boot_sector, BOOT_SECTOR, 1);
+
+  // Empty every FAT cluster, then set reserved clusters through FAT sector cache
+  driver_state.geometry = geometry;
+  invalidate_fat_cache();
+  for (uint32_t i = 0; i < geometry.fat_cluster_count; i++)
+    write_clusters(empty_cluster_value, fat_cluster_number(i), 1);
+  set_fat_entry(0, CLUSTER_0_VALUE);
+  set_fat_entry(1, CLUSTER_1_VALUE);
+  set_fat_entry(2, FAT32_FAT_END_OF_FILE);
+  for (uint32_t i = 1; i < geometry.fat_cluster_count; i++)
+    set_fat_entry(fat_cluster_number(i), FAT32_FAT_END_OF_FILE);
+  sync_fat();
+
+  // Initialize root directory
+  struct FAT32DirectoryTable root = {0};
+  init_directory_table(&root, "root\0\0\0", 2);
+  write_directory_table(&root, 2);
+
+  // Everything past the FAT clusters following root is free
+  memset(driver_state.reservation, 0, sizeof(driver_state.reservation));
+  memset(driver_state.delayed_file, 0, sizeof(driver_state.delayed_file));
+  memset(driver_state.directory_index, 0, sizeof(driver_state.directory_index));
+  memset(driver_state.dentry, 0, sizeof(driver_state.dentry));
+  memset(driver_state.verified_directory, 0, sizeof(driver_state.verified_directory));
+  driver_state.delayed_buffer_used = 0;
+  driver_state.delayed_cluster_count = 0;
+  driver_state.next_free_hint = ROOT_CLUSTER_NUMBER + geometry.fat_cluster_count;
+  driver_state.free_cluster_count = geometry.cluster_count - driver_state.next_free_hint;
+  driver_state.file_count = 0;
+  driver_state.directory_count = 0;
+  write_fsinfo(FAT32_FSINFO_CLEAN);
+  driver_state.fsinfo_dirty = FALSE;
+}
+
+void initialize_filesystem_fat32(void)
+{
+  // Write back state left dirty by previous mount before invalidating cache
+  sync_filesystem_fat32();
+  invalidate_fat_cache();
+  initialize_block_cache();
+  if (is_empty_storage())
+  {
+    // Create FAT if it's empty
+    create_fat32(CLUSTER_BLOCK_COUNT);
+  }
+
+  // Only geometry and free space are loaded, reservations are memory only and
+  // do not survive remount
+  read_fat32_geometry();
+  load_free_space();
+  memset(driver_state.reservation, 0, sizeof(driver_state.reservation));
+  memset(driver_state.directory_index, 0, sizeof(driver_state.directory_index));
+  memset(driver_state.dentry, 0, sizeof(driver_state.dentry));
+  memset(driver_state.verified_directory, 0, sizeof(driver_state.verified_directory));
+
+  // Initialize B+ Tree, pools are reset so remount does not leak nodes
+  create_b_tree();
+
+  // Initialize static array for empty clusters
+  for (int i = 0; i < MAX_CLUSTER_SIZE; i++)
+  {
+    empty_cluster_value[i] = 0;
+  }
+}
+
+bool is_empty_storage()
+{
+  uint8_t boot_sector[BLOCK_SIZE];
+  block_cache_read(&boot_sector, BOOT_SECTOR, 1);
+  // Volume layout area and geometry are not part of the signature
+  return memcmp(boot_sector, fs_signature, BLOCK_VOLUME_LAYOUT_OFFSET) ||
+         memcmp(boot_sector + FAT32_SIGNATURE_TAIL_OFFSET, fs_signature + FAT32_SIGNATURE_TAIL_OFFSET,
+                BLOCK_SIZE - FAT32_SIGNATURE_TAIL_OFFSET);
+}
+
+static void write_back_fat_sector(uint32_t slot)
+{
+  block_cache_write(&driver_state.fat_cache[slot], fat_sector_to_lba(driver_state.fat_cache_sector[slot]), 1);
+  driver_state.fat_cache_dirty[slot] = FALSE;
+  driver_state.fat_dirty_count--;
+}
+
+/**
+ * Find cache slot holding FAT sector. On miss the least recently used slot
+ * is written back if dirty and refilled from block cache
+ *
+ * @param sector FAT sector index
+ * @return Cache slot index
+ */
+static uint32_t load_fat_sector(uint32_t sector)
+{
+  uint32_t victim = 0;
+  driver_state.fat_cache_clock++;
+  for (uint32_t i = 0; i < FAT_CACHE_SECTOR_COUNT; i++)
+  {
+    if (driver_state.fat_cache_sector[i] == sector)
+    {
+      driver_state.fat_cache_last_use[i] = driver_state.fat_cache_clock;
+      return i;
+    }
+    if (driver_state.fat_cache_last_use[i] < driver_state.fat_cache_last_use[victim])
+      victim = i;
+  }
+
+  if (driver_state.fat_cache_dirty[victim])
+    write_back_fat_sector(victim);
+  block_cache_read(&driver_state.fat_cache[victim], fat_sector_to_lba(sector), 1);
+  driver_state.fat_cache_sector[victim] = sector;
+  driver_state.fat_cache_last_use[victim] = driver_state.fat_cache_clock;
+  return victim;
+}
+
+uint32_t get_fat_entry(uint32_t cluster_number)
+{
+  if (cluster_number >= driver_state.geometry.cluster_count)
+    return FAT32_FAT_END_OF_FILE;
+  uint32_t slot = load_fat_sector(cluster_number / FAT_SECTOR_ENTRY_COUNT);
+  return driver_state.fat_cache[slot].cluster_map[cluster_number % FAT_SECTOR_ENTRY_COUNT] & FAT32_CLUSTER_MASK;
+}
+
+static bool is_cluster_free(uint32_t cluster_number)
+{
+  return (driver_state.free_cluster_bitmap[cluster_number / 32] & (1u << (cluster_number % 32))) != 0;
+}
+
+void set_fat_entry(uint32_t cluster_number, uint32_t value)
+{
+  if (cluster_number >= driver_state.geometry.cluster_count)
+    return;
+  uint32_t slot = load_fat_sector(cluster_number / FAT_SECTOR_ENTRY_COUNT);
+  if (!driver_state.fat_cache_dirty[slot])
+  {
+    driver_state.fat_cache_dirty[slot] = TRUE;
+    driver_state.fat_dirty_count++;
+  }
+
+  // Free count of clusters not in the bitmap yet follow the FAT, bitmap pick
+  // them up when it is filled
+  uint32_t index = cluster_number % FAT_SECTOR_ENTRY_COUNT;
+  uint32_t previous_value = driver_state.fat_cache[slot].cluster_map[index] & FAT32_CLUSTER_MASK;
+  driver_state.fat_cache[slot].cluster_map[index] = value;
+  if (cluster_number >= driver_state.free_bitmap_limit)
+  {
+    if (value == 0 && previous_value != 0)
+    {
+      driver_state.free_cluster_count++;
+      if (cluster_number < driver_state.next_free_hint)
+        driver_state.next_free_hint = cluster_number;
+    }
+    else if (value != 0 && previous_value == 0)
+      driver_state.free_cluster_count--;
+    return;
+  }
+
+  // Keep free cluster bitmap in sync on free <-> used transition
+  uint32_t cluster_mask = 1u << (cluster_number % 32);
+  if (value == 0 && !is_cluster_free(cluster_number))
+  {
+    driver_state.free_cluster_bitmap[cluster_number / 32] |= cluster_mask;
+    driver_state.free_cluster_count++;
+    if (cluster_number < driver_state.next_free_hint)
+      driver_state.next_free_hint = cluster_number;
+  }
+  else if (value != 0 && is_cluster_free(cluster_number))
+  {
+    driver_state.free_cluster_bitmap[cluster_number / 32] &= ~cluster_mask;
+    driver_state.free_cluster_count--;
+  }
+}
+
+void build_free_cluster_bitmap(void)
+{
+  uint64_t start = read_tsc();
+  uint32_t cluster_count = driver_state.geometry.cluster_count;
+  memset(driver_state.free_cluster_bitmap, 0, (cluster_count + 31) / 32 * sizeof(uint32_t));
+  driver_state.free_cluster_count = 0;
+  driver_state.next_free_hint = cluster_count;
+  driver_state.free_bitmap_limit = cluster_count;
+
+  // FAT is scanned CLUSTER_BLOCK_COUNT sectors at a time, never crossing FAT
+  // cluster boundary. FAT sector cache is left for chain walks
+  struct FAT32FileAllocationSector fat_sector[CLUSTER_BLOCK_COUNT];
+  uint32_t fat_sector_count = driver_state.geometry.fat_cluster_count * driver_state.geometry.cluster_block_count;
+  for (uint32_t sector = 0; sector < fat_sector_count; sector += CLUSTER_BLOCK_COUNT)
+  {
+    block_cache_read(fat_sector, fat_sector_to_lba(sector), CLUSTER_BLOCK_COUNT);
+    for (uint32_t j = 0; j < CLUSTER_BLOCK_COUNT * FAT_SECTOR_ENTRY_COUNT; j++)
+    {
+      uint32_t i = sector * FAT_SECTOR_ENTRY_COUNT + j;
+      uint32_t value = fat_sector[j / FAT_SECTOR_ENTRY_COUNT].cluster_map[j % FAT_SECTOR_ENTRY_COUNT];
+      if (i < FIRST_ALLOCATABLE_CLUSTER || i >= cluster_count || (value & FAT32_CLUSTER_MASK) != 0)
+        continue;
+      driver_state.free_cluster_bitmap[i / 32] |= 1u << (i % 32);
+      driver_state.free_cluster_count++;
+      if (i < driver_state.next_free_hint)
+        driver_state.next_free_hint = i;
+    }
+  }
+  driver_state.free_bitmap_build_cycles = read_tsc() - start;
+}
+
+// Fill bitmap for the FAT sector at free_bitmap_limit, read through FAT sector cache
+static void extend_free_cluster_bitmap(void)
+{
+  uint32_t end = driver_state.free_bitmap_limit + FAT_SECTOR_ENTRY_COUNT;
+  if (end > driver_state.geometry.cluster_count)
+    end = driver_state.geometry.cluster_count;
+  for (uint32_t i = driver_state.free_bitmap_limit; i < end; i++)
+    if (i >= FIRST_ALLOCATABLE_CLUSTER && get_fat_entry(i) == FAT32_FAT_EMPTY_ENTRY)
+      driver_state.free_cluster_bitmap[i / 32] |= 1u << (i % 32);
+  driver_state.free_bitmap_limit = end;
+}
+
+uint32_t find_free_extent(uint32_t cluster_count, uint32_t goal, uint32_t *extent_length)
+{
+  uint32_t best_start = 0;
+  uint32_t best_length = 0;
+  uint32_t best_distance = 0;
+  uint32_t run_start = 0;
+  uint32_t run_length = 0;
+  uint32_t cluster_count_total = driver_state.geometry.cluster_count;
+  uint32_t first_free = cluster_count_total;
+
+  for (uint32_t i = driver_state.next_free_hint; i <= cluster_count_total; i++)
+  {
+    while (i < cluster_count_total && i >= driver_state.free_bitmap_limit)
+      extend_free_cluster_bitmap();
+
+    // Whole word fast path, only at word boundary
+    if (i % 32 == 0 && i + 32 <= cluster_count_total)
+    {
+      uint32_t word = driver_state.free_cluster_bitmap[i / 32];
+      if (word == 0 && run_length == 0)
+      {
+        i += 31;
+        continue;
+      }
+      if (word == 0xFFFFFFFF)
+      {
+        if (run_length == 0)
+          run_start = i;
+        run_length += 32;
+        i += 31;
+        continue;
+      }
+    }
+
+    if (i < cluster_count_total && is_cluster_free(i))
+    {
+      if (run_length == 0)
+        run_start = i;
+      run_length++;
+      continue;
+    }
+    if (run_length == 0)
+      continue;
+    if (first_free == cluster_count_total)
+      first_free = run_start;
+
+    // Run ended, fitting run nearest to goal win, else the longest one
+    uint32_t distance = run_start > goal ? run_start - goal : goal - run_start;
+    bool fit = run_length >= cluster_count;
+    bool best_fit = best_length >= cluster_count;
+    if (best_length == 0 ||
+        (fit && !best_fit) ||
+        (fit && best_fit && distance < best_distance) ||
+        (!fit && !best_fit && run_length > best_length))
+    {
+      best_start = run_start;
+      best_length = run_length;
+      best_distance = distance;
+    }
+    run_length = 0;
+
+    // Later runs are further from goal
+    if (fit && run_start >= goal)
+      break;
+  }
+
+  // Every cluster before the first run seen is used
+  driver_state.next_free_hint = first_free;
+  *extent_length = best_length < cluster_count ? best_length : cluster_count;
+  return best_start;
+}
+
+// Return chain that was not linked into any entry into free clusters
+static void free_cluster_chain(uint32_t cluster_number)
+{
+  while (cluster_number != 0 && cluster_number != FAT32_FAT_END_OF_FILE)
+  {
+    uint32_t next_cluster_number = get_fat_entry(cluster_number);
+    set_fat_entry(cluster_number, FAT32_FAT_EMPTY_ENTRY);
+    cluster_number = next_cluster_number;
+  }
+}
+
+uint32_t allocate_cluster_chain(uint32_t cluster_count, uint32_t goal)
+{
+  uint32_t first_cluster_number = 0;
+  uint32_t last_cluster_number = 0;
+  while (cluster_count > 0)
+  {
+    uint32_t extent_length;
+    uint32_t extent_start = find_free_extent(cluster_count, goal, &extent_length);
+    if (extent_start == 0)
+    {
+      // Partial chain is unwound, caller get nothing
+      free_cluster_chain(first_cluster_number);
+      return 0;
+    }
+
+    // Link the extent internally, then append it into the chain
+    for (uint32_t i = 0; i < extent_length - 1; i++)
+      set_fat_entry(extent_start + i, extent_start + i + 1);
+    set_fat_entry(extent_start + extent_length - 1, FAT32_FAT_END_OF_FILE);
+    if (last_cluster_number != 0)
+      set_fat_entry(last_cluster_number, extent_start);
+    else
+      first_cluster_number = extent_start;
+
+    last_cluster_number = extent_start + extent_length - 1;
+    goal = last_cluster_number + 1;
+    cluster_count -= extent_length;
+  }
+  return first_cluster_number;
+}
+
+// Mark clusters used in free cluster bitmap without touching the FAT
+static void reserve_cluster_extent(uint32_t first_cluster_number, uint32_t cluster_count)
+{
+  for (uint32_t i = first_cluster_number; i < first_cluster_number + cluster_count; i++)
+  {
+    driver_state.free_cluster_bitmap[i / 32] &= ~(1u << (i % 32));
+    driver_state.free_cluster_count--;
+  }
+}
+
+static void release_cluster_extent(uint32_t first_cluster_number, uint32_t cluster_count)
+{
+  for (uint32_t i = first_cluster_number; i < first_cluster_number + cluster_count; i++)
+  {
+    driver_state.free_cluster_bitmap[i / 32] |= 1u << (i % 32);
+    driver_state.free_cluster_count++;
+  }
+  if (cluster_count > 0 && first_cluster_number < driver_state.next_free_hint)
+    driver_state.next_free_hint = first_cluster_number;
+}
+
+static struct FAT32Reservation *find_reservation(struct FAT32DriverRequest request)
+{
+  for (uint32_t i = 0; i < FAT32_RESERVATION_COUNT; i++)
+  {
+    struct FAT32Reservation *reservation = &driver_state.reservation[i];
+    if (reservation->valid &&
+        reservation->parent_cluster_number == request.parent_cluster_number &&
+        memcmp(reservation->name, request.name, 8) == 0 &&
+        memcmp(reservation->ext, request.ext, 3) == 0)
+      return reservation;
+  }
+  return NULL;
+}
+
+/**
+ * Allocate cluster chain of a file, the preallocated extent is used first and
+ * its unused tail returned into free cluster bitmap
+ */
+static uint32_t allocate_file_chain(struct FAT32Reservation *reservation,
+                                    uint32_t cluster_count, uint32_t goal)
+{
+  if (reservation == NULL)
+    return allocate_cluster_chain(cluster_count, goal);
+
+  uint32_t first_cluster_number = reservation->first_cluster_number;
+  uint32_t used = reservation->cluster_count < cluster_count ? reservation->cluster_count : cluster_count;
+  reservation->valid = FALSE;
+  release_cluster_extent(first_cluster_number + used, reservation->cluster_count - used);
+
+  // Reserved clusters are not free anymore, set_fat_entry() keep the bitmap as is
+  uint32_t last_cluster_number = first_cluster_number + used - 1;
+  for (uint32_t i = first_cluster_number; i < last_cluster_number; i++)
+    set_fat_entry(i, i + 1);
+  set_fat_entry(last_cluster_number, FAT32_FAT_END_OF_FILE);
+
+  if (used < cluster_count)
+  {
+    uint32_t tail_cluster_number = allocate_cluster_chain(cluster_count - used, last_cluster_number + 1);
+    if (tail_cluster_number == 0)
+    {
+      free_cluster_chain(first_cluster_number);
+      return 0;
+    }
+    set_fat_entry(last_cluster_number, tail_cluster_number);
+  }
+  return first_cluster_number;
+}
+
+static struct FAT32DelayedFile *find_delayed_file(uint32_t table_cluster_number, const char *name, const char *ext)
+{
+  for (uint32_t i = 0; i < FAT32_DELAYED_FILE_COUNT; i++)
+  {
+    struct FAT32DelayedFile *delayed_file = &driver_state.delayed_file[i];
+    if (delayed_file->valid &&
+        delayed_file->table_cluster_number == table_cluster_number &&
+        memcmp(delayed_file->name, name, 8) == 0 &&
+        memcmp(delayed_file->ext, ext, 3) == 0)
+      return delayed_file;
+  }
+  return NULL;
+}
+
+// Whether nth cluster of file content is all zero, last cluster may be partial
+static bool is_file_cluster_zero(const uint8_t *buf, uint32_t size, uint32_t nth_cluster)
+{
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t length = size - cluster_size * nth_cluster;
+  if (length > cluster_size)
+    length = cluster_size;
+  return memcmp(buf + cluster_size * nth_cluster, empty_cluster_value, length) == 0;
+}
+
+/**
+ * Count clusters a file take. File is stored sparse when its zero clusters
+ * outnumber the block map clusters it would need
+ *
+ * @param buf       File content
+ * @param size      File size
+ * @param is_sparse Pointer to store whether the file is stored sparse
+ * @return Chain length, at least 1
+ */
+static uint32_t get_file_cluster_count(const uint8_t *buf, uint32_t size, bool *is_sparse)
+{
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t file_cluster_count = ceil(size, cluster_size);
+  uint32_t data_cluster_count = 0;
+  for (uint32_t i = 0; i < file_cluster_count; i++)
+    if (!is_file_cluster_zero(buf, size, i))
+      data_cluster_count++;
+
+  uint32_t map_cluster_count = ceil(file_cluster_count, cluster_size / sizeof(uint32_t));
+  *is_sparse = file_cluster_count - data_cluster_count > map_cluster_count;
+  if (*is_sparse)
+    return map_cluster_count + data_cluster_count;
+  return file_cluster_count == 0 ? 1 : file_cluster_count;
+}
+
+// Whether write() can buffer size more bytes without flushing first
+static bool is_delayed_buffer_available(uint32_t size)
+{
+  if (size > FAT32_DELAYED_BUFFER_SIZE - driver_state.delayed_buffer_used)
+    return FALSE;
+  for (uint32_t i = 0; i < FAT32_DELAYED_FILE_COUNT; i++)
+    if (!driver_state.delayed_file[i].valid)
+      return TRUE;
+  return FALSE;
+}
+
+/**
+ * Write sparse file content into its allocated chain, non-zero clusters go
+ * into data clusters in file order, then the block map is written
+ *
+ * @param cluster_number First cluster of the chain, first block map cluster
+ * @param buf            File content
+ * @param size           File size
+ */
+static void write_sparse_file_data(uint32_t cluster_number, const uint8_t *buf, uint32_t size)
+{
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t map_entry_count = cluster_size / sizeof(uint32_t);
+  uint32_t file_cluster_count = ceil(size, cluster_size);
+  uint32_t full_clusters = size / cluster_size;
+  uint32_t map_cluster_count = ceil(file_cluster_count, map_entry_count);
+  uint32_t first_data_cluster_number = cluster_number;
+  for (uint32_t i = 0; i < map_cluster_count; i++)
+    first_data_cluster_number = get_fat_entry(first_data_cluster_number);
+
+  // Data, consecutive non-zero clusters contiguous on disk are written at once
+  uint32_t now_cluster_number = first_data_cluster_number;
+  for (uint32_t i = 0; i < file_cluster_count;)
+  {
+    if (is_file_cluster_zero(buf, size, i))
+    {
+      i++;
+      continue;
+    }
+    if (i >= full_clusters)
+    {
+      memset(driver_state.cluster_buf, 0, cluster_size);
+      memcpy(driver_state.cluster_buf, buf + cluster_size * i, size - cluster_size * i);
+      write_clusters(driver_state.cluster_buf, now_cluster_number, 1);
+      break;
+    }
+    uint32_t run = 1;
+    while (i + run < full_clusters && !is_file_cluster_zero(buf, size, i + run) &&
+           get_fat_entry(now_cluster_number + run - 1) == now_cluster_number + run)
+      run++;
+    write_clusters(buf + cluster_size * i, now_cluster_number, run);
+    i += run;
+    now_cluster_number = get_fat_entry(now_cluster_number + run - 1);
+  }
+
+  // Block map, built one map cluster at a time in cluster_buf
+  uint32_t map_cluster_number = cluster_number;
+  now_cluster_number = first_data_cluster_number;
+  for (uint32_t m = 0; m < map_cluster_count; m++)
+  {
+    memset(driver_state.cluster_buf, 0, cluster_size);
+    for (uint32_t j = 0; j < map_entry_count && m * map_entry_count + j < file_cluster_count; j++)
+    {
+      if (is_file_cluster_zero(buf, size, m * map_entry_count + j))
+        continue;
+      memcpy(driver_state.cluster_buf + j * sizeof(uint32_t), &now_cluster_number, sizeof(uint32_t));
+      now_cluster_number = get_fat_entry(now_cluster_number);
+    }
+    write_clusters(driver_state.cluster_buf, map_cluster_number, 1);
+    map_cluster_number = get_fat_entry(map_cluster_number);
+  }
+}
+
+/**
+ * Write file content into its allocated chain. Full clusters are written per
+ * contiguous run, partial tail cluster is zero padded in cluster_buf so
+ * nothing past size is read
+ *
+ * @param cluster_number First cluster of the chain
+ * @param buf            File content
+ * @param size           File size
+ * @param is_sparse      Whether chain start with block map, see ATTR_SPARSE
+ */
+static void write_file_data(uint32_t cluster_number, const uint8_t *buf, uint32_t size, bool is_sparse)
+{
+  if (is_sparse)
+  {
+    write_sparse_file_data(cluster_number, buf, size);
+    return;
+  }
+
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t full_clusters = size / cluster_size;
+  uint32_t nth_cluster = 0;
+  uint32_t now_cluster_number = cluster_number;
+  while (nth_cluster < full_clusters)
+  {
+    uint32_t run = count_contiguous_clusters(now_cluster_number);
+    if (run > full_clusters - nth_cluster)
+      run = full_clusters - nth_cluster;
+    write_clusters(buf + cluster_size * nth_cluster, now_cluster_number, run);
+    nth_cluster += run;
+    now_cluster_number = get_fat_entry(now_cluster_number + run - 1);
+  }
+  if (cluster_size * nth_cluster < size)
+  {
+    memset(driver_state.cluster_buf, 0, cluster_size);
+    memcpy(driver_state.cluster_buf, buf + cluster_size * nth_cluster, size - cluster_size * nth_cluster);
+    write_clusters(driver_state.cluster_buf, now_cluster_number, 1);
+  }
+}
+
+/**
+ * Fill file entry and buffer its content, clusters are chosen by
+ * flush_delayed_files() but free space is taken now so write() fail early
+ *
+ * @param entry Empty entry in dir_table_buf
+ * @param req   Write request, parent_cluster_number is the cluster of dir_table_buf
+ * @param goal_cluster_number Head of parent directory
+ * @param cluster_count       Clusters the file will take
+ * @param is_sparse           Whether the file is stored sparse
+ */
+static void create_delayed_file_from_entry(struct FAT32DirectoryEntry *entry, struct FAT32DriverRequest req,
+                                           uint32_t goal_cluster_number, uint32_t cluster_count, bool is_sparse)
+{
+  struct FAT32DelayedFile *delayed_file = NULL;
+  for (uint32_t i = 0; i < FAT32_DELAYED_FILE_COUNT && delayed_file == NULL; i++)
+    if (!driver_state.delayed_file[i].valid)
+      delayed_file = &driver_state.delayed_file[i];
+
+  delayed_file->valid = TRUE;
+  memcpy(delayed_file->name, req.name, 8);
+  memcpy(delayed_file->ext, req.ext, 3);
+  delayed_file->table_cluster_number = req.parent_cluster_number;
+  delayed_file->goal_cluster_number = goal_cluster_number;
+  delayed_file->buffer_offset = driver_state.delayed_buffer_used;
+  delayed_file->size = req.buffer_size;
+  delayed_file->cluster_count = cluster_count;
+  delayed_file->is_sparse = is_sparse;
+  memcpy(driver_state.delayed_buffer + driver_state.delayed_buffer_used, req.buf, req.buffer_size);
+  driver_state.delayed_buffer_used += req.buffer_size;
+
+  driver_state.free_cluster_count -= cluster_count;
+  driver_state.delayed_cluster_count += cluster_count;
+
+  increment_subdir_n_of_entry(&(driver_state.dir_table_buf));
+  memcpy(entry->name, req.name, 8);
+  memcpy(entry->ext, req.ext, 3);
+  entry->filesize = req.buffer_size;
+  entry->cluster_high = 0;
+  entry->cluster_low = 0;
+  entry->attribute = (uint8_t)0;
+  entry->user_attribute = UATTR_NOT_EMPTY;
+  write_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
+}
+
+bool flush_delayed_files(void)
+{
+  bool is_flushed = TRUE;
+  bool visited[FAT32_DELAYED_FILE_COUNT] = {FALSE};
+  while (TRUE)
+  {
+    // Buffer offset grow with every buffered write() since last flush, so
+    // the smallest one not visited yet is the oldest file
+    struct FAT32DelayedFile *delayed_file = NULL;
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < FAT32_DELAYED_FILE_COUNT; i++)
+    {
+      struct FAT32DelayedFile *candidate = &driver_state.delayed_file[i];
+      if (candidate->valid && !visited[i] &&
+          (delayed_file == NULL || candidate->buffer_offset < delayed_file->buffer_offset))
+      {
+        delayed_file = candidate;
+        index = i;
+      }
+    }
+    if (delayed_file == NULL)
+      break;
+    visited[index] = TRUE;
+
+    // Give back taken free space, allocation take it again cluster by cluster
+    const uint8_t *buf = driver_state.delayed_buffer + delayed_file->buffer_offset;
+    driver_state.free_cluster_count += delayed_file->cluster_count;
+    driver_state.delayed_cluster_count -= delayed_file->cluster_count;
+    uint32_t cluster_number = allocate_cluster_chain(delayed_file->cluster_count, delayed_file->goal_cluster_number);
+    if (cluster_number == 0)
+    {
+      // File stay buffered with its entry on cluster 0, space is taken again
+      driver_state.free_cluster_count -= delayed_file->cluster_count;
+      driver_state.delayed_cluster_count += delayed_file->cluster_count;
+      is_flushed = FALSE;
+      continue;
+    }
+    write_file_data(cluster_number, buf, delayed_file->size, delayed_file->is_sparse);
+
+    read_directory_table(&driver_state.dir_table_buf, delayed_file->table_cluster_number);
+    for (uint8_t j = 1; j < CLUSTER_SIZE / sizeof(struct FAT32DirectoryEntry); j++)
+    {
+      struct FAT32DirectoryEntry *entry = &driver_state.dir_table_buf.table[j];
+      if (!is_entry_empty(entry) && !is_subdirectory(entry) && get_entry_cluster_number(entry) == 0 &&
+          memcmp(entry->name, delayed_file->name, 8) == 0 && memcmp(entry->ext, delayed_file->ext, 3) == 0)
+      {
+        entry->cluster_high = cluster_number >> 16;
+        entry->cluster_low = cluster_number & 0x0000FFFF;
+        entry->attribute = delayed_file->is_sparse ? ATTR_SPARSE : 0;
+        write_directory_table(&driver_state.dir_table_buf, delayed_file->table_cluster_number);
+        break;
+      }
+    }
+    delayed_file->valid = FALSE;
+  }
+
+  // Buffer space of flushed files is reclaimed only once none is left
+  if (is_flushed)
+    driver_state.delayed_buffer_used = 0;
+  return is_flushed;
+}
+
+void sync_fat(void)
+{
+  for (uint32_t slot = 0; slot < FAT_CACHE_SECTOR_COUNT && driver_state.fat_dirty_count > 0; slot++)
+    if (driver_state.fat_cache_dirty[slot])
+      write_back_fat_sector(slot);
+}
+
+bool sync_filesystem_fat32(void)
+{
+  bool is_flushed = flush_delayed_files();
+  sync_fat();
+  is_flushed = block_cache_flush() && is_flushed;
+
+  // Clean FSInfo is written only once everything it describe is on storage
+  if (is_flushed && driver_state.fsinfo_dirty)
+  {
+    write_fsinfo(FAT32_FSINFO_CLEAN);
+    is_flushed = block_cache_flush();
+    driver_state.fsinfo_dirty = !is_flushed;
+  }
+  return is_flushed;
+}
+
+void get_volume_statistic(struct FAT32VolumeStatistic *statistic)
+{
+  statistic->cluster_size = get_cluster_size();
+  statistic->cluster_count = driver_state.geometry.cluster_count;
+  statistic->free_cluster_count = driver_state.free_cluster_count;
+  statistic->file_count = driver_state.file_count;
+  statistic->directory_count = driver_state.directory_count;
+}
+
+void write_clusters(const void *ptr, uint32_t cluster_number,
+                    uint32_t cluster_count)
+{
+  uint64_t start_cycle = read_tsc();
+  uint32_t logical_block_address = cluster_to_lba(cluster_number);
+  uint32_t block_count = cluster_count * driver_state.geometry.cluster_block_count;
+  block_cache_write(ptr, logical_block_address, block_count);
+  iostat_record(IOSTAT_WRITE_CLUSTERS, block_count * BLOCK_SIZE, read_tsc() - start_cycle);
+}
+
+bool read_clusters(void *ptr, uint32_t cluster_number, uint32_t cluster_count)
+{
+  uint64_t start_cycle = read_tsc();
+  uint32_t logical_block_address = cluster_to_lba(cluster_number);
+  uint32_t block_count = cluster_count * driver_state.geometry.cluster_block_count;
+  bool ok = block_cache_read(ptr, logical_block_address, block_count);
+  if (ok && cluster_count == 1)
+    read_ahead_cluster_chain(cluster_number);
+  iostat_record(IOSTAT_READ_CLUSTERS, block_count * BLOCK_SIZE, read_tsc() - start_cycle);
+  return ok;
+}
+
+void read_directory_table(struct FAT32DirectoryTable *dir_table, uint32_t cluster_number)
+{
+  uint64_t start_cycle = read_tsc();
+  block_cache_read(dir_table, cluster_to_lba(cluster_number), CLUSTER_BLOCK_COUNT);
+  read_ahead_cluster_chain(cluster_number);
+  iostat_record(IOSTAT_READ_CLUSTERS, CLUSTER_SIZE, read_tsc() - start_cycle);
+}
+
+void write_directory_table(const struct FAT32DirectoryTable *dir_table, uint32_t cluster_number)
+{
+  uint64_t start_cycle = read_tsc();
+  block_cache_write(dir_table, cluster_to_lba(cluster_number), CLUSTER_BLOCK_COUNT);
+  iostat_record(IOSTAT_WRITE_CLUSTERS, CLUSTER_SIZE, read_tsc() - start_cycle);
+}
+
+static bool is_chain_cluster(uint32_t cluster_number)
+{
+  return cluster_number >= FIRST_ALLOCATABLE_CLUSTER && cluster_number < driver_state.geometry.cluster_count;
+}
+
+void read_ahead_cluster_chain(uint32_t cluster_number)
+{
+  uint32_t window_size = READ_AHEAD_BLOCK_COUNT / driver_state.geometry.cluster_block_count;
+  if (cluster_number >= driver_state.geometry.cluster_count || window_size == 0)
+    return;
+
+  uint32_t window = 0;
+  uint32_t next_cluster_number = get_fat_entry(cluster_number);
+  while (window < window_size && is_chain_cluster(next_cluster_number))
+  {
+    uint32_t run_start = next_cluster_number;
+    uint32_t run = 1;
+    while (window + run < window_size &&
+           get_fat_entry(next_cluster_number) == next_cluster_number + 1)
+    {
+      next_cluster_number++;
+      run++;
+    }
+    block_cache_prefetch(cluster_to_lba(run_start), run * driver_state.geometry.cluster_block_count);
+    window += run;
+    next_cluster_number = get_fat_entry(next_cluster_number);
+  }
+}
+
+void init_directory_table(struct FAT32DirectoryTable *dir_table, char *name,
+                          uint32_t parent_dir_cluster)
+{
+  memcpy(dir_table->table[0].name, name, 8);
+  dir_table->table[0].cluster_high = parent_dir_cluster >> 16;
+  dir_table->table[0].cluster_low = parent_dir_cluster & 0xFFFF;
+  dir_table->table[0].filesize = CLUSTER_SIZE;
+  dir_table->table[0].n_of_entries = 1;
+  dir_table->table[0].attribute = ATTR_SUBDIRECTORY;
+}
+
+void init_directory_table_child(struct FAT32DirectoryTable *dir_table,
+                                char *name, uint32_t parent_dir_cluster)
+{
+  init_directory_table(dir_table, name, parent_dir_cluster);
+  dir_table->table[0].attribute = ATTR_SUBDIRECTORY_CHILD;
+}
+
+// FNV-1a of name and ext, stored in index blocks so it must never change
+static uint32_t hash_entry_name(const char *name, const char *ext)
+{
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i < 8; i++)
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  for (uint8_t i = 0; i < 3; i++)
+    hash = (hash ^ (uint8_t)ext[i]) * 16777619u;
+  return hash;
+}
+
+static uint32_t hash_directory_entry_key(const char *name, const char *ext)
+{
+  return hash_entry_name(name, ext) % FAT32_DIRECTORY_INDEX_BUCKET_COUNT;
+}
+
+static void link_directory_index_node(struct FAT32DirectoryIndex *index, uint16_t position,
+                                      const char *name, const char *ext)
+{
+  uint32_t bucket = hash_directory_entry_key(name, ext);
+  memcpy(index->node[position].name, name, 8);
+  memcpy(index->node[position].ext, ext, 3);
+  index->node[position].next = index->bucket[bucket];
+  index->bucket[bucket] = position;
+}
+
+static void push_directory_index_free_slot(struct FAT32DirectoryIndex *index, uint16_t position)
+{
+  index->node[position].next = index->free_head;
+  index->free_head = position;
+}
+
+// Index of directory whose head is cluster_number, NULL if not built
+static struct FAT32DirectoryIndex *find_directory_index(uint32_t cluster_number)
+{
+  for (uint32_t i = 0; i < FAT32_DIRECTORY_INDEX_COUNT; i++)
+    if (driver_state.directory_index[i].valid && driver_state.directory_index[i].cluster_number == cluster_number)
+      return &driver_state.directory_index[i];
+  return NULL;
+}
+
+// Drop index keyed on cluster that is freed or become a new directory table
+static void invalidate_directory_index(uint32_t cluster_number)
+{
+  struct FAT32DirectoryIndex *index = find_directory_index(cluster_number);
+  if (index != NULL)
+    index->valid = FALSE;
+}
+
+// Whether directory chain fit in an index, walked through FAT sector cache only
+static bool is_directory_indexable(uint32_t cluster_number)
+{
+  uint32_t table_count = 0;
+  while (cluster_number != FAT32_FAT_END_OF_FILE && cluster_number != 0)
+  {
+    if (++table_count > FAT32_DIRECTORY_INDEX_TABLE_COUNT)
+      return FALSE;
+    cluster_number = get_fat_entry(cluster_number);
+  }
+  return TRUE;
+}
+
+static uint32_t find_directory_index_table(struct FAT32DirectoryIndex *index, uint32_t table_cluster_number)
+{
+  uint32_t table = 0;
+  while (table < index->table_count && index->table_cluster_number[table] != table_cluster_number)
+    table++;
+  return table;
+}
+
+/**
+ * Index every slot of directory. Tables are read backward so the free list
+ * pop empty slots in chain order, the same slot a scan would pick. Cluster
+ * whose table is not a directory head is left unindexed
+ *
+ * @param index          Slot to build into
+ * @param cluster_number Head cluster of the directory
+ */
+static void build_directory_index(struct FAT32DirectoryIndex *index, uint32_t cluster_number)
+{
+  index->valid = TRUE;
+  index->cluster_number = cluster_number;
+  index->table_count = 0;
+  index->free_head = FAT32_DIRECTORY_INDEX_NONE;
+  for (uint32_t i = 0; i < FAT32_DIRECTORY_INDEX_BUCKET_COUNT; i++)
+    index->bucket[i] = FAT32_DIRECTORY_INDEX_NONE;
+
+  uint32_t now_cluster_number = cluster_number;
+  do
+  {
+    if (index->table_count == FAT32_DIRECTORY_INDEX_TABLE_COUNT)
+    {
+      index->valid = FALSE;
+      return;
+    }
+    index->table_cluster_number[index->table_count++] = now_cluster_number;
+    now_cluster_number = get_fat_entry(now_cluster_number);
+  } while (now_cluster_number != FAT32_FAT_END_OF_FILE);
+
+  for (uint32_t table = index->table_count; table-- > 0;)
+  {
+    read_directory_table(&driver_state.dir_table_buf, index->table_cluster_number[table]);
+    for (uint16_t slot = FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1; slot > 0; slot--)
+    {
+      struct FAT32DirectoryEntry *entry = &driver_state.dir_table_buf.table[slot];
+      uint16_t position = table * FAT32_DIRECTORY_TABLE_ENTRY_COUNT + slot;
+      if (is_entry_empty(entry))
+        push_directory_index_free_slot(index, position);
+      else
+        link_directory_index_node(index, position, entry->name, entry->ext);
+    }
+  }
+
+  // dir_table_buf now hold the head table
+  if (driver_state.dir_table_buf.table[0].attribute != ATTR_SUBDIRECTORY)
+    index->valid = FALSE;
+}
+
+/**
+ * Get index of directory, built into the least recently used slot when not
+ * cached. Directory too long to index is turned away before any slot is
+ * evicted. dir_table_buf is clobbered when building
+ *
+ * @param cluster_number Head cluster of the directory
+ * @return               Index, NULL if directory cannot be indexed
+ */
+static struct FAT32DirectoryIndex *get_directory_index(uint32_t cluster_number)
+{
+  struct FAT32DirectoryIndex *index = find_directory_index(cluster_number);
+  if (index == NULL)
+  {
+    if (!is_directory_indexable(cluster_number))
+      return NULL;
+    for (uint32_t i = 0; i < FAT32_DIRECTORY_INDEX_COUNT; i++)
+    {
+      struct FAT32DirectoryIndex *candidate = &driver_state.directory_index[i];
+      if (index == NULL || !candidate->valid || (index->valid && candidate->last_use < index->last_use))
+        index = candidate;
+    }
+    build_directory_index(index, cluster_number);
+    if (!index->valid)
+      return NULL;
+  }
+
+  index->last_use = ++driver_state.directory_index_clock;
+  return index;
+}
+
+// Node position of entry with name and ext, FAT32_DIRECTORY_INDEX_NONE if absent
+static uint16_t lookup_directory_index(struct FAT32DirectoryIndex *index, const char *name, const char *ext)
+{
+  uint16_t position = index->bucket[hash_directory_entry_key(name, ext)];
+  while (position != FAT32_DIRECTORY_INDEX_NONE &&
+         (memcmp(index->node[position].name, name, 8) != 0 || memcmp(index->node[position].ext, ext, 3) != 0))
+    position = index->node[position].next;
+  return position;
+}
+
+// Load table holding node position into dir_table_buf
+static struct FAT32DirectoryEntry *load_directory_index_entry(struct FAT32DirectoryIndex *index, uint16_t position,
+                                                             uint32_t *table_cluster_number)
+{
+  *table_cluster_number = index->table_cluster_number[position / FAT32_DIRECTORY_TABLE_ENTRY_COUNT];
+  read_directory_table(&driver_state.dir_table_buf, *table_cluster_number);
+  return &driver_state.dir_table_buf.table[position % FAT32_DIRECTORY_TABLE_ENTRY_COUNT];
+}
+
+/**
+ * Record entry filled by write() in index of its directory, if there is one
+ *
+ * @param cluster_number       Head cluster of the directory
+ * @param table_cluster_number Cluster of the table holding the entry, may be
+ * a table just appended to the directory
+ * @param slot                 Position of the entry in the table
+ * @param entry                The filled entry
+ */
+static void insert_directory_index_entry(uint32_t cluster_number, uint32_t table_cluster_number, uint8_t slot,
+                                         struct FAT32DirectoryEntry *entry)
+{
+  struct FAT32DirectoryIndex *index = find_directory_index(cluster_number);
+  if (index == NULL)
+    return;
+
+  uint32_t table = find_directory_index_table(index, table_cluster_number);
+  if (table == index->table_count)
+  {
+    // Table added by create_child_cluster_of_subdir(), all of its slots are
+    // empty. Directory outgrowing the index give its slot back
+    if (table == FAT32_DIRECTORY_INDEX_TABLE_COUNT)
+    {
+      index->valid = FALSE;
+      return;
+    }
+    index->table_cluster_number[index->table_count++] = table_cluster_number;
+    for (uint16_t i = FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1; i > 0; i--)
+      push_directory_index_free_slot(index, table * FAT32_DIRECTORY_TABLE_ENTRY_COUNT + i);
+  }
+
+  // Filled slot is the top of the free list unless the directory was scanned
+  uint16_t position = table * FAT32_DIRECTORY_TABLE_ENTRY_COUNT + slot;
+  if (index->free_head == position)
+    index->free_head = index->node[position].next;
+  else
+  {
+    uint16_t previous = index->free_head;
+    while (previous != FAT32_DIRECTORY_INDEX_NONE && index->node[previous].next != position)
+      previous = index->node[previous].next;
+    if (previous != FAT32_DIRECTORY_INDEX_NONE)
+      index->node[previous].next = index->node[position].next;
+  }
+  link_directory_index_node(index, position, entry->name, entry->ext);
+}
+
+/**
+ * Forget entry emptied by delete() from index of its directory, if there is
+ * one. The slot become the next one filled
+ *
+ * @param cluster_number       Head cluster of the directory
+ * @param table_cluster_number Cluster of the table holding the entry
+ * @param slot                 Position of the entry in the table
+ */
+static void remove_directory_index_entry(uint32_t cluster_number, uint32_t table_cluster_number, uint8_t slot)
+{
+  struct FAT32DirectoryIndex *index = find_directory_index(cluster_number);
+  if (index == NULL)
+    return;
+
+  // Index out of sync is rebuilt on next lookup
+  uint32_t table = find_directory_index_table(index, table_cluster_number);
+  if (table == index->table_count)
+  {
+    index->valid = FALSE;
+    return;
+  }
+
+  uint16_t position = table * FAT32_DIRECTORY_TABLE_ENTRY_COUNT + slot;
+  uint32_t bucket = hash_directory_entry_key(index->node[position].name, index->node[position].ext);
+  if (index->bucket[bucket] == position)
+    index->bucket[bucket] = index->node[position].next;
+  else
+  {
+    uint16_t previous = index->bucket[bucket];
+    while (previous != FAT32_DIRECTORY_INDEX_NONE && index->node[previous].next != position)
+      previous = index->node[previous].next;
+    if (previous == FAT32_DIRECTORY_INDEX_NONE)
+    {
+      index->valid = FALSE;
+      return;
+    }
+    index->node[previous].next = index->node[position].next;
+  }
+  push_directory_index_free_slot(index, position);
+}
+
+// Slot of (parent, name) in the direct-mapped dentry cache, FNV-1a of both
+static struct FAT32Dentry *get_dentry_slot(uint32_t parent_cluster_number, const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i < 4; i++)
+    hash = (hash ^ ((parent_cluster_number >> (i * 8)) & 0xFF)) * 16777619u;
+  for (uint8_t i = 0; i < 8; i++)
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  return &driver_state.dentry[hash % FAT32_DENTRY_COUNT];
+}
+
+// Cached lookup of subdirectory name in directory, NULL on miss
+static struct FAT32Dentry *lookup_dentry(uint32_t parent_cluster_number, const char *name)
+{
+  struct FAT32Dentry *dentry = get_dentry_slot(parent_cluster_number, name);
+  if (dentry->valid && dentry->parent_cluster_number == parent_cluster_number && memcmp(dentry->name, name, 8) == 0)
+    return dentry;
+  return NULL;
+}
+
+static void insert_dentry(uint32_t parent_cluster_number, const char *name, uint32_t cluster_number,
+                          uint32_t filesize)
+{
+  struct FAT32Dentry *dentry = get_dentry_slot(parent_cluster_number, name);
+  dentry->valid = TRUE;
+  dentry->parent_cluster_number = parent_cluster_number;
+  memcpy(dentry->name, name, 8);
+  dentry->cluster_number = cluster_number;
+  dentry->filesize = filesize;
+}
+
+// Entry named name is created in directory, negative lookup of it is stale
+static void invalidate_dentry(uint32_t parent_cluster_number, const char *name)
+{
+  struct FAT32Dentry *dentry = lookup_dentry(parent_cluster_number, name);
+  if (dentry != NULL)
+    dentry->valid = FALSE;
+}
+
+static bool is_directory_verified(uint32_t cluster_number)
+{
+  return cluster_number != 0 &&
+         driver_state.verified_directory[cluster_number % FAT32_VERIFIED_DIRECTORY_COUNT] == cluster_number;
+}
+
+static void set_directory_verified(uint32_t cluster_number)
+{
+  driver_state.verified_directory[cluster_number % FAT32_VERIFIED_DIRECTORY_COUNT] = cluster_number;
+}
+
+/**
+ * Forget everything cached about cluster that is freed or become a new
+ * directory table: its directory index, lookups into it or resolving to it,
+ * and whether it is reachable from root
+ *
+ * @param cluster_number Head cluster of deleted directory or first cluster of new table
+ */
+static void forget_directory_cluster(uint32_t cluster_number)
+{
+  invalidate_directory_index(cluster_number);
+  if (is_directory_verified(cluster_number))
+    driver_state.verified_directory[cluster_number % FAT32_VERIFIED_DIRECTORY_COUNT] = 0;
+  for (uint32_t i = 0; i < FAT32_DENTRY_COUNT; i++)
+    if (driver_state.dentry[i].parent_cluster_number == cluster_number ||
+        driver_state.dentry[i].cluster_number == cluster_number)
+      driver_state.dentry[i].valid = FALSE;
+}
+
+static void read_hash_index_block(struct FAT32HashIndexBlock *block, uint32_t cluster_number)
+{
+  uint64_t start_cycle = read_tsc();
+  block_cache_read(block, cluster_to_lba(cluster_number), CLUSTER_BLOCK_COUNT);
+  iostat_record(IOSTAT_READ_CLUSTERS, CLUSTER_SIZE, read_tsc() - start_cycle);
+}
+
+static void write_hash_index_block(const struct FAT32HashIndexBlock *block, uint32_t cluster_number)
+{
+  uint64_t start_cycle = read_tsc();
+  block_cache_write(block, cluster_to_lba(cluster_number), CLUSTER_BLOCK_COUNT);
+  iostat_record(IOSTAT_WRITE_CLUSTERS, CLUSTER_SIZE, read_tsc() - start_cycle);
+}
+
+static bool is_hash_index_block_valid(const struct FAT32HashIndexBlock *block, uint32_t cluster_number,
+                                      uint16_t level)
+{
+  return block->header.magic == FAT32_HASH_INDEX_MAGIC && block->header.directory_cluster_number == cluster_number &&
+         block->header.level == level && block->header.record_count > 0 &&
+         block->header.record_count <= FAT32_HASH_INDEX_RECORD_COUNT;
+}
+
+// Head table of hashed directory keep the index root in the access
+// timestamp of table[0], which directory headers never use
+static uint32_t get_hash_index_root_field(const struct FAT32DirectoryEntry *header)
+{
+  return ((uint32_t)header->access_date << 16) | header->access_time;
+}
+
+static void set_hash_index_root_field(struct FAT32DirectoryEntry *header, uint32_t cluster_number)
+{
+  header->access_date = cluster_number >> 16;
+  header->access_time = cluster_number & 0xFFFF;
+}
+
+/**
+ * Find root of hash index of directory and load it into hash_index_buf.
+ * Only the first block of the head table is read, dir_table_buf is untouched
+ *
+ * @param cluster_number Head cluster of the directory
+ * @return               Root cluster, 0 if directory is not hashed or its index is damaged
+ */
+static uint32_t get_hash_index_root(uint32_t cluster_number)
+{
+  struct BlockBuffer head;
+  block_cache_read(&head, cluster_to_lba(cluster_number), 1);
+  const struct FAT32DirectoryEntry *header = (const struct FAT32DirectoryEntry *)head.buf;
+  uint32_t root_cluster_number = get_hash_index_root_field(header);
+  if (header->attribute != ATTR_SUBDIRECTORY || !is_chain_cluster(root_cluster_number))
+    return 0;
+
+  read_hash_index_block(&driver_state.hash_index_buf, root_cluster_number);
+  if (!is_hash_index_block_valid(&driver_state.hash_index_buf, cluster_number, 1))
+    return 0;
+  return root_cluster_number;
+}
+
+// Position of last record whose range start at or below hash
+static uint16_t search_hash_index_block(const struct FAT32HashIndexBlock *block, uint32_t hash)
+{
+  uint16_t low = 0;
+  uint16_t high = block->header.record_count;
+  while (high - low > 1)
+  {
+    uint16_t middle = (low + high) / 2;
+    if (block->record[middle].hash <= hash)
+      low = middle;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static void insert_hash_index_record(struct FAT32HashIndexBlock *block, uint16_t position, uint32_t hash,
+                                     uint32_t cluster_number)
+{
+  for (uint16_t i = block->header.record_count; i > position; i--)
+    block->record[i] = block->record[i - 1];
+  block->record[position].hash = hash;
+  block->record[position].cluster_number = cluster_number;
+  block->header.record_count++;
+}
+
+/**
+ * Walk hash index from the root in hash_index_buf down to the leaf holding
+ * hash. hash_index_buf is left holding the node
+ *
+ * @param cluster_number      Head cluster of the directory
+ * @param hash                Hash of the entry
+ * @param root_position       Set to position of the node record in root
+ * @param node_cluster_number Set to the node block
+ * @param node_position       Set to position of the leaf record in node
+ * @return                    Leaf table cluster, 0 if index is damaged
+ */
+static uint32_t find_hashed_leaf(uint32_t cluster_number, uint32_t hash, uint16_t *root_position,
+                                 uint32_t *node_cluster_number, uint16_t *node_position)
+{
+  struct FAT32HashIndexBlock *block = &driver_state.hash_index_buf;
+  *root_position = search_hash_index_block(block, hash);
+  *node_cluster_number = block->record[*root_position].cluster_number;
+  if (!is_chain_cluster(*node_cluster_number))
+    return 0;
+
+  read_hash_index_block(block, *node_cluster_number);
+  if (!is_hash_index_block_valid(block, cluster_number, 0))
+    return 0;
+  *node_position = search_hash_index_block(block, hash);
+  uint32_t leaf_cluster_number = block->record[*node_position].cluster_number;
+  return is_chain_cluster(leaf_cluster_number) ? leaf_cluster_number : 0;
+}
+
+static struct FAT32DirectoryEntry *find_empty_table_entry(struct FAT32DirectoryTable *table)
+{
+  for (uint8_t i = 1; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT; i++)
+    if (is_entry_empty(&table->table[i]))
+      return &table->table[i];
+  return NULL;
+}
+
+/**
+ * Find entry of hashed directory. Equal hashes never span two leaves, so
+ * only the leaf of its hash is read, into dir_table_buf
+ *
+ * @param cluster_number       Head cluster of the directory, its root in hash_index_buf
+ * @param name                 Name of the entry
+ * @param ext                  Extension of the entry
+ * @param entry                Set to the entry in dir_table_buf, NULL if there is none
+ * @param table_cluster_number Set to the leaf
+ * @return                     False if index is damaged
+ */
+static bool find_hashed_entry(uint32_t cluster_number, const char *name, const char *ext,
+                              struct FAT32DirectoryEntry **entry, uint32_t *table_cluster_number)
+{
+  uint16_t root_position, node_position;
+  uint32_t node_cluster_number;
+  uint32_t leaf_cluster_number = find_hashed_leaf(cluster_number, hash_entry_name(name, ext), &root_position,
+                                                  &node_cluster_number, &node_position);
+  if (leaf_cluster_number == 0)
+    return FALSE;
+
+  read_directory_table(&driver_state.dir_table_buf, leaf_cluster_number);
+  *table_cluster_number = leaf_cluster_number;
+  *entry = NULL;
+  for (uint8_t i = 1; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT && *entry == NULL; i++)
+  {
+    struct FAT32DirectoryEntry *candidate = &driver_state.dir_table_buf.table[i];
+    if (!is_entry_empty(candidate) && memcmp(candidate->name, name, 8) == 0 && memcmp(candidate->ext, ext, 3) == 0)
+      *entry = candidate;
+  }
+  return TRUE;
+}
+
+/**
+ * Split full leaf of hashed directory. Entries from the distinct hash
+ * nearest the middle up move to a new leaf linked right after it in the
+ * chain, the node get a record for the new leaf. Full node is split in two
+ * and the root get a record for the upper half
+ *
+ * @param root_cluster_number     Root block
+ * @param root_position           Position of the node record in root
+ * @param node_cluster_number     Node block, in hash_index_buf
+ * @param node_position           Position of the leaf record in node
+ * @param leaf_cluster_number     Full leaf, in dir_table_buf
+ * @param reserved_cluster_count  Clusters the pending write need
+ * @param split_hash              Set to hash range start of the new leaf
+ * @param new_leaf_cluster_number Set to the new leaf
+ * @return                        0 if split, -1 if there is not enough free
+ * cluster, 1 if leaf hold one hash only or root is full
+ */
+static int8_t split_hashed_leaf(uint32_t root_cluster_number, uint16_t root_position, uint32_t node_cluster_number,
+                                uint16_t node_position, uint32_t leaf_cluster_number, uint32_t reserved_cluster_count,
+                                uint32_t *split_hash, uint32_t *new_leaf_cluster_number)
+{
+  struct FAT32HashIndexBlock *block = &driver_state.hash_index_buf;
+  struct FAT32DirectoryTable *leaf = &driver_state.dir_table_buf;
+
+  // Sorted hashes of the leaf, split where they change nearest the middle
+  uint32_t hash[FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1];
+  for (uint8_t i = 0; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1; i++)
+  {
+    uint32_t value = hash_entry_name(leaf->table[i + 1].name, leaf->table[i + 1].ext);
+    uint8_t j = i;
+    for (; j > 0 && hash[j - 1] > value; j--)
+      hash[j] = hash[j - 1];
+    hash[j] = value;
+  }
+  uint8_t middle = (FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1) / 2;
+  *split_hash = 0;
+  for (uint8_t distance = 0; distance <= middle && *split_hash == 0; distance++)
+  {
+    uint8_t upper = middle + distance;
+    uint8_t lower = middle - distance;
+    if (upper < FAT32_DIRECTORY_TABLE_ENTRY_COUNT - 1 && hash[upper] != hash[upper - 1])
+      *split_hash = hash[upper];
+    else if (lower > 0 && hash[lower] != hash[lower - 1])
+      *split_hash = hash[lower];
+  }
+
+  // Full node need its root to take one more record
+  bool is_node_full = block->header.record_count == FAT32_HASH_INDEX_RECORD_COUNT;
+  if (is_node_full)
+    read_hash_index_block(block, root_cluster_number);
+  if (*split_hash == 0 || (is_node_full && block->header.record_count == FAT32_HASH_INDEX_RECORD_COUNT))
+    return 1;
+  if (driver_state.free_cluster_count < reserved_cluster_count + (is_node_full ? 2 : 1))
+    return -1;
+
+  *new_leaf_cluster_number = allocate_cluster_chain(1, leaf_cluster_number);
+  set_fat_entry(*new_leaf_cluster_number, get_fat_entry(leaf_cluster_number));
+  set_fat_entry(leaf_cluster_number, *new_leaf_cluster_number);
+  forget_directory_cluster(*new_leaf_cluster_number);
+
+  struct FAT32DirectoryTable new_leaf = {0};
+  init_directory_table_child(&new_leaf, leaf->table[0].name, get_entry_cluster_number(&leaf->table[0]));
+  for (uint8_t i = 1; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT; i++)
+  {
+    struct FAT32DirectoryEntry *entry = &leaf->table[i];
+    if (hash_entry_name(entry->name, entry->ext) < *split_hash)
+      continue;
+
+    // Delayed file keep the table holding its entry
+    struct FAT32DelayedFile *delayed_file = find_delayed_file(leaf_cluster_number, entry->name, entry->ext);
+    if (delayed_file != NULL)
+      delayed_file->table_cluster_number = *new_leaf_cluster_number;
+    new_leaf.table[new_leaf.table[0].n_of_entries++] = *entry;
+    memset(entry, 0, sizeof(struct FAT32DirectoryEntry));
+    decrement_subdir_n_of_entry(leaf);
+  }
+  write_directory_table(&new_leaf, *new_leaf_cluster_number);
+  write_directory_table(leaf, leaf_cluster_number);
+
+  read_hash_index_block(block, node_cluster_number);
+  if (!is_node_full)
+  {
+    insert_hash_index_record(block, node_position + 1, *split_hash, *new_leaf_cluster_number);
+    write_hash_index_block(block, node_cluster_number);
+    return 0;
+  }
+
+  // Upper half of the node move to a new node
+  struct FAT32HashIndexBlock new_node = {0};
+  uint16_t half = FAT32_HASH_INDEX_RECORD_COUNT / 2;
+  new_node.header = block->header;
+  new_node.header.record_count = FAT32_HASH_INDEX_RECORD_COUNT - half;
+  for (uint16_t i = half; i < FAT32_HASH_INDEX_RECORD_COUNT; i++)
+    new_node.record[i - half] = block->record[i];
+  block->header.record_count = half;
+  if (node_position < half)
+    insert_hash_index_record(block, node_position + 1, *split_hash, *new_leaf_cluster_number);
+  else
+    insert_hash_index_record(&new_node, node_position + 1 - half, *split_hash, *new_leaf_cluster_number);
+
+  uint32_t new_node_cluster_number = allocate_cluster_chain(1, node_cluster_number);
+  write_hash_index_block(block, node_cluster_number);
+  write_hash_index_block(&new_node, new_node_cluster_number);
+
+  read_hash_index_block(block, root_cluster_number);
+  insert_hash_index_record(block, root_position + 1, new_node.record[0].hash, new_node_cluster_number);
+  write_hash_index_block(block, root_cluster_number);
+  return 0;
+}
+
+/**
+ * Find empty slot in the leaf of hashed directory where entry belong,
+ * splitting the leaf when it is full. The slot is loaded into dir_table_buf
+ *
+ * @param cluster_number         Head cluster of the directory, its root in hash_index_buf
+ * @param root_cluster_number    Root block
+ * @param name                   Name of the entry
+ * @param ext                    Extension of the entry
+ * @param reserved_cluster_count Clusters the pending write need
+ * @param entry                  Set to the empty entry, NULL if there is not enough free cluster
+ * @param table_cluster_number   Set to the leaf, 0 if entry is NULL
+ * @return                       False if index is damaged or cannot grow
+ */
+static bool find_hashed_empty_entry(uint32_t cluster_number, uint32_t root_cluster_number, const char *name,
+                                    const char *ext, uint32_t reserved_cluster_count,
+                                    struct FAT32DirectoryEntry **entry, uint32_t *table_cluster_number)
+{
+  uint32_t hash = hash_entry_name(name, ext);
+  uint16_t root_position, node_position;
+  uint32_t node_cluster_number;
+  uint32_t leaf_cluster_number =
+      find_hashed_leaf(cluster_number, hash, &root_position, &node_cluster_number, &node_position);
+  if (leaf_cluster_number == 0)
+    return FALSE;
+
+  read_directory_table(&driver_state.dir_table_buf, leaf_cluster_number);
+  *entry = find_empty_table_entry(&driver_state.dir_table_buf);
+  *table_cluster_number = leaf_cluster_number;
+  if (*entry != NULL)
+    return TRUE;
+
+  uint32_t split_hash, new_leaf_cluster_number;
+  int8_t retcode = split_hashed_leaf(root_cluster_number, root_position, node_cluster_number, node_position,
+                                     leaf_cluster_number, reserved_cluster_count, &split_hash,
+                                     &new_leaf_cluster_number);
+  if (retcode == 1)
+    return FALSE;
+  if (retcode == -1)
+  {
+    *table_cluster_number = 0;
+    return TRUE;
+  }
+
+  *table_cluster_number = hash < split_hash ? leaf_cluster_number : new_leaf_cluster_number;
+  read_directory_table(&driver_state.dir_table_buf, *table_cluster_number);
+  *entry = find_empty_table_entry(&driver_state.dir_table_buf);
+  return TRUE;
+}
+
+/**
+ * Free index blocks of hashed directory. Only blocks belonging to the
+ * directory are freed, record of a damaged index may point anywhere
+ *
+ * @param cluster_number      Head cluster of the directory
+ * @param root_cluster_number Root block
+ */
+static void free_hash_index(uint32_t cluster_number, uint32_t root_cluster_number)
+{
+  struct FAT32HashIndexBlock root;
+  read_hash_index_block(&root, root_cluster_number);
+  for (uint16_t i = 0; i < root.header.record_count; i++)
+  {
+    uint32_t node_cluster_number = root.record[i].cluster_number;
+    if (!is_chain_cluster(node_cluster_number))
+      continue;
+    read_hash_index_block(&driver_state.hash_index_buf, node_cluster_number);
+    if (is_hash_index_block_valid(&driver_state.hash_index_buf, cluster_number, 0))
+      set_fat_entry(node_cluster_number, FAT32_FAT_EMPTY_ENTRY);
+  }
+  set_fat_entry(root_cluster_number, FAT32_FAT_EMPTY_ENTRY);
+}
+
+// Turn hashed directory back into plain one, its leaves are scanned as before
+static void drop_hash_index(uint32_t cluster_number, uint32_t root_cluster_number)
+{
+  free_hash_index(cluster_number, root_cluster_number);
+  read_directory_table(&driver_state.dir_table_buf, cluster_number);
+  set_hash_index_root_field(&driver_state.dir_table_buf.table[0], 0);
+  write_directory_table(&driver_state.dir_table_buf, cluster_number);
+  invalidate_directory_index(cluster_number);
+}
+
+/**
+ * Convert full directory into hashed layout. Leaf i take the hashes whose
+ * top bits are i, there are at least twice as many leaves as tables so each
+ * end up about half full. Existing tables become the first leaves and new
+ * ones are appended to the chain. Head table is written last, directory
+ * turn hashed only once everything else is in place
+ *
+ * @param index                  Index of the directory, every table known
+ * @param reserved_cluster_count Clusters the pending write need
+ * @return                       True if converted, otherwise directory is left as it was
+ */
+static bool convert_hashed_directory(struct FAT32DirectoryIndex *index, uint32_t reserved_cluster_count)
+{
+  uint32_t leaf_count = 1;
+  uint8_t shift = 32;
+  while (leaf_count < 2 * index->table_count)
+  {
+    leaf_count <<= 1;
+    shift--;
+  }
+  if (driver_state.free_cluster_count < reserved_cluster_count + leaf_count - index->table_count + 2)
+    return FALSE;
 
-  // Copy reserved clusters
-  driver_state.fat_table.cluster_map[0] = CLUSTER_0_VALUE;
-  driver_state.fat_table.cluster_map[1] = CLUSTER_1_VALUE;
-  driver_state.fat_table.cluster_map[2] = FAT32_FAT_END_OF_FILE;
+  // Gather every entry, a leaf receiving more than a table hold fail the conversion.
+  // Indexed directory is at most FAT32_DIRECTORY_INDEX_TABLE_COUNT tables, well
+  // within cluster_buf, which nothing else use until conversion is done
+  struct FAT32DirectoryEntry *hash_index_entry = (struct FAT32DirectoryEntry *)driver_state.cluster_buf;
+  uint32_t entry_count = 0;
+  uint8_t leaf_entry_count[FAT32_HASH_INDEX_MAX_CONVERT_LEAF_COUNT] = {0};
+  struct FAT32DirectoryEntry header;
+  for (uint32_t table = 0; table < index->table_count; table++)
+  {
+    read_directory_table(&driver_state.dir_table_buf, index->table_cluster_number[table]);
+    if (table == 0)
+      header = driver_state.dir_table_buf.table[0];
+    for (uint8_t i = 1; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT; i++)
+    {
+      struct FAT32DirectoryEntry *entry = &driver_state.dir_table_buf.table[i];
+      if (is_entry_empty(entry))
+        continue;
+      hash_index_entry[entry_count++] = *entry;
+      if (++leaf_entry_count[hash_entry_name(entry->name, entry->ext) >> shift] == FAT32_DIRECTORY_TABLE_ENTRY_COUNT)
+        return FALSE;
+    }
+  }
 
-  // Empty the remaining entry in the fat table
-  for (int i = 3; i < CLUSTER_MAP_SIZE; i++)
+  uint32_t leaf_cluster_number[FAT32_HASH_INDEX_MAX_CONVERT_LEAF_COUNT];
+  for (uint32_t leaf = 0; leaf < index->table_count; leaf++)
+    leaf_cluster_number[leaf] = index->table_cluster_number[leaf];
+  uint32_t last_cluster_number = index->table_cluster_number[index->table_count - 1];
+  uint32_t next_cluster_number = allocate_cluster_chain(leaf_count - index->table_count, last_cluster_number);
+  set_fat_entry(last_cluster_number, next_cluster_number);
+  for (uint32_t leaf = index->table_count; leaf < leaf_count; leaf++)
   {
-    driver_state.fat_table.cluster_map[i] = 0;
+    leaf_cluster_number[leaf] = next_cluster_number;
+    forget_directory_cluster(next_cluster_number);
+    next_cluster_number = get_fat_entry(next_cluster_number);
   }
-  write_clusters(&driver_state.fat_table, 1, 1);
-
-  // Initialize root directory
-  struct FAT32DirectoryTable root;
-  init_directory_table(&root, "root\0\0\0", 2);
-  write_clusters(&root, 2, 1);
-}
-
-void initialize_filesystem_fat32(void)
-{
-  if (is_empty_storage())
+  uint32_t root_cluster_number = allocate_cluster_chain(1, index->cluster_number);
+  uint32_t node_cluster_number = allocate_cluster_chain(1, root_cluster_number);
+
+  struct FAT32HashIndexBlock *block = &driver_state.hash_index_buf;
+  memset(block, 0, sizeof(struct FAT32HashIndexBlock));
+  block->header.magic = FAT32_HASH_INDEX_MAGIC;
+  block->header.directory_cluster_number = index->cluster_number;
+  block->header.record_count = leaf_count;
+  for (uint32_t leaf = 0; leaf < leaf_count; leaf++)
   {
-    // Create FAT if it's empty
-    create_fat32();
+    block->record[leaf].hash = leaf << shift;
+    block->record[leaf].cluster_number = leaf_cluster_number[leaf];
   }
+  write_hash_index_block(block, node_cluster_number);
 
-  // Move the FAT table from storage to the driver state
-  read_clusters(&driver_state.fat_table, 1, 1);
+  memset(block->record, 0, sizeof(block->record));
+  block->header.level = 1;
+  block->header.record_count = 1;
+  block->record[0].cluster_number = node_cluster_number;
+  write_hash_index_block(block, root_cluster_number);
 
-  // Initialize B+ Tree
-  BPlusTree = make_tree("root\0\0\0\0", "\0\0\0", 2);
-  initialize_b_tree(BPlusTree, "root\0\0\0\0", 2, 2);
+  for (uint32_t leaf = leaf_count; leaf-- > 0;)
+  {
+    struct FAT32DirectoryTable *table = &driver_state.dir_table_buf;
+    memset(table, 0, sizeof(struct FAT32DirectoryTable));
+    if (leaf == 0)
+    {
+      table->table[0] = header;
+      table->table[0].n_of_entries = 1;
+      set_hash_index_root_field(&table->table[0], root_cluster_number);
+    }
+    else
+      init_directory_table_child(table, header.name, get_entry_cluster_number(&header));
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+      struct FAT32DirectoryEntry *entry = &hash_index_entry[i];
+      if (hash_entry_name(entry->name, entry->ext) >> shift == leaf)
+        table->table[table->table[0].n_of_entries++] = *entry;
+    }
+    write_directory_table(table, leaf_cluster_number[leaf]);
+  }
 
-  // Initialize static array for empty clusters
-  for (int i = 0; i < CLUSTER_SIZE; i++)
+  // Delayed files follow their entry into its leaf
+  for (uint32_t i = 0; i < FAT32_DELAYED_FILE_COUNT; i++)
   {
-    empty_cluster_value[i] = 0;
+    struct FAT32DelayedFile *delayed_file = &driver_state.delayed_file[i];
+    if (delayed_file->valid &&
+        find_directory_index_table(index, delayed_file->table_cluster_number) < index->table_count)
+      delayed_file->table_cluster_number =
+          leaf_cluster_number[hash_entry_name(delayed_file->name, delayed_file->ext) >> shift];
   }
+  invalidate_directory_index(index->cluster_number);
+  return TRUE;
 }
 
-bool is_empty_storage()
+/**
+ * Find entry through index of directory, the table holding it is loaded
+ * into dir_table_buf. Hashed directory read only the leaf of the entry
+ *
+ * @param cluster_number       Head cluster of the directory
+ * @param name                 Name of the entry
+ * @param ext                  Extension of the entry, all zero for directory
+ * @param entry                Set to the entry in dir_table_buf, NULL if there is none
+ * @param table_cluster_number Set to cluster of the table holding the entry
+ * @return                     True if directory is indexed, otherwise dir_table_buf
+ * hold the head table to be scanned
+ */
+static bool find_indexed_entry(uint32_t cluster_number, const char *name, const char *ext,
+                               struct FAT32DirectoryEntry **entry, uint32_t *table_cluster_number)
 {
-  uint8_t boot_sector[BLOCK_SIZE];
-  read_blocks(&boot_sector, BOOT_SECTOR, 1);
-  return memcmp(boot_sector, fs_signature, BLOCK_SIZE);
-}
+  if (get_hash_index_root(cluster_number) != 0 &&
+      find_hashed_entry(cluster_number, name, ext, entry, table_cluster_number))
+    return TRUE;
 
-void write_clusters(const void *ptr, uint32_t cluster_number,
-                    uint8_t cluster_count)
-{
-  uint32_t logical_block_address = cluster_to_lba(cluster_number);
-  uint8_t block_count = cluster_count * CLUSTER_BLOCK_COUNT;
-  write_blocks(ptr, logical_block_address, block_count);
-}
+  struct FAT32DirectoryIndex *index = get_directory_index(cluster_number);
+  if (index == NULL)
+  {
+    read_directory_table(&driver_state.dir_table_buf, cluster_number);
+    return FALSE;
+  }
 
-void read_clusters(void *ptr, uint32_t cluster_number, uint8_t cluster_count)
-{
-  uint32_t logical_block_address = cluster_to_lba(cluster_number);
-  uint8_t block_count = cluster_count * CLUSTER_BLOCK_COUNT;
-  read_blocks(ptr, logical_block_address, block_count);
+  uint16_t position = lookup_directory_index(index, name, ext);
+  *entry = position == FAT32_DIRECTORY_INDEX_NONE ? NULL : load_directory_index_entry(index, position, table_cluster_number);
+  return TRUE;
 }
 
-void init_directory_table(struct FAT32DirectoryTable *dir_table, char *name,
-                          uint32_t parent_dir_cluster)
+/**
+ * Find empty slot for new entry through index of directory, its table is
+ * loaded into dir_table_buf. Hashed directory give a slot in the leaf of the
+ * entry. Otherwise the first empty slot is taken, and when every slot is
+ * taken dir_table_buf hold the last table, ready to be extended by
+ * create_child_cluster_of_subdir(), unless the directory is long enough to
+ * be converted into hashed layout
+ *
+ * @param cluster_number         Head cluster of the directory
+ * @param name                   Name of the new entry
+ * @param ext                    Extension of the new entry, all zero for directory
+ * @param reserved_cluster_count Clusters the pending write need
+ * @param entry                  Set to the empty entry in dir_table_buf, NULL if directory is full
+ * @param table_cluster_number   Set to cluster of the loaded table, 0 if hashed
+ * directory has no free cluster to grow
+ * @return                       True if directory is indexed, otherwise dir_table_buf
+ * hold the head table to be scanned
+ */
+static bool find_indexed_empty_entry(uint32_t cluster_number, const char *name, const char *ext,
+                                     uint32_t reserved_cluster_count, struct FAT32DirectoryEntry **entry,
+                                     uint32_t *table_cluster_number)
 {
-  memcpy(dir_table->table[0].name, name, 8);
-  dir_table->table[0].cluster_high = parent_dir_cluster >> 16;
-  dir_table->table[0].cluster_low = parent_dir_cluster & 0xFFFF;
-  dir_table->table[0].filesize = CLUSTER_SIZE;
-  dir_table->table[0].n_of_entries = 1;
-  dir_table->table[0].attribute = ATTR_SUBDIRECTORY;
-}
+  uint32_t root_cluster_number = get_hash_index_root(cluster_number);
+  if (root_cluster_number != 0)
+  {
+    if (find_hashed_empty_entry(cluster_number, root_cluster_number, name, ext, reserved_cluster_count, entry,
+                                table_cluster_number))
+      return TRUE;
+    drop_hash_index(cluster_number, root_cluster_number);
+  }
 
-void init_directory_table_child(struct FAT32DirectoryTable *dir_table,
-                                char *name, uint32_t parent_dir_cluster)
-{
-  init_directory_table(dir_table, name, parent_dir_cluster);
-  dir_table->table[0].attribute = ATTR_SUBDIRECTORY_CHILD;
+  struct FAT32DirectoryIndex *index = get_directory_index(cluster_number);
+  if (index == NULL)
+  {
+    read_directory_table(&driver_state.dir_table_buf, cluster_number);
+    return FALSE;
+  }
+
+  if (index->free_head != FAT32_DIRECTORY_INDEX_NONE)
+  {
+    *entry = load_directory_index_entry(index, index->free_head, table_cluster_number);
+    return TRUE;
+  }
+
+  if (index->table_count >= FAT32_HASH_INDEX_THRESHOLD_TABLE_COUNT &&
+      convert_hashed_directory(index, reserved_cluster_count))
+    return find_indexed_empty_entry(cluster_number, name, ext, reserved_cluster_count, entry, table_cluster_number);
+
+  *entry = NULL;
+  *table_cluster_number = index->table_cluster_number[index->table_count - 1];
+  read_directory_table(&driver_state.dir_table_buf, *table_cluster_number);
+  return TRUE;
 }
 
 int8_t read_directory(struct FAT32DriverRequest request)
 {
 
-  read_clusters(&driver_state.dir_table_buf, request.parent_cluster_number, 1);
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
 
   if (request.parent_cluster_number == ROOT_CLUSTER_NUMBER && memcmp("root\0\0\0\0", request.name, 8) == 0)
   {
@@ -205,14 +1978,29 @@ int8_t read_directory(struct FAT32DriverRequest request)
     return 3;
   }
 
+  // Repeated lookup is answered from the dentry cache
+  struct FAT32Dentry *dentry = lookup_dentry(request.parent_cluster_number, request.name);
+  if (dentry != NULL)
+  {
+    if (dentry->cluster_number == 0)
+      return 2;
+    if (request.buffer_size < dentry->filesize)
+      return -1;
+    read_directory_by_cluster_number(dentry->cluster_number, request);
+    return 0;
+  }
+
   // Iterate through the directory entries, including traversal through all of
   // directory's cluster and find the matching one
   struct FAT32DirectoryEntry *entry;
-  bool found_matching_directory = FALSE;
-  bool found_matching_file = FALSE;
-  bool end_of_directory = FALSE;
+  uint32_t now_cluster_number = request.parent_cluster_number;
+
+  // Indexed directory is not scanned
+  bool end_of_directory =
+      find_indexed_entry(request.parent_cluster_number, request.name, "\0\0\0", &entry, &now_cluster_number);
+  bool found_matching_file = end_of_directory && entry != NULL;
+  bool found_matching_directory = found_matching_file && is_subdirectory(entry);
 
-  uint16_t now_cluster_number = request.parent_cluster_number;
   while (!end_of_directory && !found_matching_directory)
   {
 
@@ -231,8 +2019,7 @@ int8_t read_directory(struct FAT32DriverRequest request)
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // If directory is found, get out of the loop
     if (found_matching_directory)
@@ -242,9 +2029,8 @@ int8_t read_directory(struct FAT32DriverRequest request)
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 
@@ -256,8 +2042,10 @@ int8_t read_directory(struct FAT32DriverRequest request)
 
   if (!found_matching_directory)
   {
+    insert_dentry(request.parent_cluster_number, request.name, 0, 0);
     return 2;
   }
+  insert_dentry(request.parent_cluster_number, request.name, get_entry_cluster_number(entry), entry->filesize);
 
   // Return error when the buffer size is insufficient
   if (request.buffer_size < entry->filesize)
@@ -272,8 +2060,7 @@ int8_t read_directory(struct FAT32DriverRequest request)
 
 int8_t read(struct FAT32DriverRequest request)
 {
-  read_clusters(&driver_state.dir_table_buf, request.parent_cluster_number, 1);
-  read_clusters(&driver_state.fat_table, 1, 1);
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
 
   // If given parent cluster number isn't the head of a directory, return error
   if (!is_parent_cluster_valid(request))
@@ -284,10 +2071,13 @@ int8_t read(struct FAT32DriverRequest request)
   // Iterate through the directory entries, including traversal through all of
   // directory's cluster and find the matching one
   struct FAT32DirectoryEntry *entry;
-  bool found_matching_file = FALSE;
-  bool end_of_directory = FALSE;
+  uint32_t now_cluster_number = request.parent_cluster_number;
+
+  // Indexed directory is not scanned
+  bool end_of_directory =
+      find_indexed_entry(request.parent_cluster_number, request.name, request.ext, &entry, &now_cluster_number);
+  bool found_matching_file = end_of_directory && entry != NULL;
 
-  uint16_t now_cluster_number = request.parent_cluster_number;
   while (!end_of_directory && !found_matching_file)
   {
 
@@ -305,8 +2095,7 @@ int8_t read(struct FAT32DriverRequest request)
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // If file is found, get out of the loop
     if (found_matching_file)
@@ -316,9 +2105,8 @@ int8_t read(struct FAT32DriverRequest request)
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 
@@ -342,15 +2130,188 @@ int8_t read(struct FAT32DriverRequest request)
   }
 
   // Buffer size sufficient, reading the content
-  read_directory_by_entry(entry, request);
+  request.parent_cluster_number = now_cluster_number;
+  if (!read_file_by_entry(entry, request))
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Copy entry named name.ext in directory, found through the directory index
+ * or by scanning when the directory is not indexed. dir_table_buf is clobbered
+ *
+ * @param cluster_number Head cluster of the directory
+ * @param name           Name of the entry
+ * @param ext            Extension of the entry, all zero for directory
+ * @param entry          Set to copy of the entry if found
+ * @return               Whether the entry is found
+ */
+static bool find_entry(uint32_t cluster_number, const char *name, const char *ext, struct FAT32DirectoryEntry *entry)
+{
+  struct FAT32DirectoryEntry *found;
+  uint32_t table_cluster_number;
+  if (find_indexed_entry(cluster_number, name, ext, &found, &table_cluster_number))
+  {
+    if (found != NULL)
+      *entry = *found;
+    return found != NULL;
+  }
+
+  for (uint32_t now_cluster_number = cluster_number; now_cluster_number != FAT32_FAT_END_OF_FILE;
+       now_cluster_number = get_fat_entry(now_cluster_number))
+  {
+    read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+    for (uint8_t i = 1; i < FAT32_DIRECTORY_TABLE_ENTRY_COUNT; i++)
+    {
+      found = &driver_state.dir_table_buf.table[i];
+      if (!is_entry_empty(found) && memcmp(found->name, name, 8) == 0 && memcmp(found->ext, ext, 3) == 0)
+      {
+        *entry = *found;
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+int8_t resolve_path(struct FAT32PathRequest *request)
+{
+  const char *path = request->path;
+  uint32_t i = 0;
+  uint32_t now_cluster_number = request->start_cluster_number;
+  if (request->path_length > 0 && path[0] == '/')
+    now_cluster_number = ROOT_CLUSTER_NUMBER;
+  if (now_cluster_number < ROOT_CLUSTER_NUMBER || now_cluster_number >= driver_state.geometry.cluster_count)
+    return 4;
+
+  read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+  struct FAT32DriverRequest start = {.parent_cluster_number = now_cluster_number};
+  if (!is_parent_cluster_valid(start))
+    return 4;
+
+  // Entry of the target is known only when the last step looked it up by
+  // name, after a dentry hit or ".." it is looked up at the end
+  uint32_t parent_cluster_number = ROOT_CLUSTER_NUMBER;
+  bool is_file = FALSE;
+  bool has_entry = FALSE;
+  struct FAT32DirectoryEntry entry;
+
+  while (i < request->path_length)
+  {
+    uint32_t component_start = i;
+    while (i < request->path_length && path[i] != '/')
+      i++;
+    const char *component = path + component_start;
+    uint32_t length = i - component_start;
+    request->resolved_length = component_start;
+    if (i < request->path_length)
+      i++;
+
+    // Empty component come from repeated or trailing '/'
+    if (length == 0)
+      continue;
+    if (is_file)
+      return 2;
+    if (length == 1 && component[0] == '.')
+      continue;
+    if (length == 2 && memcmp(component, "..", 2) == 0)
+    {
+      // Table of root point to root itself
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+      now_cluster_number = get_entry_cluster_number(&driver_state.dir_table_buf.table[0]);
+      has_entry = FALSE;
+      continue;
+    }
+
+    // Extension follow the last dot, dot at the start is part of the name
+    uint32_t name_length = length;
+    for (uint32_t j = length - 1; j > 0; j--)
+      if (component[j] == '.')
+      {
+        name_length = j;
+        break;
+      }
+    uint32_t ext_length = name_length == length ? 0 : length - name_length - 1;
+    if (name_length > 8 || ext_length > 3)
+      return 3;
+    char name[8] = {0};
+    char ext[3] = {0};
+    memcpy(name, component, name_length);
+    memcpy(ext, component + name_length + 1, ext_length);
+
+    if (now_cluster_number == ROOT_CLUSTER_NUMBER && ext_length == 0 && memcmp(name, "root\0\0\0\0", 8) == 0)
+    {
+      has_entry = FALSE;
+      continue;
+    }
+
+    struct FAT32Dentry *dentry = ext_length == 0 ? lookup_dentry(now_cluster_number, name) : NULL;
+    if (dentry != NULL && dentry->cluster_number == 0)
+      return 1;
+    if (dentry != NULL)
+    {
+      parent_cluster_number = now_cluster_number;
+      now_cluster_number = dentry->cluster_number;
+      has_entry = FALSE;
+      continue;
+    }
+
+    if (!find_entry(now_cluster_number, name, ext, &entry))
+    {
+      if (ext_length == 0)
+        insert_dentry(now_cluster_number, name, 0, 0);
+      return 1;
+    }
+    parent_cluster_number = now_cluster_number;
+    now_cluster_number = get_entry_cluster_number(&entry);
+    has_entry = TRUE;
+    is_file = !is_subdirectory(&entry);
+
+    // Reached by name from a directory walked up to root
+    if (!is_file)
+    {
+      insert_dentry(parent_cluster_number, name, now_cluster_number, entry.filesize);
+      set_directory_verified(now_cluster_number);
+    }
+  }
+  request->resolved_length = request->path_length;
+
+  // Directory reached without its entry, find it through its table
+  if (!has_entry)
+  {
+    read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
+    entry = driver_state.dir_table_buf.table[0];
+    parent_cluster_number = get_entry_cluster_number(&entry);
+    if (now_cluster_number != ROOT_CLUSTER_NUMBER)
+    {
+      char name[8];
+      memcpy(name, entry.name, 8);
+      if (!find_entry(parent_cluster_number, name, "\0\0\0", &entry))
+        return 1;
+    }
+  }
 
+  request->cluster_number = now_cluster_number;
+  request->parent_cluster_number = parent_cluster_number;
+  request->entry = entry;
   return 0;
 }
 
 int8_t write(struct FAT32DriverRequest request)
 {
-  read_clusters(&driver_state.dir_table_buf, request.parent_cluster_number, 1);
-  read_clusters(&driver_state.fat_table, 1, 1);
+  // File without preallocated extent is buffered, earlier ones are flushed
+  // first when the buffer is full. Flush use dir_table_buf so it go first
+  bool is_delayed = request.buffer_size != 0 && request.buffer_size <= FAT32_DELAYED_BUFFER_SIZE &&
+                    find_reservation(request) == NULL;
+  if (is_delayed && !is_delayed_buffer_available(request.buffer_size))
+  {
+    // File still buffered after a failed flush keep its space, write directly
+    flush_delayed_files();
+    is_delayed = is_delayed_buffer_available(request.buffer_size);
+  }
+
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
 
   // If the given parent cluster number isn't the head of a directory, return
   // error
@@ -366,46 +2327,45 @@ int8_t write(struct FAT32DriverRequest request)
     return 1;
   }
 
-  // Determine the amount of clusters needed
-  int required_clusters = ceil(request.buffer_size, CLUSTER_SIZE);
-
-  if (required_clusters == 0)
-    required_clusters++;
-
-  bool check_empty = FALSE;
-  uint32_t new_cluster_number = 0;
-  int count = 0;
-  uint32_t last_occupied_cluster_number;
-
-  // Iterate through the directory entries and find empty cluster
-  for (int i = 3; i < CLUSTER_MAP_SIZE && !check_empty; i++)
-  {
-    // Check if the cluster empty, if yes target the cluster
-    check_empty = driver_state.fat_table.cluster_map[i] == (uint32_t)0;
-
-    if (check_empty)
-    {
-      if (count == 0)
-        new_cluster_number = i;
-      count++;
-      last_occupied_cluster_number = i;
-      check_empty = (count == required_clusters);
-    }
-  }
+  if (is_creating_directory && memcmp("root\0\0\0\0", request.name, 8) == 0)
+    return 3;
+  invalidate_dentry(request.parent_cluster_number, request.name);
+
+  // Determine the amount of clusters needed, zero clusters of sparse file are not.
+  // Content is scanned only here, the layout is passed down to the writer
+  bool is_sparse = FALSE;
+  int required_clusters = 1;
+  if (!is_creating_directory)
+    required_clusters = get_file_cluster_count(request.buf, request.buffer_size, &is_sparse);
+
+  // Clusters covered by preallocated extent are not taken from free clusters
+  uint32_t goal_cluster_number = request.parent_cluster_number;
+  struct FAT32Reservation *reservation = is_creating_directory ? NULL : find_reservation(request);
+  uint32_t reserved_clusters = reservation == NULL ? 0 : reservation->cluster_count;
+  uint32_t needed_free_clusters =
+      reserved_clusters >= (uint32_t)required_clusters ? 0 : required_clusters - reserved_clusters;
 
   // If not enough clusters to create the requested directory, return erro
-  if (!check_empty)
+  if (driver_state.free_cluster_count < needed_free_clusters)
   {
     return -1;
   }
+  mark_fsinfo_dirty();
 
-  // Iterate through the directory entries and find empty entry
-  bool found_empty_entry = FALSE;
+  // Iterate through the directory entries and find empty entry, indexed
+  // directory is not scanned
   bool cluster_full = FALSE;
-  uint16_t now_cluster_number = request.parent_cluster_number;
-  uint16_t prev_cluster_number;
-  bool end_of_directory = FALSE;
+  uint32_t now_cluster_number = request.parent_cluster_number;
   struct FAT32DirectoryEntry *entry;
+  bool end_of_directory =
+      find_indexed_empty_entry(request.parent_cluster_number, request.name, is_creating_directory ? "\0\0\0" : request.ext,
+                               needed_free_clusters, &entry, &now_cluster_number);
+  bool found_empty_entry = end_of_directory && entry != NULL;
+
+  // Hashed directory grow by splitting a leaf, not by appending a table
+  if (end_of_directory && now_cluster_number == 0)
+    return -1;
+  uint32_t prev_cluster_number = now_cluster_number;
 
   while (!end_of_directory && !found_empty_entry)
   {
@@ -434,16 +2394,14 @@ int8_t write(struct FAT32DriverRequest request)
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0xFFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // Move onto the next cluster if it's not the end yet
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 
@@ -454,7 +2412,7 @@ int8_t write(struct FAT32DriverRequest request)
     // Create the child cluster of the target directory. dir_table_buf will be
     // set into the table of the child cluster
     bool succesfully_created_child_cluster = create_child_cluster_of_subdir(
-        last_occupied_cluster_number, prev_cluster_number, &request);
+        needed_free_clusters, prev_cluster_number, &request);
 
     if (!succesfully_created_child_cluster)
     {
@@ -472,28 +2430,97 @@ int8_t write(struct FAT32DriverRequest request)
   }
 
   // set_create_datetime(entry);
+  uint8_t slot = entry - driver_state.dir_table_buf.table;
 
   // Create a directory
   if (is_creating_directory)
   {
-
-    if (memcmp("root\0\0\0\0", request.name, 8) == 0)
-      return 3;
-
+    // Directory cluster placed near its parent
+    uint32_t new_cluster_number = allocate_cluster_chain(1, goal_cluster_number);
+    if (new_cluster_number == 0)
+      return -1;
     create_subdirectory_from_entry(new_cluster_number, entry, request);
-    BPlusTree = insert(BPlusTree, request.name, request.ext, request.parent_cluster_number);
+    insert_directory_index_entry(goal_cluster_number, request.parent_cluster_number, slot, entry);
+    driver_state.directory_count++;
+    BPlusTree = insert(BPlusTree, request.name, entry->ext, goal_cluster_number);
+    return 0;
+  }
+
+  if (is_delayed)
+  {
+    create_delayed_file_from_entry(entry, request, goal_cluster_number, required_clusters, is_sparse);
+    insert_directory_index_entry(goal_cluster_number, request.parent_cluster_number, slot, entry);
+    driver_state.file_count++;
+    BPlusTree = insert(BPlusTree, request.name, entry->ext, goal_cluster_number);
     return 0;
   }
 
-  // Create a file
-  create_file_from_entry(new_cluster_number, entry, request);
-  BPlusTree = insert(BPlusTree, request.name, request.ext, request.parent_cluster_number);
+  // Create a file, whole chain is allocated as contiguous as possible
+  uint32_t new_cluster_number = allocate_file_chain(reservation, required_clusters, goal_cluster_number);
+  if (new_cluster_number == 0)
+    return -1;
+  create_file_from_entry(new_cluster_number, entry, request, is_sparse);
+  insert_directory_index_entry(goal_cluster_number, request.parent_cluster_number, slot, entry);
+  driver_state.file_count++;
+  BPlusTree = insert(BPlusTree, request.name, entry->ext, goal_cluster_number);
+  return 0;
+}
+
+int8_t preallocate(struct FAT32DriverRequest request)
+{
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
+
+  if (!is_parent_cluster_valid(request))
+    return 2;
+
+  // Directory only take single cluster, nothing to reserve
+  if (request.buffer_size == 0)
+    return -1;
+
+  if (is_requested_directory_already_exist(request))
+    return 1;
+
+  // Replace previous reservation of the same file. Its extent may be reused by
+  // the new one, it is given back only if no new extent is found
+  struct FAT32Reservation *reservation = find_reservation(request);
+  if (reservation != NULL)
+    release_cluster_extent(reservation->first_cluster_number, reservation->cluster_count);
+  else
+  {
+    for (uint32_t i = 0; i < FAT32_RESERVATION_COUNT && reservation == NULL; i++)
+      if (!driver_state.reservation[i].valid)
+        reservation = &driver_state.reservation[i];
+    if (reservation == NULL)
+      return -1;
+  }
+
+  // Clusters taken by delayed files are still free in the bitmap, the free
+  // count is what keep them for flush_delayed_files()
+  uint32_t cluster_count = ceil(request.buffer_size, get_cluster_size());
+  uint32_t extent_length = 0;
+  uint32_t extent_start = 0;
+  if (cluster_count <= driver_state.free_cluster_count)
+    extent_start = find_free_extent(cluster_count, request.parent_cluster_number, &extent_length);
+  if (extent_start == 0 || extent_length < cluster_count)
+  {
+    if (reservation->valid)
+      reserve_cluster_extent(reservation->first_cluster_number, reservation->cluster_count);
+    return 3;
+  }
+
+  reserve_cluster_extent(extent_start, cluster_count);
+  reservation->valid = TRUE;
+  memcpy(reservation->name, request.name, 8);
+  memcpy(reservation->ext, request.ext, 3);
+  reservation->parent_cluster_number = request.parent_cluster_number;
+  reservation->first_cluster_number = extent_start;
+  reservation->cluster_count = cluster_count;
   return 0;
 }
 
 int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_recursion)
 {
-  read_clusters(&driver_state.dir_table_buf, request.parent_cluster_number, 1);
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
 
   // If given parent cluster number isn't the head of a directory, return error
   if (!is_parent_cluster_valid(request))
@@ -502,13 +2529,18 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
   }
 
   // Iterate through the directory entries and find the matching one
-  bool found_directory = FALSE;
-  bool end_of_directory = FALSE;
+  uint32_t directory_cluster_number = request.parent_cluster_number;
   struct FAT32DirectoryEntry *entry;
+  uint32_t now_cluster_number = request.parent_cluster_number;
+  uint32_t prev_cluster_number = now_cluster_number;
+  uint32_t nth_entry;
 
-  uint16_t now_cluster_number = request.parent_cluster_number;
-  uint16_t prev_cluster_number;
-  uint16_t nth_entry;
+  // Indexed directory is not scanned
+  bool end_of_directory =
+      find_indexed_entry(request.parent_cluster_number, request.name, request.ext, &entry, &prev_cluster_number);
+  bool found_directory = end_of_directory && entry != NULL;
+  if (found_directory)
+    nth_entry = entry - driver_state.dir_table_buf.table;
 
   while (!end_of_directory && !found_directory)
   {
@@ -534,8 +2566,7 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // Take notes of the latest_cluster_number for the proper copying of
     // directory table
@@ -551,9 +2582,8 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 
@@ -564,12 +2594,14 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
   }
 
   request.parent_cluster_number = prev_cluster_number;
+  mark_fsinfo_dirty();
 
   if (!is_subdirectory(entry))
   {
     // Not a folder, delete as a file
+    BPlusTree = remove_from_tree(BPlusTree, request.name, entry->ext, directory_cluster_number);
     delete_file_by_entry(entry, request);
-    create_b_tree();
+    remove_directory_index_entry(directory_cluster_number, prev_cluster_number, nth_entry);
     return 0;
   }
 
@@ -582,12 +2614,13 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
   // Folder is empty and can be deleted
   if (is_subdirectory_immediately_empty(entry) && !is_recursive)
   {
+    BPlusTree = remove_from_tree(BPlusTree, request.name, entry->ext, directory_cluster_number);
     delete_subdirectory_by_entry(entry, request);
-    create_b_tree();
+    remove_directory_index_entry(directory_cluster_number, prev_cluster_number, nth_entry);
     return 0;
   }
 
-  uint16_t entry_cluster_position = entry->cluster_low;
+  uint32_t entry_cluster_position = get_entry_cluster_number(entry);
 
   // If check recursion is false, no checking will be done
   if (check_recursion && !is_below_max_recursion_depth(entry_cluster_position, 0))
@@ -599,12 +2632,13 @@ int8_t delete(struct FAT32DriverRequest request, bool is_recursive, bool check_r
   delete_subdirectory_content(entry_cluster_position);
 
   // Reset the read clusters to the cluster where the entry of the directory to be deleted is located in the directory table
-  read_clusters(&driver_state.dir_table_buf, request.parent_cluster_number, 1);
-
-  // Delete the directory itself
-  delete_subdirectory_by_entry(&driver_state.dir_table_buf.table[nth_entry], request);
+  read_directory_table(&driver_state.dir_table_buf, request.parent_cluster_number);
 
-  create_b_tree();
+  // Delete the directory itself, its content already left the B+ Tree
+  entry = &driver_state.dir_table_buf.table[nth_entry];
+  BPlusTree = remove_from_tree(BPlusTree, request.name, entry->ext, directory_cluster_number);
+  delete_subdirectory_by_entry(entry, request);
+  remove_directory_index_entry(directory_cluster_number, prev_cluster_number, nth_entry);
 
   return 0;
 }
@@ -613,46 +2647,62 @@ void delete_subdirectory_by_entry(struct FAT32DirectoryEntry *entry,
                                   struct FAT32DriverRequest req)
 {
 
-  uint16_t now_cluster_number = entry->cluster_low;
-  uint16_t next_cluster_number;
+  uint32_t now_cluster_number = get_entry_cluster_number(entry);
+  uint32_t next_cluster_number;
+  forget_directory_cluster(now_cluster_number);
+  uint32_t root_cluster_number = get_hash_index_root(now_cluster_number);
+  if (root_cluster_number != 0)
+    free_hash_index(now_cluster_number, root_cluster_number);
   do
   {
     next_cluster_number =
-        (uint16_t)(driver_state.fat_table.cluster_map[now_cluster_number] &
-                   0xFFFF);
-    driver_state.fat_table.cluster_map[now_cluster_number] = (uint32_t)0;
+        get_fat_entry(now_cluster_number);
+    set_fat_entry(now_cluster_number, (uint32_t)0);
     reset_cluster(now_cluster_number);
     now_cluster_number = next_cluster_number;
-  } while (now_cluster_number != 0xFFFF);
+  } while (now_cluster_number != FAT32_FAT_END_OF_FILE);
 
   memcpy(entry->name, "\0\0\0\0\0\0\0\0", 8);
   entry->user_attribute = (uint8_t)0;
   entry->attribute = (uint8_t)0;
-  driver_state.fat_table.cluster_map[entry->cluster_low] = (uint32_t)0;
+  set_fat_entry(get_entry_cluster_number(entry), (uint32_t)0);
   entry->cluster_high = (uint16_t)0;
   entry->cluster_low = (uint16_t)0;
 
   // Decrement the number of entry in its targeted parent's directory table
   decrement_subdir_n_of_entry(&(driver_state.dir_table_buf));
+  driver_state.directory_count--;
 
-  write_clusters(&driver_state.fat_table, 1, 1);
-  write_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
+  write_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
 }
 
 void delete_file_by_entry(struct FAT32DirectoryEntry *entry,
                           struct FAT32DriverRequest req)
 {
-  uint16_t now_cluster_number = entry->cluster_low;
-  uint16_t next_cluster_number;
-  do
+  uint32_t now_cluster_number = get_entry_cluster_number(entry);
+  uint32_t next_cluster_number;
+  if (now_cluster_number == 0)
   {
-    next_cluster_number =
-        (uint16_t)(driver_state.fat_table.cluster_map[now_cluster_number] &
-                   0xFFFF);
-    driver_state.fat_table.cluster_map[now_cluster_number] = (uint32_t)0;
-    reset_cluster(now_cluster_number);
-    now_cluster_number = next_cluster_number;
-  } while (now_cluster_number != 0xFFFF);
+    // Delayed file never reached the FAT, its buffer space is reclaimed on flush
+    struct FAT32DelayedFile *delayed_file = find_delayed_file(req.parent_cluster_number, entry->name, entry->ext);
+    if (delayed_file != NULL)
+    {
+      driver_state.free_cluster_count += delayed_file->cluster_count;
+      driver_state.delayed_cluster_count -= delayed_file->cluster_count;
+      delayed_file->valid = FALSE;
+    }
+  }
+  else
+  {
+    do
+    {
+      next_cluster_number =
+          get_fat_entry(now_cluster_number);
+      set_fat_entry(now_cluster_number, (uint32_t)0);
+      reset_cluster(now_cluster_number);
+      now_cluster_number = next_cluster_number;
+    } while (now_cluster_number != FAT32_FAT_END_OF_FILE);
+  }
   memcpy(entry->name, "\0\0\0\0\0\0\0\0", 8);
   memcpy(entry->ext, "\0\0\0", 3);
   entry->cluster_high = 0;
@@ -662,15 +2712,15 @@ void delete_file_by_entry(struct FAT32DirectoryEntry *entry,
 
   // Decrement the number of entry in its targeted parent's directory table
   decrement_subdir_n_of_entry(&(driver_state.dir_table_buf));
+  driver_state.file_count--;
 
-  write_clusters(&driver_state.fat_table, 1, 1);
-  write_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
+  write_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
 }
 
-void delete_subdirectory_content(uint16_t target_cluster_number)
+void delete_subdirectory_content(uint32_t target_cluster_number)
 {
 
-  read_clusters(&driver_state.dir_table_buf, target_cluster_number, 1);
+  read_directory_table(&driver_state.dir_table_buf, target_cluster_number);
 
   struct FAT32DriverRequest req =
       {
@@ -680,7 +2730,7 @@ void delete_subdirectory_content(uint16_t target_cluster_number)
   bool end_of_directory = FALSE;
   struct FAT32DirectoryEntry *entry;
 
-  uint16_t now_cluster_number = target_cluster_number;
+  uint32_t now_cluster_number = target_cluster_number;
 
   while (!end_of_directory)
   {
@@ -695,31 +2745,34 @@ void delete_subdirectory_content(uint16_t target_cluster_number)
       }
       if (is_subdirectory(entry))
       {
+        // Subdirectory is looked up from the head, it may sit in any table
         memcpy(&(req.name), &(entry->name), 8);
+        req.parent_cluster_number = target_cluster_number;
         delete (req, TRUE, FALSE);
+        req.parent_cluster_number = now_cluster_number;
 
         // Reset the content of the driver state to before deletion
-        read_clusters(&driver_state.dir_table_buf, target_cluster_number, 1);
+        read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
       }
       else
       {
+        BPlusTree = remove_from_tree(BPlusTree, entry->name, entry->ext, target_cluster_number);
         delete_file_by_entry(entry, req);
+        remove_directory_index_entry(target_cluster_number, now_cluster_number, i);
       }
     }
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // Move onto the next cluster if it's not the end yet
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
+          get_fat_entry(now_cluster_number);
       req.parent_cluster_number = now_cluster_number;
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 }
@@ -752,89 +2805,75 @@ bool is_subdirectory(struct FAT32DirectoryEntry *entry)
   return entry->attribute == ATTR_SUBDIRECTORY;
 };
 
+uint32_t get_entry_cluster_number(struct FAT32DirectoryEntry *entry)
+{
+  return ((uint32_t)entry->cluster_high << 16) | entry->cluster_low;
+}
+
 int ceil(int a, int b) { return (a / b) + ((a % b != 0) ? 1 : 0); }
 
 void create_subdirectory_from_entry(uint32_t cluster_number,
                                     struct FAT32DirectoryEntry *entry,
                                     struct FAT32DriverRequest req)
 {
-  driver_state.fat_table.cluster_map[cluster_number] = FAT32_FAT_END_OF_FILE;
+  set_fat_entry(cluster_number, FAT32_FAT_END_OF_FILE);
+  forget_directory_cluster(cluster_number);
 
   // Increment the number of entry in its targeted parent's directory table
   increment_subdir_n_of_entry(&(driver_state.dir_table_buf));
   memcpy(entry->name, req.name, 8);
   memcpy(entry->ext, "\0\0\0", 3);
   entry->filesize = req.buffer_size;
-  entry->cluster_high = (uint16_t)cluster_number >> 16;
-  entry->cluster_low = (uint16_t)cluster_number & 0x0000FFFF;
+  entry->cluster_high = cluster_number >> 16;
+  entry->cluster_low = cluster_number & 0x0000FFFF;
   entry->attribute = (uint8_t)ATTR_SUBDIRECTORY;
   entry->user_attribute = (uint8_t)UATTR_NOT_EMPTY;
-  struct FAT32DirectoryTable new_directory;
+  struct FAT32DirectoryTable new_directory = {0};
   init_directory_table(&new_directory, req.name, req.parent_cluster_number);
 
   // Write the new directory into the cluster
-  write_clusters(&new_directory, cluster_number, 1);
+  write_directory_table(&new_directory, cluster_number);
 
-  // Update the file allocation table in storage
-  write_clusters(&driver_state.fat_table, 1, 1);
 
   // Update directory table of the parent
-  write_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
+  write_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
 }
 
 void create_file_from_entry(uint32_t cluster_number,
                             struct FAT32DirectoryEntry *entry,
-                            struct FAT32DriverRequest req)
+                            struct FAT32DriverRequest req,
+                            bool is_sparse)
 {
   // Increment the number of entry in its targeted parent's directory table
   increment_subdir_n_of_entry(&(driver_state.dir_table_buf));
   entry->cluster_high = cluster_number >> 16;
   entry->cluster_low = cluster_number & 0x0000FFFF;
 
-  int required_clusters = ceil(req.buffer_size, CLUSTER_SIZE);
-
-  uint32_t old_cluster_number;
-  for (int i = 0; i < required_clusters; i++)
-  {
-    write_clusters(req.buf + CLUSTER_SIZE * i, cluster_number, 1);
-    old_cluster_number = cluster_number;
-    for (int j = old_cluster_number + 1; j < CLUSTER_MAP_SIZE; j++)
-    {
-      // Check if the cluster is empty
-      if (driver_state.fat_table.cluster_map[j] == 0)
-      {
-        cluster_number = j;
-        break;
-      }
-    }
-    driver_state.fat_table.cluster_map[old_cluster_number] = cluster_number;
-  }
-  driver_state.fat_table.cluster_map[old_cluster_number] =
-      FAT32_FAT_END_OF_FILE;
+  // Chain is already allocated by write(), consecutive clusters are written at once
+  write_file_data(cluster_number, req.buf, req.buffer_size, is_sparse);
 
   memcpy(entry->name, req.name, 8);
   memcpy(entry->ext, req.ext, 3);
   entry->filesize = req.buffer_size;
-  entry->attribute = (uint8_t)0;
+  entry->attribute = is_sparse ? ATTR_SPARSE : 0;
   entry->user_attribute = UATTR_NOT_EMPTY;
 
-  write_clusters(&driver_state.fat_table, 1, 1);
-  write_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
+  write_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
 };
 
 bool is_subdirectory_immediately_empty(struct FAT32DirectoryEntry *entry)
 {
-  uint16_t now_cluster_number = entry->cluster_low;
+  uint32_t now_cluster_number = get_entry_cluster_number(entry);
   struct FAT32DirectoryTable subdir_table;
   bool found_filled = FALSE;
   do
   {
-    read_clusters(&subdir_table, now_cluster_number, 1);
+    read_directory_table(&subdir_table, now_cluster_number);
     now_cluster_number =
-        driver_state.fat_table.cluster_map[now_cluster_number] & 0xFFFF;
+        get_fat_entry(now_cluster_number);
 
     found_filled = !is_subdirectory_cluster_empty(&subdir_table);
-  } while (now_cluster_number != 0xFFFF && !found_filled);
+  } while (now_cluster_number != FAT32_FAT_END_OF_FILE && !found_filled);
   return !found_filled;
 }
 
@@ -858,34 +2897,149 @@ void reset_cluster(uint32_t cluster_number)
   write_clusters(empty_cluster_value, cluster_number, 1);
 }
 
+uint32_t count_contiguous_clusters(uint32_t cluster_number)
+{
+  uint32_t run = 1;
+  while (get_fat_entry(cluster_number) == cluster_number + 1)
+  {
+    cluster_number++;
+    run++;
+  }
+  return run;
+}
+
 void read_directory_by_entry(struct FAT32DirectoryEntry *entry,
                              struct FAT32DriverRequest req)
 {
-  uint16_t now_cluster_number = entry->cluster_low;
-  uint8_t nth_cluster = 0;
-  do
-  {
-    read_clusters(req.buf + CLUSTER_SIZE * nth_cluster, now_cluster_number, 1);
-    now_cluster_number =
-        driver_state.fat_table.cluster_map[now_cluster_number] & 0x0000FFFF;
-    nth_cluster++;
-  } while (now_cluster_number != 0xFFFF);
+  read_directory_by_cluster_number(get_entry_cluster_number(entry), req);
   // set_access_datetime(entry);
 }
 
-void read_directory_by_cluster_number(uint16_t cluster_number,
+/**
+ * Read sparse file content, block map is read one block at a time. Holes
+ * are zero filled, data clusters consecutive both in file and on disk are
+ * read at once
+ *
+ * @param cluster_number First cluster of the chain, first block map cluster
+ * @param buf            Buffer for file content
+ * @param size           File size
+ * @return               False if the disk reported read error
+ */
+static bool read_sparse_file_data(uint32_t cluster_number, uint8_t *buf, uint32_t size)
+{
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t map_entry_count = cluster_size / sizeof(uint32_t);
+  uint32_t file_cluster_count = ceil(size, cluster_size);
+  uint32_t full_clusters = size / cluster_size;
+  uint32_t map[FAT_SECTOR_ENTRY_COUNT];
+  uint32_t map_cluster_number = cluster_number;
+
+  for (uint32_t i = 0; i < file_cluster_count;)
+  {
+    // Map cluster hold whole map blocks, every block start is visited
+    if (i % FAT_SECTOR_ENTRY_COUNT == 0)
+    {
+      if (i > 0 && i % map_entry_count == 0)
+        map_cluster_number = get_fat_entry(map_cluster_number);
+      if (!block_cache_read(map, cluster_to_lba(map_cluster_number) + (i % map_entry_count) / FAT_SECTOR_ENTRY_COUNT, 1))
+        return FALSE;
+    }
+
+    uint32_t data_cluster_number = map[i % FAT_SECTOR_ENTRY_COUNT];
+    uint32_t length = i < full_clusters ? cluster_size : size - cluster_size * i;
+    if (data_cluster_number == 0)
+    {
+      memset(buf + cluster_size * i, 0, length);
+      i++;
+      continue;
+    }
+    if (i >= full_clusters)
+    {
+      if (!read_clusters(driver_state.cluster_buf, data_cluster_number, 1))
+        return FALSE;
+      memcpy(buf + cluster_size * i, driver_state.cluster_buf, length);
+      break;
+    }
+
+    // Run stay inside the map block in hand
+    uint32_t run = 1;
+    while (i + run < full_clusters && (i + run) % FAT_SECTOR_ENTRY_COUNT != 0 &&
+           map[(i + run) % FAT_SECTOR_ENTRY_COUNT] == data_cluster_number + run)
+      run++;
+    if (!read_clusters(buf + cluster_size * i, data_cluster_number, run))
+      return FALSE;
+    i += run;
+  }
+  return TRUE;
+}
+
+bool read_file_by_entry(struct FAT32DirectoryEntry *entry,
+                        struct FAT32DriverRequest req)
+{
+  if (get_entry_cluster_number(entry) == 0)
+  {
+    struct FAT32DelayedFile *delayed_file = find_delayed_file(req.parent_cluster_number, entry->name, entry->ext);
+    if (delayed_file != NULL)
+      memcpy(req.buf, driver_state.delayed_buffer + delayed_file->buffer_offset, entry->filesize);
+    else
+      memset(req.buf, 0, entry->filesize);
+    return TRUE;
+  }
+  if (entry->attribute & ATTR_SPARSE)
+    return read_sparse_file_data(get_entry_cluster_number(entry), req.buf, entry->filesize);
+
+  // Full clusters are read per contiguous run, partial tail cluster is staged
+  // in cluster_buf so nothing past filesize is written into req.buf
+  uint32_t cluster_size = get_cluster_size();
+  uint32_t full_clusters = entry->filesize / cluster_size;
+  uint32_t nth_cluster = 0;
+  uint32_t now_cluster_number = get_entry_cluster_number(entry);
+  while (nth_cluster < full_clusters)
+  {
+    uint32_t run = count_contiguous_clusters(now_cluster_number);
+    if (run > full_clusters - nth_cluster)
+      run = full_clusters - nth_cluster;
+    if (!read_clusters(req.buf + cluster_size * nth_cluster, now_cluster_number, run))
+      return FALSE;
+    nth_cluster += run;
+    now_cluster_number = get_fat_entry(now_cluster_number + run - 1);
+  }
+  if (cluster_size * nth_cluster < entry->filesize)
+  {
+    if (!read_clusters(driver_state.cluster_buf, now_cluster_number, 1))
+      return FALSE;
+    memcpy(req.buf + cluster_size * nth_cluster, driver_state.cluster_buf,
+           entry->filesize - cluster_size * nth_cluster);
+  }
+  return TRUE;
+}
+
+void read_directory_by_cluster_number(uint32_t cluster_number,
                                       struct FAT32DriverRequest req)
 {
-  uint16_t now_cluster_number = cluster_number;
-  uint8_t nth_cluster = 0;
-  do
+  // Tables past buffer_size are left out, long directory is walked with syscall 6
+  uint32_t now_cluster_number = cluster_number;
+  uint32_t nth_table = 0;
+  uint32_t table_count = req.buffer_size / CLUSTER_SIZE;
+  while (now_cluster_number != FAT32_FAT_END_OF_FILE && nth_table < table_count)
   {
-    read_clusters(req.buf + CLUSTER_SIZE * nth_cluster, now_cluster_number, 1);
+    // Table fill the whole cluster only at default cluster size, consecutive
+    // clusters in the chain are then read with single request
+    uint32_t run = 1;
+    if (driver_state.geometry.cluster_block_count == CLUSTER_BLOCK_COUNT)
+    {
+      run = count_contiguous_clusters(now_cluster_number);
+      if (run > table_count - nth_table)
+        run = table_count - nth_table;
+      read_clusters(req.buf + CLUSTER_SIZE * nth_table, now_cluster_number, run);
+    }
+    else
+      read_directory_table(req.buf + CLUSTER_SIZE * nth_table, now_cluster_number);
+    now_cluster_number += run - 1;
     now_cluster_number =
-        driver_state.fat_table.cluster_map[now_cluster_number] & 0x0000FFFF;
-    nth_cluster++;
-  } while (now_cluster_number != 0xFFFF);
-  // set_access_datetime(entry);
+        get_fat_entry(now_cluster_number);
+    nth_table += run;
+  }
 }
 
 void increment_subdir_n_of_entry(struct FAT32DirectoryTable *table)
@@ -911,11 +3065,14 @@ bool is_subdirectory_cluster_full(struct FAT32DirectoryTable *subdir)
 
 bool is_parent_cluster_valid(struct FAT32DriverRequest request)
 {
+  // Directory walked up to root before is not walked again
+  if (is_directory_verified(request.parent_cluster_number))
+    return TRUE;
 
   struct FAT32DirectoryTable current_parent_table;
-  read_clusters(&current_parent_table, request.parent_cluster_number, 1);
+  read_directory_table(&current_parent_table, request.parent_cluster_number);
 
-  if (current_parent_table.table[0].cluster_low == ROOT_CLUSTER_NUMBER)
+  if (get_entry_cluster_number(&current_parent_table.table[0]) == ROOT_CLUSTER_NUMBER)
   {
     return TRUE;
   }
@@ -925,27 +3082,39 @@ bool is_parent_cluster_valid(struct FAT32DriverRequest request)
     return FALSE;
   }
 
+  // Walk up to root, a cycle in corrupted volume is caught by comparing
+  // against checkpoint moved at power of two steps, no visited set needed
   uint32_t target_cluster_number = request.parent_cluster_number;
-  int8_t visited_parent[CLUSTER_MAP_SIZE];
-  for (uint32_t i = 0; i < CLUSTER_MAP_SIZE; i++)
-  {
-    visited_parent[i] = 0;
-  }
+  uint32_t checkpoint_cluster_number = target_cluster_number;
+  uint32_t step = 0;
+  uint32_t power = 1;
 
   current_parent_table = driver_state.dir_table_buf;
 
-  while (target_cluster_number < CLUSTER_MAP_SIZE &&
-         target_cluster_number > ROOT_CLUSTER_NUMBER &&
-         visited_parent[target_cluster_number] == 0)
+  while (target_cluster_number < driver_state.geometry.cluster_count &&
+         target_cluster_number > ROOT_CLUSTER_NUMBER)
   {
-    visited_parent[target_cluster_number] = 1;
-    read_clusters(&current_parent_table, target_cluster_number, 1);
+    read_directory_table(&current_parent_table, target_cluster_number);
+    target_cluster_number = get_entry_cluster_number(&current_parent_table.table[0]);
 
-    target_cluster_number = (current_parent_table.table[0].cluster_high << 16) +
-                            current_parent_table.table[0].cluster_low;
+    // Rest of the way is already known to lead to root
+    if (is_directory_verified(target_cluster_number))
+      target_cluster_number = ROOT_CLUSTER_NUMBER;
+    if (target_cluster_number == checkpoint_cluster_number)
+      return FALSE;
+
+    if (++step == power)
+    {
+      checkpoint_cluster_number = target_cluster_number;
+      power *= 2;
+      step = 0;
+    }
   }
 
-  return target_cluster_number == ROOT_CLUSTER_NUMBER;
+  if (target_cluster_number != ROOT_CLUSTER_NUMBER)
+    return FALSE;
+  set_directory_verified(request.parent_cluster_number);
+  return TRUE;
 }
 
 bool is_subdirectory_cluster_empty(struct FAT32DirectoryTable *subdir)
@@ -965,14 +3134,23 @@ uint32_t get_n_of_cluster_subdir(struct FAT32DirectoryEntry *entry)
 bool is_requested_directory_already_exist(struct FAT32DriverRequest req)
 {
 
-  read_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
   // Determine whether we're creating a file or a folder
   bool is_creating_directory = req.buffer_size == 0;
 
+  // Directory entry has no extension
+  struct FAT32DirectoryEntry *indexed_entry;
+  uint32_t table_cluster_number;
+  if (find_indexed_entry(req.parent_cluster_number, req.name, is_creating_directory ? "\0\0\0" : req.ext,
+                         &indexed_entry, &table_cluster_number))
+  {
+    read_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
+    return indexed_entry != NULL;
+  }
+
   // Iterate through the directory entries and find the same folder/file. Return
   // early if file with the same name already exist.
   bool same_entry = FALSE;
-  uint16_t now_cluster_number = req.parent_cluster_number;
+  uint32_t now_cluster_number = req.parent_cluster_number;
   bool end_of_directory = FALSE;
   while (!end_of_directory && !same_entry)
   {
@@ -1002,58 +3180,38 @@ bool is_requested_directory_already_exist(struct FAT32DriverRequest req)
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // Move onto the next cluster if it's not the end yet
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
 
   // Reset the dir_table in driver state to the original parent
-  read_clusters(&driver_state.dir_table_buf, req.parent_cluster_number, 1);
+  read_directory_table(&driver_state.dir_table_buf, req.parent_cluster_number);
 
   return FALSE;
 }
 
-bool create_child_cluster_of_subdir(uint32_t last_occupied_cluster_number,
-                                    uint16_t prev_cluster_number,
+bool create_child_cluster_of_subdir(uint32_t reserved_cluster_count,
+                                    uint32_t prev_cluster_number,
                                     struct FAT32DriverRequest *req)
 {
-  // Iterate through the file allocation table and find empty cluster for the
-  // directory expansion
-  uint32_t new_cluster_number_directory;
-  bool empty_cluster_found = FALSE;
-
-  // Find clusters after the allocated cluster of the requested directory itself
-  for (int i = last_occupied_cluster_number + 1;
-       i < CLUSTER_MAP_SIZE && !empty_cluster_found; i++)
-  {
-    // Check if the cluster is empty, if yes target the cluster
-    empty_cluster_found = driver_state.fat_table.cluster_map[i] == (uint32_t)0;
-
-    if (empty_cluster_found)
-      new_cluster_number_directory = i;
-  }
-
-  // If not enough cluster for expanding directory, return error
-  if (!empty_cluster_found)
+  // If not enough cluster for expanding directory and the entry, return error
+  if (driver_state.free_cluster_count <= reserved_cluster_count)
   {
     return FALSE;
   }
 
-  // Point the last cluster of the directory to the new to-be-allocated-cluster
-  driver_state.fat_table.cluster_map[prev_cluster_number] =
-      new_cluster_number_directory;
-
-  // Point the to-be-allocated-cluster to EOF
-  driver_state.fat_table.cluster_map[new_cluster_number_directory] =
-      FAT32_FAT_END_OF_FILE;
+  // Allocated cluster already point to EOF, link the last cluster of the
+  // directory into it
+  uint32_t new_cluster_number_directory = allocate_cluster_chain(1, prev_cluster_number);
+  set_fat_entry(prev_cluster_number, new_cluster_number_directory);
+  forget_directory_cluster(new_cluster_number_directory);
 
   uint16_t cluster_low_original = driver_state.dir_table_buf.table->cluster_low;
   uint16_t cluster_high_original =
@@ -1062,7 +3220,7 @@ bool create_child_cluster_of_subdir(uint32_t last_occupied_cluster_number,
       (cluster_high_original << 16) | cluster_low_original;
 
   // Create and allocate the table
-  struct FAT32DirectoryTable new_cluster_for_directory;
+  struct FAT32DirectoryTable new_cluster_for_directory = {0};
   init_directory_table_child(&new_cluster_for_directory,
                              driver_state.dir_table_buf.table->name,
                              parent_dir_cluster);
@@ -1094,7 +3252,7 @@ void set_access_datetime(struct FAT32DirectoryEntry *entry)
   entry->access_time = (FTTimestamp & 0x0000FFFF);
 }
 
-bool is_below_max_recursion_depth(uint16_t target_cluster_number, uint8_t recursion_count)
+bool is_below_max_recursion_depth(uint32_t target_cluster_number, uint8_t recursion_count)
 {
   // Basis
   if (recursion_count >= MAX_RECURSIVE_OP_DEPTH)
@@ -1103,12 +3261,12 @@ bool is_below_max_recursion_depth(uint16_t target_cluster_number, uint8_t recurs
   }
 
   // Get the directory table of the directory to check
-  read_clusters(&driver_state.dir_table_buf, target_cluster_number, 1);
+  read_directory_table(&driver_state.dir_table_buf, target_cluster_number);
 
   bool end_of_directory = FALSE;
   struct FAT32DirectoryEntry *entry;
 
-  uint16_t now_cluster_number = target_cluster_number;
+  uint32_t now_cluster_number = target_cluster_number;
 
   while (!end_of_directory)
   {
@@ -1119,26 +3277,24 @@ bool is_below_max_recursion_depth(uint16_t target_cluster_number, uint8_t recurs
       if (!is_entry_empty(entry) && is_subdirectory(entry))
       {
         // Return false if recursive checking finds the subdirectory in the directory too deep
-        if (!is_below_max_recursion_depth(entry->cluster_low, recursion_count + 1))
+        if (!is_below_max_recursion_depth(get_entry_cluster_number(entry), recursion_count + 1))
         {
           return FALSE;
         }
-        read_clusters(&driver_state.dir_table_buf, target_cluster_number, 1);
+        read_directory_table(&driver_state.dir_table_buf, target_cluster_number);
       }
     }
 
     // If the cluster_number is EOF, then we've finished examining the last
     // cluster of the directory
-    end_of_directory = (driver_state.fat_table.cluster_map[now_cluster_number] &
-                        0x0000FFFF) == 0xFFFF;
+    end_of_directory = get_fat_entry(now_cluster_number) == FAT32_FAT_END_OF_FILE;
 
     // Move onto the next cluster if it's not the end yet
     if (!end_of_directory)
     {
       now_cluster_number =
-          driver_state.fat_table.cluster_map[now_cluster_number];
-      read_clusters(&driver_state.dir_table_buf, (uint32_t)now_cluster_number,
-                    1);
+          get_fat_entry(now_cluster_number);
+      read_directory_table(&driver_state.dir_table_buf, now_cluster_number);
     }
   }
   return TRUE;
@@ -7,6 +7,8 @@
 #include "lib-header/fat32.h"
 #include "lib-header/stdmem.h"
 #include "lib-header/bplustree.h"
+#include "lib-header/disk.h"
+#include "lib-header/iostat.h"
 
 void io_wait(void)
 {
@@ -58,6 +60,13 @@ void activate_keyboard_interrupt(void)
     out(PIC2_DATA, PIC_DISABLE_ALL_MASK);
 }
 
+void activate_ata_interrupt(void)
+{
+    // IRQ 14 and 15 are routed through slave PIC, which is cascaded into master IRQ 2
+    out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_CASCADE));
+    out(PIC2_DATA, in(PIC2_DATA) & ~((1 << (IRQ_PRIMARY_ATA - 8)) | (1 << (IRQ_SECOND_ATA - 8))));
+}
+
 void set_tss_kernel_current_stack(void)
 {
     uint32_t stack_ptr;
@@ -125,6 +134,15 @@ void puts(char *buf, uint32_t length, uint8_t color)
     }
 }
 
+// Power off the emulator, halt forever on machine without known shutdown port
+static void power_off(void)
+{
+    out16(QEMU_SHUTDOWN_PORT, ACPI_SHUTDOWN_VALUE);
+    out16(BOCHS_SHUTDOWN_PORT, ACPI_SHUTDOWN_VALUE);
+    while (TRUE)
+        __asm__ volatile("cli; hlt");
+}
+
 void syscall(struct CPURegister cpu, __attribute__((unused)) struct InterruptStack info)
 {
 
@@ -132,30 +150,40 @@ void syscall(struct CPURegister cpu, __attribute__((unused)) struct InterruptSta
     if (cpu.eax == 0)
     {
         struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
+        uint8_t previous_entry = iostat_enter(IOSTAT_ENTRY_READ);
         *((int8_t *)cpu.ecx) = read(request);
+        iostat_leave(previous_entry);
     }
 
     else if (cpu.eax == 1)
     {
         struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
+        uint8_t previous_entry = iostat_enter(IOSTAT_ENTRY_READ_DIRECTORY);
         *((int8_t *)cpu.ecx) = read_directory(request);
+        iostat_leave(previous_entry);
     }
 
     else if (cpu.eax == 2)
     {
         struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
+        uint8_t previous_entry = iostat_enter(IOSTAT_ENTRY_WRITE);
         *((int8_t *)cpu.ecx) = write(request);
+        iostat_leave(previous_entry);
     }
 
     else if (cpu.eax == 3)
     {
         struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
         bool is_recursive = (bool)cpu.edx;
+        uint8_t previous_entry = iostat_enter(IOSTAT_ENTRY_DELETE);
         *((int8_t *)cpu.ecx) = delete (request, is_recursive, TRUE);
+        iostat_leave(previous_entry);
     }
 
     else if (cpu.eax == 4)
     {
+        // Shell is about to idle waiting for input, write back FAT and cached blocks
+        sync_filesystem_fat32();
         keyboard_state_activate();
         __asm__("sti"); // Due IRQ is disabled when main_interrupt_handler() called
         while (is_keyboard_blocking())
@@ -176,17 +204,24 @@ void syscall(struct CPURegister cpu, __attribute__((unused)) struct InterruptSta
     {
         struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
 
+        int8_t retcode = 1;
         if (request.buffer_size >= CLUSTER_SIZE)
         {
-            read_clusters(request.buf, request.parent_cluster_number, 1);
-            *((int8_t *)cpu.ecx) = 0;
-        }
+            read_directory_table(request.buf, request.parent_cluster_number);
+            retcode = 0;
 
-        else
-        {
-            // buffer size too small
-            *((int8_t *)cpu.ecx) = 1;
+            // Next table of the chain in edx, 0 after the last, so directory
+            // of any length can be read table by table
+            if (cpu.edx != 0)
+            {
+                uint32_t next_cluster_number = get_fat_entry(request.parent_cluster_number);
+                *((uint32_t *)cpu.edx) = next_cluster_number == FAT32_FAT_END_OF_FILE ? 0 : next_cluster_number;
+            }
         }
+
+        // retcode 1 if buffer size too small
+        if (cpu.ecx != 0)
+            *((int8_t *)cpu.ecx) = retcode;
     }
 
     else if (cpu.eax == 7)
@@ -202,6 +237,52 @@ void syscall(struct CPURegister cpu, __attribute__((unused)) struct InterruptSta
             request->result.n_of_items = 0;
         }
     }
+
+    // sync, write dirty FAT sectors and cached blocks into disk, ecx may point
+    // to receive 0 on success or -1 if something did not reach storage
+    else if (cpu.eax == 8)
+    {
+        int8_t retcode = sync_filesystem_fat32() ? 0 : -1;
+        if (cpu.ecx)
+            *((int8_t *)cpu.ecx) = retcode;
+    }
+
+    // preallocate, reserve contiguous extent for a file written later
+    else if (cpu.eax == 9)
+    {
+        struct FAT32DriverRequest request = *(struct FAT32DriverRequest *)cpu.ebx;
+        *((int8_t *)cpu.ecx) = preallocate(request);
+    }
+
+    // iostat, copy block layer and FAT32 counters, reset them if edx is nonzero
+    else if (cpu.eax == 10)
+    {
+        get_io_statistic((struct IOStatistic *)cpu.ebx);
+        if (cpu.edx)
+            reset_io_statistic();
+    }
+
+    // shutdown, sync file system, let block device persist itself, then power off
+    else if (cpu.eax == 11)
+    {
+        sync_filesystem_fat32();
+        shutdown_disk();
+        power_off();
+    }
+
+    // statfs, copy volume usage kept by the file system driver
+    else if (cpu.eax == 12)
+    {
+        get_volume_statistic((struct FAT32VolumeStatistic *)cpu.ebx);
+    }
+
+    // resolve path, walk every component in the kernel and copy the target entry
+    else if (cpu.eax == 13)
+    {
+        uint8_t previous_entry = iostat_enter(IOSTAT_ENTRY_RESOLVE_PATH);
+        *((int8_t *)cpu.ecx) = resolve_path((struct FAT32PathRequest *)cpu.ebx);
+        iostat_leave(previous_entry);
+    }
 }
 
 void main_interrupt_handler(struct CPURegister cpu, uint32_t int_number, struct InterruptStack info)
@@ -211,6 +292,12 @@ void main_interrupt_handler(struct CPURegister cpu, uint32_t int_number, struct
     case PIC1_OFFSET + IRQ_KEYBOARD:
         keyboard_isr();
         break;
+    case PIC1_OFFSET + IRQ_PRIMARY_ATA:
+        ata_isr(ATA_PRIMARY_CHANNEL);
+        break;
+    case PIC1_OFFSET + IRQ_SECOND_ATA:
+        ata_isr(ATA_SECONDARY_CHANNEL);
+        break;
     case 0x30:
         syscall(cpu, info);
         break;
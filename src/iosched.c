@@ -0,0 +1,146 @@
+#include "lib-header/iosched.h"
+
+static struct IOSchedulerState io_scheduler_state;
+
+// Segment lists of merged runs, one segment per queued request. Runs submitted
+// together keep their own slice until io_unplug() wait for completion
+static struct BlockSegment io_segment[IO_QUEUE_SIZE];
+
+static bool is_deadline_expired(void)
+{
+  for (uint32_t i = 0; i < io_scheduler_state.queue_count; i++)
+    if ((int32_t)(io_scheduler_state.clock - io_scheduler_state.queue[i].deadline) >= 0)
+      return TRUE;
+  return FALSE;
+}
+
+static void sort_queue_by_lba(void)
+{
+  // Insertion sort, queue is small and usually submitted almost in order
+  for (uint32_t i = 1; i < io_scheduler_state.queue_count; i++)
+  {
+    struct IORequest request = io_scheduler_state.queue[i];
+    uint32_t j = i;
+    while (j > 0 && io_scheduler_state.queue[j - 1].logical_block_address > request.logical_block_address)
+    {
+      io_scheduler_state.queue[j] = io_scheduler_state.queue[j - 1];
+      j--;
+    }
+    io_scheduler_state.queue[j] = request;
+  }
+}
+
+void io_submit_write(const void *buf, uint32_t logical_block_address, uint32_t block_count)
+{
+  if (io_scheduler_state.queue_count == IO_QUEUE_SIZE)
+    io_unplug();
+
+  struct IORequest *request = &io_scheduler_state.queue[io_scheduler_state.queue_count++];
+  request->buf = buf;
+  request->logical_block_address = logical_block_address;
+  request->block_count = block_count;
+  request->deadline = io_scheduler_state.clock + IO_WRITE_DEADLINE;
+  io_scheduler_state.statistic.submitted++;
+
+  io_scheduler_state.clock++;
+  if (is_deadline_expired())
+  {
+    io_scheduler_state.statistic.expired++;
+    io_unplug();
+  }
+}
+
+bool io_read(void *buf, uint32_t logical_block_address, uint32_t block_count)
+{
+  // Read must observe queued data, dispatch everything if any write overlap
+  for (uint32_t i = 0; i < io_scheduler_state.queue_count; i++)
+  {
+    struct IORequest *request = &io_scheduler_state.queue[i];
+    if (request->logical_block_address < logical_block_address + block_count &&
+        logical_block_address < request->logical_block_address + request->block_count)
+    {
+      io_unplug();
+      break;
+    }
+  }
+
+  io_scheduler_state.statistic.read++;
+  bool ok = read_blocks(buf, logical_block_address, block_count);
+
+  io_scheduler_state.clock++;
+  if (is_deadline_expired())
+  {
+    io_scheduler_state.statistic.expired++;
+    io_unplug();
+  }
+  return ok;
+}
+
+void io_unplug(void)
+{
+  uint32_t count = io_scheduler_state.queue_count;
+  if (count == 0)
+    return;
+  sort_queue_by_lba();
+
+  // C-LOOK, first request at or above the head then wrap around once
+  uint32_t start = 0;
+  while (start < count && io_scheduler_state.queue[start].logical_block_address < io_scheduler_state.head_position)
+    start++;
+  if (start == count)
+    start = 0;
+
+  uint32_t dispatched = 0;
+  uint32_t segment_base = 0;
+  while (dispatched < count)
+  {
+    uint32_t index = (start + dispatched) % count;
+    struct IORequest *first = &io_scheduler_state.queue[index];
+    uint32_t next_lba = first->logical_block_address;
+    uint32_t segment_count = 0;
+    struct BlockSegment *segment = io_segment + segment_base;
+
+    // Merge while next request in sweep order start where the run end
+    do
+    {
+      struct IORequest *request = &io_scheduler_state.queue[index];
+      segment[segment_count].buf = request->buf;
+      segment[segment_count].block_count = request->block_count;
+      segment_count++;
+      next_lba = request->logical_block_address + request->block_count;
+      dispatched++;
+      index = (start + dispatched) % count;
+    } while (dispatched < count && index != 0 &&
+             io_scheduler_state.queue[index].logical_block_address == next_lba);
+
+    io_scheduler_state.statistic.merged += segment_count - 1;
+    io_scheduler_state.statistic.dispatched++;
+    submit_block_segments(segment, segment_count, first->logical_block_address);
+    segment_base += segment_count;
+    io_scheduler_state.head_position = next_lba;
+  }
+
+  // Merged runs may be in flight together on queuing device, request buffers
+  // are reusable only after every run completed
+  if (!wait_blocks())
+    io_scheduler_state.write_failed = TRUE;
+  io_scheduler_state.queue_count = 0;
+  io_scheduler_state.unplug_count++;
+}
+
+uint32_t io_get_unplug_count(void)
+{
+  return io_scheduler_state.unplug_count;
+}
+
+bool io_take_write_status(void)
+{
+  bool ok = !io_scheduler_state.write_failed;
+  io_scheduler_state.write_failed = FALSE;
+  return ok;
+}
+
+void get_io_scheduler_statistic(struct IOSchedulerStatistic *statistic)
+{
+  *statistic = io_scheduler_state.statistic;
+}
@@ -0,0 +1,53 @@
+#include "lib-header/iostat.h"
+#include "lib-header/stdmem.h"
+
+static struct IOStatistic io_statistic;
+static uint8_t active_entry = IOSTAT_ENTRY_OTHER;
+
+static uint8_t latency_bucket(uint64_t cycle)
+{
+  uint8_t bucket = 0;
+  cycle >>= IOSTAT_HISTOGRAM_SHIFT + 1;
+  while (cycle > 0 && bucket < IOSTAT_HISTOGRAM_BUCKET_COUNT - 1)
+  {
+    cycle >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void iostat_record(uint8_t operation, uint32_t byte_count, uint64_t cycle)
+{
+  struct IOStatOperationCounter *counter = &io_statistic.operation[operation];
+  counter->call++;
+  counter->byte += byte_count;
+  counter->histogram[latency_bucket(cycle)]++;
+
+  struct IOStatEntryCounter *entry = &io_statistic.entry[active_entry];
+  entry->operation[operation]++;
+  if (operation == IOSTAT_READ_BLOCKS || operation == IOSTAT_WRITE_BLOCKS)
+    entry->disk_byte += byte_count;
+}
+
+uint8_t iostat_enter(uint8_t entry)
+{
+  uint8_t previous = active_entry;
+  active_entry = entry;
+  io_statistic.entry[entry].call++;
+  return previous;
+}
+
+void iostat_leave(uint8_t previous)
+{
+  active_entry = previous;
+}
+
+void get_io_statistic(struct IOStatistic *statistic)
+{
+  *statistic = io_statistic;
+}
+
+void reset_io_statistic(void)
+{
+  memset(&io_statistic, 0, sizeof(io_statistic));
+}
@@ -16,8 +16,10 @@ void kernel_setup(void)
     pic_remap();
     initialize_idt();
     activate_keyboard_interrupt();
+    activate_ata_interrupt();
     framebuffer_clear();
     framebuffer_set_cursor(0, 0);
+    initialize_disk();
     initialize_filesystem_fat32();
     gdt_install_tss();
     set_tss_register();
@@ -2,14 +2,15 @@ global loader                                 ; the entry symbol for ELF
 global enter_protected_mode                   ; go to protected mode
 global set_tss_register                       ; set tss register to GDT entry
 global kernel_execute_user_program            ; execute user program from kernel
+global _multiboot_info_physical_addr          ; multiboot information passed by GRUB
 extern kernel_setup                           ; kernel C entrypoint
 extern _paging_kernel_page_directory          ; kernel page directory
 
 KERNEL_VIRTUAL_BASE equ 0xC0000000            ; kernel virtual memory
 KERNEL_STACK_SIZE   equ 2097152               ; size of stack in bytes
 MAGIC_NUMBER        equ 0x1BADB002            ; define the magic number constant
-FLAGS               equ 0x0                   ; multiboot flags
-CHECKSUM            equ -MAGIC_NUMBER         ; calculate the checksum
+FLAGS               equ 0x1                   ; multiboot flags, page align modules
+CHECKSUM            equ -(MAGIC_NUMBER + FLAGS) ; calculate the checksum
                                               ; (magic number + checksum + flags should equal 0)
 
 
@@ -17,6 +18,8 @@ section .bss
 align 4                                       ; align at 4 bytes
 kernel_stack:                                 ; label points to beginning of memory
     resb KERNEL_STACK_SIZE                    ; reserve stack for the kernel
+_multiboot_info_physical_addr:                ; ebx from GRUB, saved before kernel_setup
+    resd 1
 
 
 section .multiboot                            ; GRUB multiboot header
@@ -52,6 +55,7 @@ loader_virtual:
     mov dword [_paging_kernel_page_directory], 0
     invlpg [0] ; Delete identity mapping and invalidate TLB cache for first page
     mov esp, kernel_stack + KERNEL_STACK_SIZE ; Setup stack register to proper location
+    mov [_multiboot_info_physical_addr], ebx  ; ebx is untouched since GRUB jumped into loader
     call kernel_setup
 .loop:
     jmp .loop                                 ; loop forever
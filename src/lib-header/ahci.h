@@ -0,0 +1,218 @@
+#ifndef _AHCI_H
+#define _AHCI_H
+
+#include "stdtype.h"
+#include "blockdev.h"
+
+/* -- HBA capability and global host control bits -- */
+#define AHCI_CAP_NCS_SHIFT 8 // Command slot count - 1, 5-bit
+#define AHCI_CAP_NCS_MASK 0x1F
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_GHC_AE (1u << 31)
+
+/* -- Port command and status bits -- */
+#define AHCI_PORT_CMD_ST (1u << 0)
+#define AHCI_PORT_CMD_FRE (1u << 4)
+#define AHCI_PORT_CMD_FR (1u << 14)
+#define AHCI_PORT_CMD_CR (1u << 15)
+#define AHCI_PORT_IS_TFES (1u << 30)
+#define AHCI_PORT_TFD_ERR 0x01
+#define AHCI_PORT_TFD_DRQ 0x08
+#define AHCI_PORT_TFD_BSY 0x80
+#define AHCI_PORT_SSTS_DET_MASK 0x0F
+#define AHCI_PORT_SSTS_DET_PRESENT 0x03
+#define AHCI_PORT_SIG_ATA 0x00000101
+
+#define AHCI_PORT_COUNT 32
+#define AHCI_SLOT_COUNT 32
+
+/* -- FIS and ATA commands -- */
+#define AHCI_FIS_TYPE_REG_H2D 0x27
+#define AHCI_FIS_COMMAND 0x80 // C bit, FIS carry a command
+#define AHCI_CMD_READ_DMA 0xC8
+#define AHCI_CMD_WRITE_DMA 0xCA
+#define AHCI_CMD_READ_DMA_EXT 0x25
+#define AHCI_CMD_WRITE_DMA_EXT 0x35
+#define AHCI_CMD_READ_FPDMA_QUEUED 0x60
+#define AHCI_CMD_WRITE_FPDMA_QUEUED 0x61
+#define AHCI_CMD_IDENTIFY 0xEC
+#define AHCI_DEVICE_LBA 0x40
+
+/* -- IDENTIFY word offsets -- */
+#define AHCI_IDENTIFY_LBA28_BLOCK_COUNT 60
+#define AHCI_IDENTIFY_QUEUE_DEPTH 75
+#define AHCI_IDENTIFY_SATA_CAPABILITY 76
+#define AHCI_IDENTIFY_NCQ_SUPPORTED (1 << 8)
+#define AHCI_IDENTIFY_COMMAND_SET_2 83
+#define AHCI_IDENTIFY_LBA48_SUPPORTED (1 << 10)
+#define AHCI_IDENTIFY_LBA48_BLOCK_COUNT 100
+
+/* -- Command geometry -- */
+#define AHCI_COMMAND_HEADER_FLAG_WRITE (1 << 6)
+#define AHCI_COMMAND_FIS_DWORD_COUNT 5
+#define AHCI_PRDT_PER_COMMAND 8
+#define AHCI_MAX_BLOCK_PER_COMMAND 128
+
+/**
+ * AHCIPortRegister - Memory-mapped registers of single HBA port
+ *
+ * @param command_list_base   Physical address of command list, 1 KiB aligned
+ * @param fis_base            Physical address of received FIS area, 256 bytes aligned
+ * @param interrupt_status    Port interrupt status, write 1 to clear
+ * @param interrupt_enable    Port interrupt enable
+ * @param command             Command and status (ST, FRE, FR, CR)
+ * @param task_file_data      Copy of ATA status and error register
+ * @param signature           Device signature after reset
+ * @param sata_status         SStatus, device detection in DET field
+ * @param sata_error          SError, write 1 to clear
+ * @param sata_active         Outstanding NCQ tags
+ * @param command_issue       Outstanding command slots
+ */
+struct AHCIPortRegister {
+  uint32_t command_list_base;
+  uint32_t command_list_base_upper;
+  uint32_t fis_base;
+  uint32_t fis_base_upper;
+  uint32_t interrupt_status;
+  uint32_t interrupt_enable;
+  uint32_t command;
+  uint32_t reserved0;
+  uint32_t task_file_data;
+  uint32_t signature;
+  uint32_t sata_status;
+  uint32_t sata_control;
+  uint32_t sata_error;
+  uint32_t sata_active;
+  uint32_t command_issue;
+  uint32_t sata_notification;
+  uint32_t fis_switching_control;
+  uint32_t reserved1[11];
+  uint32_t vendor[4];
+} __attribute__((packed));
+
+/**
+ * AHCIHostRegister - Memory-mapped HBA registers pointed by PCI BAR5 (ABAR)
+ *
+ * @param capability        HBA capabilities, slot count and NCQ support
+ * @param global_control    Global host control, AHCI enable
+ * @param interrupt_status  Pending port interrupts
+ * @param port_implemented  Bitmask of ports usable
+ * @param port              Per-port registers
+ */
+struct AHCIHostRegister {
+  uint32_t capability;
+  uint32_t global_control;
+  uint32_t interrupt_status;
+  uint32_t port_implemented;
+  uint32_t version;
+  uint32_t ccc_control;
+  uint32_t ccc_port;
+  uint32_t enclosure_location;
+  uint32_t enclosure_control;
+  uint32_t capability_extended;
+  uint32_t handoff_control;
+  uint32_t reserved[29];
+  uint32_t vendor[24];
+  struct AHCIPortRegister port[AHCI_PORT_COUNT];
+} __attribute__((packed));
+
+/**
+ * AHCICommandHeader - Command list entry describing single command slot
+ *
+ * @param flag                   FIS length in dword (bit 0-4), write (bit 6)
+ * @param prdt_length            Number of PRDT entries in the command table
+ * @param prd_byte_count         Bytes transferred, updated by HBA
+ * @param command_table_base     Physical address of command table, 128 bytes aligned
+ */
+struct AHCICommandHeader {
+  uint16_t flag;
+  uint16_t prdt_length;
+  volatile uint32_t prd_byte_count;
+  uint32_t command_table_base;
+  uint32_t command_table_base_upper;
+  uint32_t reserved[4];
+} __attribute__((packed));
+
+/**
+ * AHCIPhysicalRegionDescriptor - Scatter-gather entry of a command table
+ *
+ * @param data_base  Physical address of the data, word aligned
+ * @param byte_count Byte count - 1 (bit 0-21), must be even
+ */
+struct AHCIPhysicalRegionDescriptor {
+  uint32_t data_base;
+  uint32_t data_base_upper;
+  uint32_t reserved;
+  uint32_t byte_count;
+} __attribute__((packed));
+
+/**
+ * AHCIFISRegisterH2D - Register FIS sent from host to device, carry ATA command.
+ * NCQ command put block count into feature and tag into count bit 3-7
+ *
+ * @param type          AHCI_FIS_TYPE_REG_H2D
+ * @param flag          AHCI_FIS_COMMAND
+ * @param command       ATA command
+ * @param feature_low   Feature register bit 0-7
+ * @param lba_low       LBA bit 0-23
+ * @param device        Device register
+ * @param lba_high      LBA bit 24-47
+ * @param feature_high  Feature register bit 8-15
+ * @param count         Sector count register
+ */
+struct AHCIFISRegisterH2D {
+  uint8_t type;
+  uint8_t flag;
+  uint8_t command;
+  uint8_t feature_low;
+  uint8_t lba_low[3];
+  uint8_t device;
+  uint8_t lba_high[3];
+  uint8_t feature_high;
+  uint16_t count;
+  uint8_t icc;
+  uint8_t control;
+  uint32_t reserved;
+} __attribute__((packed));
+
+/**
+ * AHCICommandTable - Command FIS and scatter-gather list of single slot
+ *
+ * @param command_fis Command FIS, only AHCIFISRegisterH2D is used
+ * @param atapi       ATAPI command, unused
+ * @param prdt        Physical region descriptor table
+ */
+struct AHCICommandTable {
+  uint8_t command_fis[64];
+  uint8_t atapi[16];
+  uint8_t reserved[48];
+  struct AHCIPhysicalRegionDescriptor prdt[AHCI_PRDT_PER_COMMAND];
+} __attribute__((packed, aligned(128)));
+
+/**
+ * AHCIDriverState - Contain all AHCI driver states
+ *
+ * @param port        Registers of the port holding the drive
+ * @param slot_count  Command slots usable on the port
+ * @param ncq         Whether reads and writes are issued as NCQ commands
+ * @param lba48       Whether drive support 48-bit commands, LBA28 DMA otherwise
+ * @param outstanding Bitmask of issued slots not yet reaped
+ * @param outstanding_write Bitmask of outstanding slots carrying a write
+ * @param block_count Drive capacity in blocks, clamped into 32-bit
+ * @param error_count Commands lost by task file error recovery
+ */
+struct AHCIDriverState {
+  volatile struct AHCIPortRegister *port;
+  uint32_t slot_count;
+  bool ncq;
+  bool lba48;
+  uint32_t outstanding;
+  uint32_t outstanding_write;
+  uint32_t block_count;
+  uint32_t error_count;
+};
+
+// AHCI SATA driver of the first drive found, NCQ when the drive support it
+extern const struct BlockDeviceOperation ahci_block_device;
+
+#endif
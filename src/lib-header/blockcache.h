@@ -0,0 +1,142 @@
+#ifndef _BLOCKCACHE_H
+#define _BLOCKCACHE_H
+
+#include "stdtype.h"
+#include "disk.h"
+
+/* -- Block cache geometry -- */
+// One cache line hold 4 blocks (2 KiB), the smallest FAT32 cluster size.
+// Volume formatted with larger clusters spread each cluster over several lines
+#define BLOCK_CACHE_LINE_BLOCK_COUNT 4
+#define BLOCK_CACHE_LINE_SIZE (BLOCK_CACHE_LINE_BLOCK_COUNT * BLOCK_SIZE)
+#define BLOCK_CACHE_LINE_COUNT 64
+#define BLOCK_CACHE_HASH_SIZE 64
+#define BLOCK_CACHE_NONE -1
+
+// Dirty lines are queued together once this many lines are dirty, the I/O
+// scheduler dispatch them on its deadline, eviction pressure or sync
+#define BLOCK_CACHE_DIRTY_THRESHOLD (BLOCK_CACHE_LINE_COUNT * 3 / 4)
+
+// Transfer of at least this many blocks go directly to disk, so large
+// file read and write does not evict the whole cache
+#define BLOCK_CACHE_BYPASS_BLOCK_COUNT (16 * BLOCK_CACHE_LINE_BLOCK_COUNT)
+
+// Maximum lines filled by single read-ahead disk command
+#define BLOCK_CACHE_READ_AHEAD_LINE_COUNT 8
+
+/**
+ * BlockCacheLine - Cached copy of BLOCK_CACHE_LINE_BLOCK_COUNT consecutive blocks
+ *
+ * @param line_number Cached blocks start at LBA line_number * BLOCK_CACHE_LINE_BLOCK_COUNT
+ * @param valid       Whether line hold any data
+ * @param dirty       Whether buf is newer than the disk content, cleared
+ * only after its queued write completed
+ * @param writing     Whether write of buf is queued, buf must not change
+ * until the write is dispatched
+ * @param write_sequence io_get_unplug_count() when the write was queued
+ * @param hash_next   Next line index in the same hash bucket, BLOCK_CACHE_NONE if last
+ * @param lru_prev    More recently used line index, BLOCK_CACHE_NONE if head
+ * @param lru_next    Less recently used line index, BLOCK_CACHE_NONE if tail
+ * @param buf         Cached block data
+ */
+struct BlockCacheLine {
+  uint32_t line_number;
+  bool valid;
+  bool dirty;
+  bool writing;
+  uint32_t write_sequence;
+  int16_t hash_next;
+  int16_t lru_prev;
+  int16_t lru_next;
+  uint8_t buf[BLOCK_CACHE_LINE_SIZE];
+};
+
+/**
+ * BlockCacheStatistic - Counters since initialize_block_cache()
+ *
+ * @param hit        Line lookups served from memory
+ * @param miss       Line lookups that need a line to be allocated
+ * @param evict      Valid lines replaced by LRU policy
+ * @param write_back Dirty lines written into disk, by eviction or flush
+ * @param bypass     Transfers sent directly to disk due their size
+ * @param read_ahead Lines filled by block_cache_prefetch()
+ */
+struct BlockCacheStatistic {
+  uint32_t hit;
+  uint32_t miss;
+  uint32_t evict;
+  uint32_t write_back;
+  uint32_t bypass;
+  uint32_t read_ahead;
+} __attribute__((packed));
+
+/**
+ * BlockCacheState - Contain all block cache states
+ *
+ * @param line        Cache line storage
+ * @param hash_head   First line index of each hash bucket
+ * @param lru_head    Most recently used line index
+ * @param lru_tail    Least recently used line index, next eviction victim
+ * @param dirty_count Number of dirty lines whose write is not queued yet
+ * @param statistic   Hit, miss and evict counters
+ */
+struct BlockCacheState {
+  struct BlockCacheLine line[BLOCK_CACHE_LINE_COUNT];
+  int16_t hash_head[BLOCK_CACHE_HASH_SIZE];
+  int16_t lru_head;
+  int16_t lru_tail;
+  uint32_t dirty_count;
+  struct BlockCacheStatistic statistic;
+};
+
+/**
+ * Write back any dirty line, then invalidate whole cache and reset counters.
+ * Called by initialize_filesystem_fat32() on every mount
+ */
+void initialize_block_cache(void);
+
+/**
+ * Read blocks through the cache, same contract as read_blocks()
+ *
+ * @param ptr                   Pointer for storing reading data
+ * @param logical_block_address Block address to read data from
+ * @param block_count           How many block to read
+ * @return                      True if every block missing in the cache was
+ * read without device error
+ */
+bool block_cache_read(void *ptr, uint32_t logical_block_address, uint32_t block_count);
+
+/**
+ * Write blocks into the cache, same contract as write_blocks().
+ * Data reach the disk on eviction, write deadline or block_cache_flush().
+ * Large transfer bypass the cache and is written before return, together
+ * with every queued line write
+ *
+ * @param ptr                   Pointer to data that to be written
+ * @param logical_block_address Block address to write data into
+ * @param block_count           How many block to write
+ * @return                      False if a partially written line could not
+ * be read, or the bypass write reported device error
+ */
+bool block_cache_write(const void *ptr, uint32_t logical_block_address, uint32_t block_count);
+
+/**
+ * Load blocks into the cache ahead of use. Missing lines in the range are
+ * read with as few disk commands as possible, cached lines are left as is
+ *
+ * @param logical_block_address First block to prefetch
+ * @param block_count           How many block to prefetch
+ */
+void block_cache_prefetch(uint32_t logical_block_address, uint32_t block_count);
+
+/**
+ * Write every dirty line into disk in elevator order, lines stay cached as clean
+ *
+ * @return True if no write error was reported since the previous flush
+ */
+bool block_cache_flush(void);
+
+// Get cache counters - @param statistic Pointer to store the counters
+void get_block_cache_statistic(struct BlockCacheStatistic *statistic);
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef _BLOCKDEV_H
+#define _BLOCKDEV_H
+
+#include "stdtype.h"
+
+#define BLOCK_SIZE 512
+
+// Bounce buffer for transfers whose memory is not kernel linear mapped, shared
+// by every driver since only one device is active. 64 KiB aligned so a
+// bus-master IDE PRD covering it never cross 64 KiB boundary
+#define DMA_BOUNCE_BUFFER_SIZE 0x10000
+
+// Bytes of volume block 0 (file system boot sector) owned by the block layer
+// to describe how the volume is laid over drives, e.g. RAID0 stripe layout.
+// File system signature leave them zero and must preserve them
+#define BLOCK_VOLUME_LAYOUT_OFFSET 384
+#define BLOCK_VOLUME_LAYOUT_SIZE 64
+
+// Block buffer data type - @param buf Byte buffer with size of BLOCK_SIZE
+struct BlockBuffer {
+  uint8_t buf[BLOCK_SIZE];
+} __attribute__((packed));
+
+/**
+ * BlockSegment - Memory piece of a transfer whose blocks are consecutive on disk
+ *
+ * @param buf         Pointer to block data
+ * @param block_count Number of blocks in buf
+ */
+struct BlockSegment {
+  const void *buf;
+  uint32_t block_count;
+};
+
+// Caller buffer pieces staged in the bounce buffer between two releases
+#define BLOCK_BOUNCE_COPY_COUNT (DMA_BOUNCE_BUFFER_SIZE / BLOCK_SIZE)
+
+/**
+ * BlockDeviceOperation - Driver entry points of a block device backend
+ *
+ * @param name                  Backend name, for diagnostic
+ * @param probe                 Detect and initialize the device, true if usable
+ * @param get_block_count       Addressable blocks, 0 if unknown
+ * @param read_blocks           Blocking read, same contract as read_blocks()
+ * @param write_block_segments  Blocking gathered write, same contract as write_block_segments()
+ * @param submit_write_segments Optional, start gathered write and return, see submit_block_segments()
+ * @param wait                  Optional, wait every submitted write, see wait_blocks()
+ * @param shutdown              Optional, last call before power off, see shutdown_disk()
+ *
+ * Command completed with error is reported with block_device_report_error(),
+ * the block layer return it to the caller of the transfer
+ */
+struct BlockDeviceOperation {
+  const char *name;
+  bool (*probe)(void);
+  uint32_t (*get_block_count)(void);
+  void (*read_blocks)(void *ptr, uint32_t logical_block_address, uint32_t block_count);
+  void (*write_block_segments)(const struct BlockSegment *segment, uint32_t segment_count,
+                               uint32_t logical_block_address);
+  void (*submit_write_segments)(const struct BlockSegment *segment, uint32_t segment_count,
+                                uint32_t logical_block_address);
+  void (*wait)(void);
+  void (*shutdown)(void);
+};
+
+/**
+ * BlockBounceCopy - Read data to move out of the bounce buffer on completion
+ *
+ * @param target Caller buffer, not kernel linear mapped
+ * @param source Bounce buffer location
+ * @param size   Bytes to copy
+ */
+struct BlockBounceCopy {
+  uint8_t *target;
+  const uint8_t *source;
+  uint32_t size;
+};
+
+/**
+ * BlockBounceState - Bounce buffer usage of the requests in flight
+ *
+ * @param offset     Bytes taken from block_device_bounce_buffer
+ * @param copy_count Pending read copies
+ * @param copy       Read copies done by block_bounce_release()
+ */
+struct BlockBounceState {
+  uint32_t offset;
+  uint32_t copy_count;
+  struct BlockBounceCopy copy[BLOCK_BOUNCE_COPY_COUNT];
+};
+
+extern uint8_t block_device_bounce_buffer[DMA_BOUNCE_BUFFER_SIZE];
+
+/**
+ * Get device addressable location for a piece of transfer buffer, for drivers
+ * doing scatter-gather DMA. Kernel memory is linear mapped and used as is,
+ * other memory take space from the bounce buffer. Bounced write data is
+ * copied in now, bounced read data is copied out by block_bounce_release()
+ *
+ * @param buf         Caller buffer
+ * @param block_count In : blocks wanted, out : blocks mapped, may be less
+ * @param is_write    Transfer direction
+ * @return            Kernel virtual address, physically contiguous for
+ * *block_count blocks. 0 if the bounce buffer is full
+ */
+void *block_bounce_map(void *buf, uint32_t *block_count, bool is_write);
+
+// Finish bounced reads once the device completed every mapped request, bounce buffer is free afterward
+void block_bounce_release(void);
+
+/**
+ * Report command of the active backend completed with error. Called by
+ * drivers on completion, failed read is returned by the read_blocks() in
+ * progress, failed write by the next write_block_segments() or wait_blocks()
+ *
+ * @param is_write Direction of the failed command
+ */
+void block_device_report_error(bool is_write);
+
+/**
+ * Probe block device backends in order of preference, RAM disk, NVMe,
+ * virtio-blk, AHCI, RAID0 over IDE drives then single ATA drive, and make
+ * the first usable one active for every function below.
+ * Must be called after IDT is loaded and activate_ata_interrupt() is called
+ */
+void initialize_disk(void);
+
+// Get name of the active block device backend
+const char *get_block_device_name(void);
+
+/**
+ * Get number of addressable blocks of the active block device
+ *
+ * @return Block count reported by the device, 0 if unknown
+ */
+uint32_t get_disk_block_count(void);
+
+/**
+ * Logical block address read blocks from the active block device. Will
+ * blocking until read is completed. Extent of any length is split by the
+ * driver into the largest commands the device allow.
+ * Recommended to use struct BlockBuffer
+ *
+ * @param ptr                   Pointer for storing reading data, this pointer
+ * should point to already allocated memory location. With allocated size
+ * positive integer multiple of BLOCK_SIZE, ex: buf[1024]
+ * @param logical_block_address Block address to read data from. Use LBA
+ * addressing
+ * @param block_count           How many block to read, starting from block
+ * logical_block_address to lba-1
+ * @return                      True if the device reported no error, buffer
+ * content is undefined otherwise
+ */
+bool read_blocks(void *ptr, uint32_t logical_block_address,
+                 uint32_t block_count);
+
+/**
+ * Logical block address write blocks into the active block device. Will
+ * blocking until write is completed. Extent of any length will be split like
+ * read_blocks(). Recommended to use struct BlockBuffer
+ *
+ * @param ptr                   Pointer to data that to be written into disk.
+ * Memory pointed should be positive integer multiple of BLOCK_SIZE
+ * @param logical_block_address Block address to write data into. Use LBA
+ * addressing
+ * @param block_count           How many block to write, starting from block
+ * logical_block_address to lba-1
+ * @return                      True if the device reported no write error
+ */
+bool write_blocks(const void *ptr, uint32_t logical_block_address,
+                  uint32_t block_count);
+
+/**
+ * Write blocks gathered from multiple memory segments into consecutive blocks
+ * starting at logical_block_address. Segments are issued as if they were one
+ * buffer, so adjacent requests cost a single disk command
+ *
+ * @param segment               Segment list, written in order
+ * @param segment_count         Number of segments
+ * @param logical_block_address Block address of the first block of segment[0]
+ * @return                      True if no write error was reported since the
+ * previous write_block_segments() or wait_blocks()
+ */
+bool write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                          uint32_t logical_block_address);
+
+/**
+ * Start gathered write like write_block_segments() without waiting for the
+ * device, so several writes may be outstanding on queuing devices. Segment
+ * data must stay unchanged until wait_blocks(). Backend without queuing
+ * write synchronously
+ *
+ * @param segment               Segment list, written in order
+ * @param segment_count         Number of segments
+ * @param logical_block_address Block address of the first block of segment[0]
+ */
+void submit_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                           uint32_t logical_block_address);
+
+/**
+ * Wait until every write started by submit_block_segments() is completed
+ *
+ * @return True if no write error was reported since the previous
+ * write_block_segments() or wait_blocks()
+ */
+bool wait_blocks(void);
+
+/**
+ * Let the active backend persist volatile state before power off, e.g.
+ * RAM disk write-back. File system must be synced before
+ */
+void shutdown_disk(void);
+
+#endif
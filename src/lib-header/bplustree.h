@@ -4,9 +4,13 @@
 #include "stdtype.h"
 #include "fat32.h"
 
+// Node pools are static kernel memory, MAX_NODES of each kind. Name found in
+// more directories than MAX_SAME_TARGET keep the first ones only
 #define MAX_NODES 512
 #define MAX_CHILDREN 7
-#define MAX_SAME_TARGET 50
+#define MAX_SAME_TARGET 16
+// Nodes a single insert may take, one per level split and a new root
+#define MAX_SPLIT_NODES 8
 #define NULL ((void *)0)
 
 /* -- B+ Tree -- */
@@ -173,13 +177,85 @@ struct NodeFileSystem *insert_into_node_after_splitting(struct NodeFileSystem *r
 uint32_t get_left_index(struct NodeFileSystem *parent, struct NodeFileSystem *left);
 
 /**
- * @brief Initialize a new B+ Tree from a directory (root)
+ * @brief Insert every entry of a directory and its subdirectories into the B+ Tree
  * @param root the B+ Tree
- * @param dir_name the directory name (root)
- * @param parent_cluster_number the parent of the directory
- * @param dir_cluster_number the cluster number of the directory
+ * @param dir_cluster_number the head cluster of the directory
  */
-void initialize_b_tree(struct NodeFileSystem *root, char* dir_name, uint32_t parent_cluster_number, uint32_t dir_cluster_number);
+void initialize_b_tree(struct NodeFileSystem *root, uint32_t dir_cluster_number);
+
+/**
+ * @brief Remove a deleted file/directory from tree, key is removed once no target with its name left
+ * @param root the B+ Tree
+ * @param file_name target's name
+ * @param ext target's extension
+ * @param parent_cluster_number head cluster of target's parent directory
+ * @return root of the B+ Tree
+ */
+struct NodeFileSystem *remove_from_tree(struct NodeFileSystem *root, char *file_name, char *ext, uint32_t parent_cluster_number);
+
+/**
+ * @brief Remove file/directory information with same parent and extension from PCNode
+ * @param node the PCNode
+ * @param parent_cluster_number head cluster of target's parent directory
+ * @param ext target's extension
+ * @return TRUE if information found and removed
+ */
+bool remove_pcn_item(struct PCNode *node, uint32_t parent_cluster_number, char *ext);
+
+/**
+ * @brief Remove key and child from node, then merge or redistribute node if it has too few keys
+ * @param root the B+ Tree
+ * @param n the node
+ * @param file_name the key
+ * @param child PCNode (leaf) or node (internal) removed with the key
+ * @return root of the B+ Tree
+ */
+struct NodeFileSystem *delete_key(struct NodeFileSystem *root, struct NodeFileSystem *n, char *file_name, void *child);
+
+/**
+ * @brief Remove key and child from node without rebalancing
+ * @param n the node
+ * @param file_name the key
+ * @param child child removed with the key
+ */
+void remove_key_from_node(struct NodeFileSystem *n, char *file_name, void *child);
+
+/**
+ * @brief Shrink the root, its only child become the new root when it has no key left
+ * @param root the B+ Tree
+ * @return root of the B+ Tree
+ */
+struct NodeFileSystem *adjust_root(struct NodeFileSystem *root);
+
+/**
+ * @brief Get the index of left neighbor of node in its parent
+ * @param n the node
+ * @return index of left neighbor, -1 if node is the leftmost child
+ */
+int32_t get_neighbor_index(struct NodeFileSystem *n);
+
+/**
+ * @brief Merge node into its neighbor and remove it from parent
+ * @param root the B+ Tree
+ * @param n the node
+ * @param neighbor the neighbor
+ * @param neighbor_index index of left neighbor, -1 if neighbor is on the right
+ * @param k_prime key between node and neighbor in parent
+ * @return root of the B+ Tree
+ */
+struct NodeFileSystem *coalesce_nodes(struct NodeFileSystem *root, struct NodeFileSystem *n, struct NodeFileSystem *neighbor, int32_t neighbor_index, char *k_prime);
+
+/**
+ * @brief Move one key and child from neighbor into node
+ * @param root the B+ Tree
+ * @param n the node
+ * @param neighbor the neighbor
+ * @param neighbor_index index of left neighbor, -1 if neighbor is on the right
+ * @param k_prime_index index of key between node and neighbor in parent
+ * @param k_prime key between node and neighbor in parent
+ * @return root of the B+ Tree
+ */
+struct NodeFileSystem *redistribute_nodes(struct NodeFileSystem *root, struct NodeFileSystem *n, struct NodeFileSystem *neighbor, int32_t neighbor_index, uint32_t k_prime_index, char *k_prime);
 
 /**
  * @brief Search target with find_pcn
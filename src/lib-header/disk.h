@@ -2,6 +2,7 @@
 #define _DISK_H
 
 #include "stdtype.h"
+#include "blockdev.h"
 
 /* -- ATA PIO status codes -- */
 #define ATA_STATUS_BSY 0x80
@@ -10,43 +11,190 @@
 #define ATA_STATUS_DF 0x20
 #define ATA_STATUS_ERR 0x01
 
-#define BLOCK_SIZE 512
+/* -- ATA channel ports -- */
+#define ATA_PRIMARY_IO_BASE 0x1F0
+#define ATA_PRIMARY_CONTROL 0x3F6
+#define ATA_SECONDARY_IO_BASE 0x170
+#define ATA_SECONDARY_CONTROL 0x376
+
+/* -- ATA register offsets from channel I/O base -- */
+#define ATA_REG_DATA 0
+#define ATA_REG_SECTOR_COUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE_SELECT 6
+#define ATA_REG_COMMAND 7
+#define ATA_REG_STATUS 7
+
+/* -- ATA drive addressing -- */
+// Drive index is channel * 2 + position, 0 primary master up to 3 secondary slave
+#define ATA_CHANNEL_COUNT 2
+#define ATA_DRIVE_COUNT (ATA_CHANNEL_COUNT * 2)
+#define ATA_PRIMARY_CHANNEL 0
+#define ATA_SECONDARY_CHANNEL 1
+#define ATA_DRIVE_CHANNEL(drive) ((drive) >> 1)
+#define ATA_DRIVE_IS_SLAVE(drive) ((drive) & 1)
+#define ATA_DRIVE_SELECT_SLAVE 0x10
+
+/* -- ATA commands -- */
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_IDENTIFY 0xEC
+
+/* -- ATA addressing limit -- */
+// Sector count register 0 means 256 blocks in LBA28 and 65536 blocks in LBA48
+#define ATA_LBA28_MAX_BLOCK_PER_COMMAND 256
+#define ATA_LBA48_MAX_BLOCK_PER_COMMAND 65536
+#define ATA_LBA28_MAX_ADDRESS 0x0FFFFFFF
+
+/* -- ATA IDENTIFY word offsets -- */
+#define ATA_IDENTIFY_LBA28_BLOCK_COUNT 60
+#define ATA_IDENTIFY_COMMAND_SET_2 83
+#define ATA_IDENTIFY_LBA48_BLOCK_COUNT 100
+#define ATA_IDENTIFY_LBA48_SUPPORTED (1 << 10)
+
+/* -- IDE bus-master registers, offset from BAR4 of the IDE controller -- */
+#define BM_COMMAND 0x00
+#define BM_STATUS 0x02
+#define BM_PRDT_ADDRESS 0x04
+#define BM_CHANNEL_STRIDE 0x08 // Secondary channel registers follow the primary
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08 // Bus master writes into memory (disk read)
+
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_INTERRUPT 0x04
+
+#define PRD_END_OF_TABLE 0x8000
+
+// CPU eflags interrupt enable bit
+#define EFLAGS_IF 0x200
+
 #define HALF_BLOCK_SIZE (BLOCK_SIZE / 2)
 
-// Block buffer data type - @param buf Byte buffer with size of BLOCK_SIZE
-struct BlockBuffer {
-  uint8_t buf[BLOCK_SIZE];
+// Single PRD cover at most the whole bounce buffer, see DMA_BOUNCE_BUFFER_SIZE
+#define DMA_MAX_BLOCK_PER_COMMAND (DMA_BOUNCE_BUFFER_SIZE / BLOCK_SIZE)
+
+/**
+ * Physical Region Descriptor, single entry of bus-master IDE PRD table
+ *
+ * @param physical_address Physical address of the memory region
+ * @param byte_count       Region size in bytes, 0 means 64 KiB
+ * @param flag             PRD_END_OF_TABLE on the last entry
+ */
+struct PhysicalRegionDescriptor {
+  uint32_t physical_address;
+  uint16_t byte_count;
+  uint16_t flag;
 } __attribute__((packed));
 
 /**
- * ATA PIO logical block address read blocks. Will blocking until read is
- * completed. Note: ATA PIO will use 2-bytes per read/write operation.
- * Recommended to use struct BlockBuffer
+ * ATAChannel - State of single IDE channel, shared by its master and slave
+ *
+ * @param io_base         Command block I/O port base
+ * @param control_base    Control block port, alternate status on read
+ * @param bus_master_base I/O port base for the channel bus-master registers
+ * @param irq             IRQ line of the channel
+ * @param dma_available   Whether bus-master IDE controller drive this channel
+ * @param irq_enabled     Whether request completion is signaled with IRQ
+ * @param irq_received    Set by ata_isr(), consumed by the waiting request
+ * @param irq_status      Drive status register read by the last ata_isr()
+ */
+struct ATAChannel {
+  uint16_t io_base;
+  uint16_t control_base;
+  uint16_t bus_master_base;
+  uint8_t irq;
+  bool dma_available;
+  bool irq_enabled;
+  volatile bool irq_received;
+  volatile uint8_t irq_status;
+};
+
+/**
+ * ATADrive - Drive found by IDENTIFY
  *
- * @param ptr                   Pointer for storing reading data, this pointer
- * should point to already allocated memory location. With allocated size
- * positive integer multiple of BLOCK_SIZE, ex: buf[1024]
- * @param logical_block_address Block address to read data from. Use LBA
- * addressing
- * @param block_count           How many block to read, starting from block
- * logical_block_address to lba-1
+ * @param lba48_supported Whether drive accept 48-bit LBA (READ/WRITE SECTORS EXT)
+ * @param block_count     Addressable blocks reported by IDENTIFY, 0 if drive absent
  */
-void read_blocks(void *ptr, uint32_t logical_block_address,
-                 uint8_t block_count);
+struct ATADrive {
+  bool lba48_supported;
+  uint32_t block_count;
+};
 
 /**
- * ATA PIO logical block address write blocks. Will blocking until write is
- * completed. Note: ATA PIO will use 2-bytes per read/write operation.
- * Recommended to use struct BlockBuffer
+ * ATADriverState - Contain all ATA driver states
  *
- * @param ptr                   Pointer to data that to be written into disk.
- * Memory pointed should be positive integer multiple of BLOCK_SIZE
- * @param logical_block_address Block address to write data into. Use LBA
- * addressing
- * @param block_count           How many block to write, starting from block
- * logical_block_address to lba-1
+ * @param channel Primary and secondary channel
+ * @param drive   Drives indexed by channel * 2 + position
  */
-void write_blocks(const void *ptr, uint32_t logical_block_address,
-                  uint8_t block_count);
+struct ATADriverState {
+  struct ATAChannel channel[ATA_CHANNEL_COUNT];
+  struct ATADrive drive[ATA_DRIVE_COUNT];
+};
+
+/**
+ * ATA interrupt service routine. Acknowledge drive and PIC, then wake up
+ * request waiting on the channel. Called from main_interrupt_handler()
+ *
+ * @param channel ATA_PRIMARY_CHANNEL or ATA_SECONDARY_CHANNEL
+ */
+void ata_isr(uint8_t channel);
+
+/**
+ * Get drive capacity, only valid after ata_block_device probe
+ *
+ * @param drive Drive index
+ * @return      Addressable blocks, 0 if drive absent
+ */
+uint32_t ata_get_drive_block_count(uint8_t drive);
+
+// Whether bus-master DMA can be used by drive
+bool ata_dma_available(uint8_t drive);
+
+/**
+ * Issue bus-master DMA command and return without waiting. Drives on
+ * different channels can run concurrently, one command per channel
+ *
+ * @param drive                 Drive index
+ * @param buffer                Kernel buffer, must not cross 64 KiB boundary
+ * @param logical_block_address Drive block address
+ * @param block_count           At most DMA_MAX_BLOCK_PER_COMMAND blocks
+ * @param is_write              Transfer direction
+ */
+void ata_dma_start(uint8_t drive, void *buffer, uint32_t logical_block_address,
+                   uint32_t block_count, bool is_write);
+
+/**
+ * Wait command issued by ata_dma_start()
+ *
+ * @param drive Drive index
+ * @return      True if transfer is completed without error
+ */
+bool ata_dma_finish(uint8_t drive);
+
+/**
+ * Blocking PIO transfer of contiguous buffer, fallback when DMA fail
+ *
+ * @param drive                 Drive index
+ * @param buffer                Data buffer
+ * @param logical_block_address Drive block address
+ * @param block_count           Any length, split into commands by the driver
+ * @param is_write              Transfer direction
+ */
+void ata_pio_transfer(uint8_t drive, void *buffer, uint32_t logical_block_address,
+                      uint32_t block_count, bool is_write);
+
+// ATA PIO / bus-master DMA driver of primary master, always usable as last resort.
+// Probe also identify the other three drives for ata_* functions above
+extern const struct BlockDeviceOperation ata_block_device;
 
 #endif
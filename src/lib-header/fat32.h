@@ -2,6 +2,7 @@
 #define _FAT32_H
 
 #include "disk.h"
+#include "blockcache.h"
 #include "stdtype.h"
 #include "cmosrtc.h"
 #include "bplustree.h"
@@ -14,9 +15,33 @@
 
 /* -- IF2230 File System constants -- */
 #define BOOT_SECTOR 0
+// Default and smallest cluster, directory table always span exactly this much
+// at the start of its cluster. Cluster size of a volume is in its geometry
 #define CLUSTER_BLOCK_COUNT 4
 #define CLUSTER_SIZE (BLOCK_SIZE * CLUSTER_BLOCK_COUNT)
-#define CLUSTER_MAP_SIZE 512
+// Largest cluster create_fat32() accept, 64 KiB
+#define MAX_CLUSTER_BLOCK_COUNT 128
+#define MAX_CLUSTER_SIZE (BLOCK_SIZE * MAX_CLUSTER_BLOCK_COUNT)
+
+/* -- Volume geometry -- */
+// Geometry follow the volume layout area of the boot sector, outside fs_signature
+#define FAT32_GEOMETRY_OFFSET (BLOCK_VOLUME_LAYOUT_OFFSET + BLOCK_VOLUME_LAYOUT_SIZE)
+#define FAT32_GEOMETRY_MAGIC 0x4F454746 // "FGEO" little-endian
+// Volume formatted without geometry has single cluster FAT and 2 KiB cluster
+#define FAT32_LEGACY_CLUSTER_COUNT (CLUSTER_SIZE / sizeof(uint32_t))
+// Bound of free cluster bitmap, 4 GiB volume with 2 KiB cluster, 128 GiB with 64 KiB
+#define FAT32_MAX_CLUSTER_COUNT (1u << 21)
+// fs_signature resume after geometry
+#define FAT32_SIGNATURE_TAIL_OFFSET (FAT32_GEOMETRY_OFFSET + sizeof(struct FAT32Geometry))
+
+/* -- FSInfo -- */
+// Block following boot sector, inside reserved cluster 0
+#define FAT32_FSINFO_SECTOR 1
+#define FAT32_FSINFO_LEAD_SIGNATURE 0x41615252  // "RRaA", as FAT32 FSInfo
+#define FAT32_FSINFO_TRAIL_SIGNATURE 0xAA550000
+// Counters are trusted at mount only if volume was synced after last modification
+#define FAT32_FSINFO_CLEAN 0x4E4C4321 // "!CLN" little-endian
+#define FAT32_FSINFO_DIRTY 0x54524421 // "!DRT" little-endian
 
 /* -- FAT32 FileAllocationTable constants -- */
 // FAT reserved value for cluster 0 and 1 in FileAllocationTable
@@ -26,13 +51,74 @@
 // EOF also double as valid cluster / "this is last valid cluster in the chain"
 #define FAT32_FAT_END_OF_FILE 0x0FFFFFFF
 #define FAT32_FAT_EMPTY_ENTRY 0x00000000
+// Upper 4 bit of FAT32 entry are reserved
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF
 
+// First FAT cluster, the rest of the FAT follow the root directory cluster
 #define FAT_CLUSTER_NUMBER 1
 #define ROOT_CLUSTER_NUMBER 2
 
+/* -- FAT sector cache -- */
+#define FAT_SECTOR_ENTRY_COUNT (BLOCK_SIZE / sizeof(uint32_t))
+// FAT sectors kept in memory, paged in on demand and written back on eviction or sync
+#define FAT_CACHE_SECTOR_COUNT 16
+#define FAT_CACHE_NONE 0xFFFFFFFF
+
+/* -- Free cluster bitmap -- */
+#define FREE_CLUSTER_BITMAP_SIZE (FAT32_MAX_CLUSTER_COUNT / 32)
+// First cluster that can be allocated, 0-2 are reserved, FAT and root. FAT
+// clusters following the root are marked end of file
+#define FIRST_ALLOCATABLE_CLUSTER 3
+
+/* -- Read-ahead -- */
+// Blocks of a chain prefetched after single cluster read, whole clusters only
+// so volume with 32 KiB cluster or larger does not read ahead
+#define READ_AHEAD_BLOCK_COUNT 32
+
+/* -- Preallocation -- */
+#define FAT32_RESERVATION_COUNT 8
+
+/* -- Delayed allocation -- */
+// Files buffered by write() until flush_delayed_files(), their entry has cluster 0
+#define FAT32_DELAYED_FILE_COUNT 16
+#define FAT32_DELAYED_BUFFER_SIZE (64 * 1024)
+
+/* -- Directory index -- */
+// Kernel memory given to directory indexes, as many are kept as fit and the
+// least recently used index is dropped
+#define FAT32_DIRECTORY_INDEX_MEMORY (64 * 1024)
+#define FAT32_DIRECTORY_INDEX_COUNT (FAT32_DIRECTORY_INDEX_MEMORY / sizeof(struct FAT32DirectoryIndex))
+// Directory spanning more tables is not indexed, it take no index slot and is
+// scanned as before. Full directory is hashed once it reach this size
+#define FAT32_DIRECTORY_INDEX_TABLE_COUNT FAT32_HASH_INDEX_THRESHOLD_TABLE_COUNT
+#define FAT32_DIRECTORY_INDEX_BUCKET_COUNT 256
+#define FAT32_DIRECTORY_TABLE_ENTRY_COUNT (CLUSTER_SIZE / sizeof(struct FAT32DirectoryEntry))
+// Node position is table index * FAT32_DIRECTORY_TABLE_ENTRY_COUNT + slot
+#define FAT32_DIRECTORY_INDEX_NODE_COUNT (FAT32_DIRECTORY_INDEX_TABLE_COUNT * FAT32_DIRECTORY_TABLE_ENTRY_COUNT)
+#define FAT32_DIRECTORY_INDEX_NONE 0xFFFF
+
+/* -- Hashed directory -- */
+// Full indexed directory this long is converted, its entries are spread over
+// leaf tables by hash of (name, ext) and found through index blocks
+#define FAT32_HASH_INDEX_THRESHOLD_TABLE_COUNT 16
+#define FAT32_HASH_INDEX_MAGIC 0x58444948 // "HIDX" little-endian
+#define FAT32_HASH_INDEX_RECORD_COUNT \
+  ((CLUSTER_SIZE - sizeof(struct FAT32HashIndexHeader)) / sizeof(struct FAT32HashIndexRecord))
+// Converted directory get at least twice its tables as leaves, power of two
+#define FAT32_HASH_INDEX_MAX_CONVERT_LEAF_COUNT (2 * FAT32_DIRECTORY_INDEX_TABLE_COUNT)
+
+/* -- Dentry cache -- */
+// Subdirectory lookups by (parent cluster, name), direct-mapped
+#define FAT32_DENTRY_COUNT 128
+// Directories known to be reachable from root, direct-mapped by cluster
+#define FAT32_VERIFIED_DIRECTORY_COUNT 64
+
 /* -- FAT32 DirectoryEntry constants -- */
 #define ATTR_SUBDIRECTORY 0b00010000
 #define ATTR_SUBDIRECTORY_CHILD 0b00010001
+// File chain start with block map, one uint32_t per file cluster holding its
+// data cluster or 0 for hole. Data clusters follow the map in file order
+#define ATTR_SPARSE 0b00100000
 #define UATTR_NOT_EMPTY 0b10101010
 
 /* -- File operation constant -- */
@@ -41,7 +127,7 @@
 // Boot sector signature for this file system "FAT32 - IF2230 edition"
 extern const uint8_t fs_signature[BLOCK_SIZE];
 
-// Cluster buffer data type - @param buf Byte buffer with size of CLUSTER_SIZE
+// Cluster buffer data type, sized for one directory table - @param buf Byte buffer with size of CLUSTER_SIZE
 struct ClusterBuffer
 {
   uint8_t buf[CLUSTER_SIZE];
@@ -50,13 +136,123 @@ struct ClusterBuffer
 /* -- FAT32 Data Structures -- */
 
 /**
- * FAT32 FileAllocationTable, for more information about this, check guidebook
+ * FAT32Geometry - Volume geometry stored at FAT32_GEOMETRY_OFFSET of boot
+ * sector, sized from the disk when the file system is created
+ *
+ * @param magic               FAT32_GEOMETRY_MAGIC, else volume use legacy geometry
+ * @param cluster_count       Number of clusters in the volume, FAT entries included
+ * @param fat_cluster_count   Number of clusters holding the FAT
+ * @param cluster_block_count Blocks per cluster, power of two from
+ * CLUSTER_BLOCK_COUNT to MAX_CLUSTER_BLOCK_COUNT
+ */
+struct FAT32Geometry
+{
+  uint32_t magic;
+  uint32_t cluster_count;
+  uint32_t fat_cluster_count;
+  uint32_t cluster_block_count;
+} __attribute__((packed));
+
+/**
+ * FAT32FSInfo - Free space hints and volume counters stored at
+ * FAT32_FSINFO_SECTOR. Marked dirty before the first modification after a
+ * sync and clean again by sync_filesystem_fat32(), so mount can skip the
+ * FAT scan when the volume was cleanly synced
+ *
+ * @param lead_signature     FAT32_FSINFO_LEAD_SIGNATURE
+ * @param state              FAT32_FSINFO_CLEAN or FAT32_FSINFO_DIRTY
+ * @param free_cluster_count Number of free clusters
+ * @param next_free_hint     No free cluster below it
+ * @param file_count         Number of files in the volume
+ * @param directory_count    Number of directories in the volume, root excluded
+ * @param trail_signature    FAT32_FSINFO_TRAIL_SIGNATURE
+ */
+struct FAT32FSInfo
+{
+  uint32_t lead_signature;
+  uint32_t state;
+  uint32_t free_cluster_count;
+  uint32_t next_free_hint;
+  uint32_t file_count;
+  uint32_t directory_count;
+  uint32_t trail_signature;
+} __attribute__((packed));
+
+/**
+ * FAT32VolumeStatistic - Volume usage, copied out by the statfs syscall
+ *
+ * @param cluster_size       Cluster size in bytes
+ * @param cluster_count      Number of clusters in the volume
+ * @param free_cluster_count Number of free clusters
+ * @param file_count         Number of files
+ * @param directory_count    Number of directories, root excluded
+ */
+struct FAT32VolumeStatistic
+{
+  uint32_t cluster_size;
+  uint32_t cluster_count;
+  uint32_t free_cluster_count;
+  uint32_t file_count;
+  uint32_t directory_count;
+} __attribute__((packed));
+
+/**
+ * FAT32HashIndexHeader - Start of a hash index block
+ *
+ * @param magic                    FAT32_HASH_INDEX_MAGIC
+ * @param directory_cluster_number Head cluster of the directory indexed
+ * @param record_count             Number of records in use, at least 1
+ * @param level                    1 for root whose records point to node blocks,
+ * 0 for node whose records point to leaf tables
+ * @param reserved                 Zero, block fill CLUSTER_SIZE exactly
+ */
+struct FAT32HashIndexHeader
+{
+  uint32_t magic;
+  uint32_t directory_cluster_number;
+  uint16_t record_count;
+  uint16_t level;
+  uint32_t reserved;
+} __attribute__((packed));
+
+/**
+ * FAT32HashIndexRecord - Hash range start of a child, the range end where
+ * the next record start
+ *
+ * @param hash           Smallest hash in the child, 0 for first record
+ * @param cluster_number Node block or leaf table of the child
+ */
+struct FAT32HashIndexRecord
+{
+  uint32_t hash;
+  uint32_t cluster_number;
+} __attribute__((packed));
+
+/**
+ * FAT32HashIndexBlock - Index block of hashed directory, one at the start of
+ * its own cluster outside the directory chain. Head table keep the root
+ * cluster, root point to nodes and nodes point to leaves, every leaf is a
+ * table of the chain. Leaves still form a plain directory, so directory
+ * whose index is lost is scanned as before
+ *
+ * @param header Block header
+ * @param record Records sorted by hash
+ */
+struct FAT32HashIndexBlock
+{
+  struct FAT32HashIndexHeader header;
+  struct FAT32HashIndexRecord record[FAT32_HASH_INDEX_RECORD_COUNT];
+} __attribute__((packed));
+
+/**
+ * FAT32 FileAllocationSector, single sector of FileAllocationTable, for more
+ * information about FAT, check guidebook
  *
- * @param cluster_map Containing cluster map of FAT32
+ * @param cluster_map FAT entries of FAT_SECTOR_ENTRY_COUNT consecutive clusters
  */
-struct FAT32FileAllocationTable
+struct FAT32FileAllocationSector
 {
-  uint32_t cluster_map[CLUSTER_MAP_SIZE];
+  uint32_t cluster_map[FAT_SECTOR_ENTRY_COUNT];
 } __attribute__((packed));
 
 /**
@@ -121,19 +317,179 @@ struct FAT32DirectoryTable
 
 /* -- FAT32 Driver -- */
 
+/**
+ * FAT32Reservation - Contiguous extent reserved by preallocate(), consumed by
+ * write() of the same name. Reserved clusters are marked used in free cluster
+ * bitmap only, FAT is untouched so reservation vanish on remount
+ *
+ * @param valid                 Whether this slot hold a reservation
+ * @param name                  Name of the file to be written
+ * @param ext                   Extension of the file to be written
+ * @param parent_cluster_number Parent directory of the file
+ * @param first_cluster_number  First cluster of the extent
+ * @param cluster_count         Extent length in clusters
+ */
+struct FAT32Reservation
+{
+  bool valid;
+  char name[8];
+  char ext[3];
+  uint32_t parent_cluster_number;
+  uint32_t first_cluster_number;
+  uint32_t cluster_count;
+} __attribute__((packed));
+
+/**
+ * FAT32DelayedFile - File written by write() whose clusters are not chosen
+ * yet. Its data wait in delayed_buffer and its directory entry point to
+ * cluster 0 until flush_delayed_files()
+ *
+ * @param valid                Whether this slot hold a delayed file
+ * @param name                 Name of the file
+ * @param ext                  Extension of the file
+ * @param table_cluster_number Directory cluster whose table hold the entry
+ * @param goal_cluster_number  Preferred location, head of parent directory
+ * @param buffer_offset        Data offset in delayed_buffer
+ * @param size                 File size
+ * @param cluster_count        Clusters the file will take, block map included if sparse
+ * @param is_sparse            Whether the file is stored sparse, decided by write()
+ */
+struct FAT32DelayedFile
+{
+  bool valid;
+  char name[8];
+  char ext[3];
+  uint32_t table_cluster_number;
+  uint32_t goal_cluster_number;
+  uint32_t buffer_offset;
+  uint32_t size;
+  uint32_t cluster_count;
+  bool is_sparse;
+} __attribute__((packed));
+
+/**
+ * FAT32DirectoryIndexNode - Slot of an indexed directory, either chained in
+ * a hash bucket when occupied or in the free list when empty
+ *
+ * @param name Name of the entry, meaningless while free
+ * @param ext  Extension of the entry, meaningless while free
+ * @param next Next node position of the bucket or free list, FAT32_DIRECTORY_INDEX_NONE at the end
+ */
+struct FAT32DirectoryIndexNode
+{
+  char name[8];
+  char ext[3];
+  uint16_t next;
+} __attribute__((packed));
+
+/**
+ * FAT32DirectoryIndex - Hash index of directory entries keyed on (name, ext),
+ * built on first lookup and kept in sync by write() and delete()
+ *
+ * @param valid                Whether this slot hold an index
+ * @param cluster_number       Head cluster of the directory
+ * @param last_use             Clock of last lookup, least recent is dropped
+ * @param table_count          Number of tables in the directory
+ * @param table_cluster_number Cluster of each table in chain order
+ * @param bucket               First node position of each hash bucket
+ * @param free_head            First empty slot in chain order, top of free list
+ * @param node                 Node of every slot, slot 0 of each table is unused
+ */
+struct FAT32DirectoryIndex
+{
+  bool valid;
+  uint32_t cluster_number;
+  uint32_t last_use;
+  uint32_t table_count;
+  uint32_t table_cluster_number[FAT32_DIRECTORY_INDEX_TABLE_COUNT];
+  uint16_t bucket[FAT32_DIRECTORY_INDEX_BUCKET_COUNT];
+  uint16_t free_head;
+  struct FAT32DirectoryIndexNode node[FAT32_DIRECTORY_INDEX_NODE_COUNT];
+} __attribute__((packed));
+
+/**
+ * FAT32Dentry - Cached result of looking up a subdirectory by name
+ *
+ * @param valid                 Whether this slot hold a lookup
+ * @param parent_cluster_number Head cluster of the directory looked into
+ * @param name                  Name looked up
+ * @param cluster_number        Head cluster of the subdirectory, 0 if parent
+ * has no entry with the name and no extension (negative entry)
+ * @param filesize              Size recorded in the entry of the subdirectory
+ */
+struct FAT32Dentry
+{
+  bool valid;
+  uint32_t parent_cluster_number;
+  char name[8];
+  uint32_t cluster_number;
+  uint32_t filesize;
+} __attribute__((packed));
+
 /**
  * FAT32DriverState - Contain all driver states
  *
- * @param fat_table     FAT of the system, will be loaded during
+ * @param geometry           Volume geometry, read from boot sector during
  * initialize_filesystem_fat32()
- * @param dir_table_buf Buffer for directory table
- * @param cluster_buf   Buffer for cluster
+ * @param fat_cache          Cached FAT sectors, authoritative until written back
+ * @param fat_cache_sector   FAT sector held by each cache slot, FAT_CACHE_NONE if empty
+ * @param fat_cache_dirty    Whether cache slot differ from storage
+ * @param fat_cache_last_use Clock of last access of each slot, least recent is evicted
+ * @param fat_cache_clock    Incremented on every FAT sector access
+ * @param fat_dirty_count    Number of dirty cache slot
+ * @param dir_table_buf      Buffer for directory table
+ * @param cluster_buf        Buffer for partial cluster, large enough for any cluster size,
+ * also hold entries of directory being hashed
+ * @param free_cluster_bitmap Bit i set if cluster i is free, mirror of FAT below free_bitmap_limit
+ * @param free_bitmap_limit  Clusters from here on are not in the bitmap yet, filled
+ * by find_free_extent() when mount trusted FSInfo
+ * @param free_cluster_count Number of free clusters, reserved ones excluded
+ * @param next_free_hint     Allocation search start, no free cluster below it
+ * @param free_bitmap_build_cycles TSC cycles spent loading free space at mount
+ * @param file_count         Number of files in the volume
+ * @param directory_count    Number of directories in the volume, root excluded
+ * @param fsinfo_dirty       FSInfo on storage is not clean, rewritten on next sync
+ * @param reservation        Extents reserved by preallocate()
+ * @param delayed_file       Files waiting for flush_delayed_files()
+ * @param delayed_buffer     Data of delayed files, appended and emptied on flush
+ * @param delayed_buffer_used Bytes of delayed_buffer in use
+ * @param delayed_cluster_count Clusters delayed files will take, not counted as free
+ * @param directory_index    Hash index of recently looked up directories
+ * @param directory_index_clock Incremented on every directory index lookup
+ * @param dentry             Recent subdirectory lookups of read_directory()
+ * @param verified_directory Head clusters is_parent_cluster_valid() walked up to
+ * root, 0 if slot is empty
+ * @param hash_index_buf     Buffer for hash index block
  */
 struct FAT32DriverState
 {
-  struct FAT32FileAllocationTable fat_table;
+  struct FAT32Geometry geometry;
+  struct FAT32FileAllocationSector fat_cache[FAT_CACHE_SECTOR_COUNT];
+  uint32_t fat_cache_sector[FAT_CACHE_SECTOR_COUNT];
+  bool fat_cache_dirty[FAT_CACHE_SECTOR_COUNT];
+  uint32_t fat_cache_last_use[FAT_CACHE_SECTOR_COUNT];
+  uint32_t fat_cache_clock;
+  uint32_t fat_dirty_count;
   struct FAT32DirectoryTable dir_table_buf;
-  struct ClusterBuffer cluster_buf;
+  uint8_t cluster_buf[MAX_CLUSTER_SIZE];
+  uint32_t free_cluster_bitmap[FREE_CLUSTER_BITMAP_SIZE];
+  uint32_t free_bitmap_limit;
+  uint32_t free_cluster_count;
+  uint32_t next_free_hint;
+  uint64_t free_bitmap_build_cycles;
+  uint32_t file_count;
+  uint32_t directory_count;
+  bool fsinfo_dirty;
+  struct FAT32Reservation reservation[FAT32_RESERVATION_COUNT];
+  struct FAT32DelayedFile delayed_file[FAT32_DELAYED_FILE_COUNT];
+  uint8_t delayed_buffer[FAT32_DELAYED_BUFFER_SIZE];
+  uint32_t delayed_buffer_used;
+  uint32_t delayed_cluster_count;
+  struct FAT32DirectoryIndex directory_index[FAT32_DIRECTORY_INDEX_COUNT];
+  uint32_t directory_index_clock;
+  struct FAT32Dentry dentry[FAT32_DENTRY_COUNT];
+  uint32_t verified_directory[FAT32_VERIFIED_DIRECTORY_COUNT];
+  struct FAT32HashIndexBlock hash_index_buf;
 } __attribute__((packed));
 
 /**
@@ -156,6 +512,29 @@ struct FAT32DriverRequest
   uint32_t buffer_size;
 } __attribute__((packed));
 
+/**
+ * FAT32PathRequest - Request for resolve_path(), path walked in the kernel
+ *
+ * @param path                  Components separated by '/', absolute if it start with '/'.
+ * "." and ".." are handled, "root" at root stay at root. Last component may be name.ext
+ * @param path_length           Length of path, no terminator needed
+ * @param start_cluster_number  Directory relative path start from
+ * @param resolved_length       Set to length of path resolved, failing component start there
+ * @param cluster_number        Set to head cluster of target directory or first cluster of file
+ * @param parent_cluster_number Set to head cluster of directory holding target, root for root
+ * @param entry                 Set to entry of target in its parent, root get its own table[0]
+ */
+struct FAT32PathRequest
+{
+  const char *path;
+  uint32_t path_length;
+  uint32_t start_cluster_number;
+  uint32_t resolved_length;
+  uint32_t cluster_number;
+  uint32_t parent_cluster_number;
+  struct FAT32DirectoryEntry entry;
+} __attribute__((packed));
+
 /* -- Driver Interfaces -- */
 
 /**
@@ -166,6 +545,13 @@ struct FAT32DriverRequest
  */
 uint32_t cluster_to_lba(uint32_t cluster);
 
+/**
+ * Cluster size of mounted volume in bytes, from CLUSTER_SIZE to MAX_CLUSTER_SIZE
+ *
+ * @return uint32_t Cluster size
+ */
+uint32_t get_cluster_size(void);
+
 /**
  * Initialize DirectoryTable value with parent DirectoryEntry and directory name
  *
@@ -195,41 +581,159 @@ void init_directory_table_child(struct FAT32DirectoryTable *dir_table,
 bool is_empty_storage(void);
 
 /**
- * Create new FAT32 file system. Will write fs_signature into boot sector and
- * proper FileAllocationTable (contain CLUSTER_0_VALUE, CLUSTER_1_VALUE,
- * and initialized root directory) into cluster number 1
+ * Create new FAT32 file system. Will write fs_signature and geometry sized
+ * from get_disk_block_count() into boot sector, clean FSInfo and proper FileAllocationTable
+ * (contain CLUSTER_0_VALUE, CLUSTER_1_VALUE, initialized root directory and
+ * its own clusters) into cluster number 1 and the clusters following root
+ *
+ * @param cluster_block_count Blocks per cluster, CLUSTER_BLOCK_COUNT is used
+ * if it is not a power of two between CLUSTER_BLOCK_COUNT and MAX_CLUSTER_BLOCK_COUNT
  */
-void create_fat32(void);
+void create_fat32(uint32_t cluster_block_count);
 
 /**
  * Initialize file system driver state, if is_empty_storage() then
- * create_fat32() Else, read and cache entire FileAllocationTable (located at
- * cluster number 1) into driver state
+ * create_fat32() with default cluster size. Then read geometry from boot
+ * sector and free space from clean FSInfo, volume not cleanly synced get its
+ * FAT scanned and its entries counted instead. FAT sectors are paged in on
+ * demand afterward
  */
 void initialize_filesystem_fat32(void);
 
 /**
- * Write cluster operation, wrapper for write_blocks().
- * Recommended to use struct ClusterBuffer
+ * Get FAT entry of cluster_number, its FAT sector is paged into cache if
+ * needed. Reserved upper 4 bit are masked, cluster outside the volume read
+ * as end of file so corrupted chain terminate
+ *
+ * @param cluster_number FAT entry index
+ * @return Entry value
+ */
+uint32_t get_fat_entry(uint32_t cluster_number);
+
+/**
+ * Set FAT entry of cluster_number in FAT sector cache and mark its sector
+ * dirty. Storage is updated on eviction or sync_fat(), every FAT modification
+ * must use this so free cluster bitmap stay consistent with the FAT
+ *
+ * @param cluster_number FAT entry index
+ * @param value          New entry value
+ */
+void set_fat_entry(uint32_t cluster_number, uint32_t value);
+
+/**
+ * Rebuild free cluster bitmap by scanning the FAT on storage, called at mount
+ * when FSInfo can not be trusted
+ */
+void build_free_cluster_bitmap(void);
+
+/**
+ * Find free extent for cluster_count clusters. Among runs long enough the
+ * nearest to goal is chosen, if there is none the longest run is returned.
+ * Search start from next_free_hint and skip full or empty 32-cluster words,
+ * it stop at the first fitting run past goal as no later run is nearer.
+ * Bitmap is filled from the FAT as the search pass free_bitmap_limit
+ *
+ * @param cluster_count Wanted extent length
+ * @param goal          Preferred location, usually parent directory cluster
+ * @param extent_length Pointer to store usable length, at most cluster_count
+ * @return First cluster of the extent, 0 if storage is full
+ */
+uint32_t find_free_extent(uint32_t cluster_count, uint32_t goal, uint32_t *extent_length);
+
+/**
+ * Allocate and link cluster chain, built from as few extents as possible.
+ * Last cluster is set to end of file. Caller must check free_cluster_count
+ *
+ * @param cluster_count Chain length
+ * @param goal          Preferred location of the first extent
+ * @return First cluster of the chain, 0 if storage is full
+ */
+uint32_t allocate_cluster_chain(uint32_t cluster_count, uint32_t goal);
+
+/**
+ * Write dirty sectors of FAT sector cache into block cache, sectors stay
+ * cached as clean
+ */
+void sync_fat(void);
+
+/**
+ * Allocate clusters of every delayed file, each as one chain laid out as
+ * contiguous as possible in creation order, then write its data and point its
+ * directory entry to the chain. File whose chain cannot be allocated stay
+ * buffered
+ *
+ * @return True if no delayed file is left
+ */
+bool flush_delayed_files(void);
+
+/**
+ * Make every file system modification durable, flush_delayed_files() and
+ * sync_fat() followed by block_cache_flush(), then FSInfo is rewritten as clean if it was marked
+ * dirty. Used by sync syscall and before shell waits for input
+ *
+ * @return True if everything reached storage, FSInfo stay dirty otherwise
+ */
+bool sync_filesystem_fat32(void);
+
+/**
+ * Copy volume usage, free space and entry counts are kept up to date by
+ * write() and delete() so no FAT walk is needed
+ *
+ * @param statistic Pointer to store the statistic
+ */
+void get_volume_statistic(struct FAT32VolumeStatistic *statistic);
+
+/**
+ * Write cluster operation, go through block cache before write_blocks().
+ * Buffer must hold cluster_count * get_cluster_size() bytes
  *
  * @param ptr            Pointer to source data
  * @param cluster_number Cluster number to write
- * @param cluster_count  Cluster count to write, due limitation of write_blocks
- * block_count 255 => max cluster_count = 63
+ * @param cluster_count  Cluster count to write, consecutive clusters are
+ * written with as few disk commands as possible
  */
 void write_clusters(const void *ptr, uint32_t cluster_number,
-                    uint8_t cluster_count);
+                    uint32_t cluster_count);
+
+/**
+ * Prefetch whole clusters following cluster_number in its chain into block
+ * cache, up to READ_AHEAD_BLOCK_COUNT blocks. Chain is walked in the FAT sector cache and
+ * contiguous clusters are fetched with single disk command
+ *
+ * @param cluster_number Cluster that has just been read
+ */
+void read_ahead_cluster_chain(uint32_t cluster_number);
 
 /**
- * Read cluster operation, wrapper for read_blocks().
- * Recommended to use struct ClusterBuffer
+ * Read cluster operation, served from block cache or read_blocks().
+ * Single cluster read trigger read_ahead_cluster_chain(), so walking a
+ * directory or file cluster by cluster hit the cache after the first one.
+ * Buffer must hold cluster_count * get_cluster_size() bytes
  *
  * @param ptr            Pointer to buffer for reading
  * @param cluster_number Cluster number to read
- * @param cluster_count  Cluster count to read, due limitation of read_blocks
- * block_count 255 => max cluster_count = 63
+ * @param cluster_count  Cluster count to read, consecutive clusters are
+ * read with as few disk commands as possible
+ * @return               False if the disk reported read error
+ */
+bool read_clusters(void *ptr, uint32_t cluster_number, uint32_t cluster_count);
+
+/**
+ * Read directory table stored at the start of a directory cluster, rest of
+ * the cluster is unused when cluster is larger than CLUSTER_SIZE
+ *
+ * @param dir_table      Pointer to buffer for reading
+ * @param cluster_number Directory cluster number
+ */
+void read_directory_table(struct FAT32DirectoryTable *dir_table, uint32_t cluster_number);
+
+/**
+ * Write directory table at the start of a directory cluster
+ *
+ * @param dir_table      Pointer to source table
+ * @param cluster_number Directory cluster number
  */
-void read_clusters(void *ptr, uint32_t cluster_number, uint8_t cluster_count);
+void write_directory_table(const struct FAT32DirectoryTable *dir_table, uint32_t cluster_number);
 
 /* -- CRUD Operation -- */
 
@@ -252,13 +756,27 @@ int8_t read_directory(struct FAT32DriverRequest request);
  * @param request All attribute will be used for read, buffer_size will limit
  * reading count
  * @return Error code: 0 success - 1 not a file - 2 not enough buffer - 3 not
- * found - -1 unknown - 4 invalid parent cluster
+ * found - -1 unknown or disk read error - 4 invalid parent cluster
  */
 
 int8_t read(struct FAT32DriverRequest request);
 
 /**
- * FAT32 write, write a file or folder to file system.
+ * Resolve path into its target, walking every component in the kernel
+ *
+ * @param request Path and start directory, resolved target is written back
+ * @return Error code: 0 success - 1 component not found - 2 component before
+ * the last is not a directory - 3 name or extension too long - 4 start is not
+ * a valid directory
+ */
+int8_t resolve_path(struct FAT32PathRequest *request);
+
+/**
+ * FAT32 write, write a file or folder to file system. File up to
+ * FAT32_DELAYED_BUFFER_SIZE without preallocated extent is buffered and get
+ * its clusters on flush_delayed_files(), free space is taken right away.
+ * File with more all-zero clusters than its block map would take is stored
+ * as ATTR_SPARSE, zero clusters are then neither allocated nor written
  *
  * @param request All attribute will be used for write, buffer_size == 0 then
  * create a folder / directory
@@ -267,6 +785,16 @@ int8_t read(struct FAT32DriverRequest request);
  */
 int8_t write(struct FAT32DriverRequest request);
 
+/**
+ * FAT32 preallocate, reserve contiguous extent for a file that will be
+ * written later with write(). Previous reservation of the same file is replaced
+ *
+ * @param request buf is unused, buffer_size is the final file size
+ * @return Error code: 0 success - 1 file/folder already exist - 2 invalid
+ * parent cluster - 3 no contiguous extent large enough - -1 unknown
+ */
+int8_t preallocate(struct FAT32DriverRequest request);
+
 /**
  * FAT32 delete, delete a file or empty directory (only 1 DirectoryEntry) in
  * file system.
@@ -333,6 +861,14 @@ bool is_dir_ext_name_same(struct FAT32DirectoryEntry *entry,
  */
 bool is_subdirectory(struct FAT32DirectoryEntry *entry);
 
+/**
+ * @brief Cluster number of an entry, joined from cluster_high and cluster_low
+ *
+ * @param entry
+ * @return uint32_t first cluster of the entry
+ */
+uint32_t get_entry_cluster_number(struct FAT32DirectoryEntry *entry);
+
 /**
  * @brief Ceiling of 2 a and b
  *
@@ -407,13 +943,15 @@ void create_subdirectory_from_entry(uint32_t cluster_number,
 /**
  * @brief Create a file into a directory entry
  *
- * @param cluster_number The cluster to which the file is to be put
+ * @param cluster_number First cluster of the already allocated chain of the file
  * @param entry The directory entry to be used by the file
  * @param req The request that contains information about file creation
+ * @param is_sparse Whether the chain start with block map, as counted by write()
  */
 void create_file_from_entry(uint32_t cluster_number,
                             struct FAT32DirectoryEntry *entry,
-                            struct FAT32DriverRequest req);
+                            struct FAT32DriverRequest req,
+                            bool is_sparse);
 
 /**
  * @brief Reset cluster_number values when deleted
@@ -432,7 +970,8 @@ void delete_subdirectory_by_entry(struct FAT32DirectoryEntry *entry,
                                   struct FAT32DriverRequest req);
 
 /**
- * @brief Delete a directory entry that is a file
+ * @brief Delete a directory entry that is a file, delayed file only give
+ * back its buffer slot and free space
  *
  * @param entry The entry to delete
  * @param req The request that contains information about deletion
@@ -440,6 +979,15 @@ void delete_subdirectory_by_entry(struct FAT32DirectoryEntry *entry,
 void delete_file_by_entry(struct FAT32DirectoryEntry *entry,
                           struct FAT32DriverRequest req);
 
+/**
+ * @brief Count clusters that directly follow cluster_number both in the chain
+ * and on disk, so they can be transferred with single disk request
+ *
+ * @param cluster_number First cluster of the run
+ * @return Run length, at least 1
+ */
+uint32_t count_contiguous_clusters(uint32_t cluster_number);
+
 /**
  * @brief Read a directory entry
  *
@@ -450,24 +998,39 @@ void read_directory_by_entry(struct FAT32DirectoryEntry *entry,
                              struct FAT32DriverRequest req);
 
 /**
- * @brief Read a directory
+ * @brief Read content of a file entry, only filesize bytes are written into
+ * req.buf even if the last cluster is partially used. Holes of sparse file
+ * are filled with zeros. Delayed file is copied
+ * from delayed_buffer, entry with cluster 0 lost by unclean shutdown read as zeros
+ *
+ * @param entry The file entry to read
+ * @param req The request to which read result is to be transferred,
+ * parent_cluster_number is the directory cluster holding the entry
+ * @return False if the disk reported read error
+ */
+bool read_file_by_entry(struct FAT32DirectoryEntry *entry,
+                        struct FAT32DriverRequest req);
+
+/**
+ * @brief Read a directory, one directory table per cluster in its chain
  *
  * @param cluster_number The intial cluster_number of directory
- * @param req The request to which read result is to be transferred
+ * @param req The request to which read result is to be transferred, tables
+ * beyond buffer_size are not read
  */
-void read_directory_by_cluster_number(uint16_t cluster_number,
+void read_directory_by_cluster_number(uint32_t cluster_number,
                                       struct FAT32DriverRequest req);
 
 /**
  * @brief Create a child cluster of a subdirectory
  *
- * @param last_occupied_cluster_number The last cluster number in the FAT table that is to-be occupied
+ * @param reserved_cluster_count Free clusters that must be left for the entry to be created
  * @param prev_cluster_number The cluster number where the last cluster used by the directory is
  * @param req Request that is used by the caller
  * @return true Creating child cluster succesful
  * @return false Creating child cluster not succesful
  */
-bool create_child_cluster_of_subdir(uint32_t last_occupied_cluster_number, uint16_t prev_cluster_number, struct FAT32DriverRequest *req);
+bool create_child_cluster_of_subdir(uint32_t reserved_cluster_count, uint32_t prev_cluster_number, struct FAT32DriverRequest *req);
 
 /* -- Timestamp Management -- */
 
@@ -497,13 +1060,13 @@ void set_access_datetime(struct FAT32DirectoryEntry *entry);
  * @return true
  * @return false
  */
-bool is_below_max_recursion_depth(uint16_t target_cluster_number, uint8_t recursion_count);
+bool is_below_max_recursion_depth(uint32_t target_cluster_number, uint8_t recursion_count);
 
 /**
  * @brief Delete the content of a subdirectory
  *
  * @param target_cluster_number the cluster number where the subdirectory is collected
  */
-void delete_subdirectory_content(uint16_t target_cluster_number);
+void delete_subdirectory_content(uint32_t target_cluster_number);
 
 #endif
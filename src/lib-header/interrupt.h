@@ -57,6 +57,11 @@
 #define IRQ_PRIMARY_ATA  14
 #define IRQ_SECOND_ATA   15
 
+// ACPI PM1a control port of QEMU (i440fx) and older QEMU / Bochs, SLP_EN write power off
+#define QEMU_SHUTDOWN_PORT   0x604
+#define BOCHS_SHUTDOWN_PORT  0xB004
+#define ACPI_SHUTDOWN_VALUE  0x2000
+
 
 /**
  * CPURegister, store CPU registers that can be used for interrupt handler / ISRs
@@ -99,6 +104,9 @@ struct InterruptStack {
 // Activate PIC mask for keyboard only
 void activate_keyboard_interrupt(void);
 
+// Unmask primary and secondary ATA IRQ (and slave PIC cascade line), keep other PIC masks intact
+void activate_ata_interrupt(void);
+
 // I/O port wait, around 1-4 microsecond, for I/O synchronization purpose
 void io_wait(void);
 
@@ -0,0 +1,119 @@
+#ifndef _IOSCHED_H
+#define _IOSCHED_H
+
+#include "stdtype.h"
+#include "disk.h"
+
+/* -- I/O scheduler parameters -- */
+// Pending writes, enough for flushing the whole block cache at once
+#define IO_QUEUE_SIZE 64
+
+// Queued write older than this many scheduler ticks force a dispatch.
+// One tick pass on every submitted write and every read
+#define IO_WRITE_DEADLINE 32
+
+/**
+ * IORequest - Pending write in the request queue
+ *
+ * @param buf                   Source data, must stay valid until dispatched
+ * @param logical_block_address First block to write
+ * @param block_count           Number of blocks
+ * @param deadline              Scheduler tick at which the write expire
+ */
+struct IORequest {
+  const void *buf;
+  uint32_t logical_block_address;
+  uint32_t block_count;
+  uint32_t deadline;
+};
+
+/**
+ * IOSchedulerStatistic - Counters of the request queue
+ *
+ * @param submitted Writes entering the queue
+ * @param merged    Writes merged into the previous one in LBA order
+ * @param dispatched Disk write commands issued by the queue
+ * @param expired   Dispatches forced by write deadline
+ * @param read      Reads issued ahead of queued writes
+ */
+struct IOSchedulerStatistic {
+  uint32_t submitted;
+  uint32_t merged;
+  uint32_t dispatched;
+  uint32_t expired;
+  uint32_t read;
+} __attribute__((packed));
+
+/**
+ * IOSchedulerState - Contain all I/O scheduler states
+ *
+ * @param queue         Pending writes, unordered until dispatch
+ * @param queue_count   Number of pending writes
+ * @param head_position Block after the last dispatched write, elevator sweep
+ * continue upward from here
+ * @param clock         Scheduler tick for write deadline
+ * @param unplug_count  Completed dispatches, write queued before the count
+ * changed is on disk
+ * @param write_failed  Whether device reported write error since the last
+ * io_take_write_status()
+ * @param statistic     Queue counters
+ */
+struct IOSchedulerState {
+  struct IORequest queue[IO_QUEUE_SIZE];
+  uint32_t queue_count;
+  uint32_t head_position;
+  uint32_t clock;
+  uint32_t unplug_count;
+  bool write_failed;
+  struct IOSchedulerStatistic statistic;
+};
+
+/**
+ * Queue write request, no disk access until io_unplug(), a full queue or
+ * expired deadline. buf must not be modified until the write is dispatched
+ *
+ * @param buf                   Source data
+ * @param logical_block_address First block to write
+ * @param block_count           Number of blocks
+ */
+void io_submit_write(const void *buf, uint32_t logical_block_address, uint32_t block_count);
+
+/**
+ * Read blocks synchronously. Read go ahead of queued writes, except queued
+ * writes overlapping the range which are dispatched first
+ *
+ * @param buf                   Destination buffer
+ * @param logical_block_address First block to read
+ * @param block_count           Number of blocks
+ * @return                      True if the device reported no error
+ */
+bool io_read(void *buf, uint32_t logical_block_address, uint32_t block_count);
+
+/**
+ * Dispatch every queued write in elevator (C-LOOK) order, starting from
+ * head_position upward then wrapping to the lowest LBA. Writes adjacent
+ * in LBA are merged into single submit_block_segments() command, every run
+ * is submitted before waiting so queuing device may overlap them
+ */
+void io_unplug(void);
+
+/**
+ * Get number of completed dispatches. Write submitted while the count was c
+ * is on disk once the count is no longer c
+ *
+ * @return Completed io_unplug() with at least one queued write
+ */
+uint32_t io_get_unplug_count(void);
+
+/**
+ * Take write status of dispatches since the previous call, dispatch may
+ * happen inside io_submit_write() or io_read()
+ *
+ * @return True if every dispatched write completed without error
+ */
+bool io_take_write_status(void);
+
+// Get request queue counters - @param statistic Pointer to store the counters
+void get_io_scheduler_statistic(struct IOSchedulerStatistic *statistic);
+
+#endif
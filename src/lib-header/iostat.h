@@ -0,0 +1,90 @@
+#ifndef _IOSTAT_H
+#define _IOSTAT_H
+
+#include "stdtype.h"
+
+/* -- Instrumented operations -- */
+#define IOSTAT_READ_BLOCKS 0
+#define IOSTAT_WRITE_BLOCKS 1
+#define IOSTAT_READ_CLUSTERS 2
+#define IOSTAT_WRITE_CLUSTERS 3
+#define IOSTAT_OPERATION_COUNT 4
+
+/* -- FAT32 entry points, disk operations are attributed to the active one -- */
+#define IOSTAT_ENTRY_READ 0
+#define IOSTAT_ENTRY_READ_DIRECTORY 1
+#define IOSTAT_ENTRY_WRITE 2
+#define IOSTAT_ENTRY_DELETE 3
+#define IOSTAT_ENTRY_RESOLVE_PATH 4
+#define IOSTAT_ENTRY_OTHER 5 // Sync, raw cluster read, whereis and anything outside entry points
+#define IOSTAT_ENTRY_COUNT 6
+
+// Latency histogram bucket i count calls taking [2^(i + SHIFT), 2^(i + SHIFT + 1))
+// TSC cycles, first and last bucket also take everything below and above
+#define IOSTAT_HISTOGRAM_BUCKET_COUNT 16
+#define IOSTAT_HISTOGRAM_SHIFT 10
+
+/**
+ * IOStatOperationCounter - Counters of single instrumented operation
+ *
+ * @param call      Number of calls
+ * @param byte      Total bytes transferred
+ * @param histogram Call count per latency bucket, see IOSTAT_HISTOGRAM_SHIFT
+ */
+struct IOStatOperationCounter {
+  uint32_t call;
+  uint64_t byte;
+  uint32_t histogram[IOSTAT_HISTOGRAM_BUCKET_COUNT];
+} __attribute__((packed));
+
+/**
+ * IOStatEntryCounter - Disk traffic caused by single FAT32 entry point
+ *
+ * @param call      Number of entry point calls
+ * @param operation Instrumented operation calls made while entry point active
+ * @param disk_byte Bytes moved by read_blocks() and write_blocks()
+ */
+struct IOStatEntryCounter {
+  uint32_t call;
+  uint32_t operation[IOSTAT_OPERATION_COUNT];
+  uint64_t disk_byte;
+} __attribute__((packed));
+
+/**
+ * IOStatistic - All counters, copied out by the iostat syscall
+ *
+ * @param operation Counters indexed by IOSTAT_* operation
+ * @param entry     Counters indexed by IOSTAT_ENTRY_* entry point
+ */
+struct IOStatistic {
+  struct IOStatOperationCounter operation[IOSTAT_OPERATION_COUNT];
+  struct IOStatEntryCounter entry[IOSTAT_ENTRY_COUNT];
+} __attribute__((packed));
+
+/**
+ * Account single completed operation
+ *
+ * @param operation  IOSTAT_* operation
+ * @param byte_count Bytes transferred
+ * @param cycle      Elapsed TSC cycles
+ */
+void iostat_record(uint8_t operation, uint32_t byte_count, uint64_t cycle);
+
+/**
+ * Make entry point active, later operations are attributed to it
+ *
+ * @param entry IOSTAT_ENTRY_* entry point
+ * @return      Previously active entry point, to be passed into iostat_leave()
+ */
+uint8_t iostat_enter(uint8_t entry);
+
+// Restore entry point active before iostat_enter() - @param previous Its return value
+void iostat_leave(uint8_t previous);
+
+// Get all counters - @param statistic Pointer to store the counters
+void get_io_statistic(struct IOStatistic *statistic);
+
+// Zero all counters
+void reset_io_statistic(void);
+
+#endif
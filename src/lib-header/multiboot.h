@@ -0,0 +1,46 @@
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+
+#include "stdtype.h"
+
+/* -- Multiboot information flags -- */
+#define MULTIBOOT_INFO_COMMAND_LINE (1u << 2)
+#define MULTIBOOT_INFO_MODULE (1u << 3)
+
+/**
+ * MultibootInformation - Structure passed by GRUB in ebx, first fields only.
+ * Every address is physical
+ *
+ * @param flag         Which fields below are valid, MULTIBOOT_INFO_*
+ * @param command_line Kernel command line, null-terminated
+ * @param module_count Number of modules loaded
+ * @param module_addr  Array of struct MultibootModule
+ */
+struct MultibootInformation {
+  uint32_t flag;
+  uint32_t memory_lower;
+  uint32_t memory_upper;
+  uint32_t boot_device;
+  uint32_t command_line;
+  uint32_t module_count;
+  uint32_t module_addr;
+} __attribute__((packed));
+
+/**
+ * MultibootModule - File loaded by GRUB "module" line
+ *
+ * @param start  Physical address of first byte, page aligned
+ * @param end    Physical address after last byte
+ * @param string Module command line, path included, null-terminated
+ */
+struct MultibootModule {
+  uint32_t start;
+  uint32_t end;
+  uint32_t string;
+  uint32_t reserved;
+} __attribute__((packed));
+
+// Physical address of struct MultibootInformation, saved by loader in kernel_loader.s
+extern uint32_t _multiboot_info_physical_addr;
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef _NVME_H
+#define _NVME_H
+
+#include "stdtype.h"
+#include "blockdev.h"
+
+/* -- Controller capability, configuration and status -- */
+#define NVME_CAP_MQES_MASK 0xFFFF     // Capability low : max queue entries - 1
+#define NVME_CAP_DSTRD_MASK 0xF       // Capability high : doorbell stride, 4 << DSTRD bytes
+#define NVME_CC_ENABLE (1u << 0)
+#define NVME_CC_IOSQES (6u << 16) // 64-bytes submission entry
+#define NVME_CC_IOCQES (4u << 20) // 16-bytes completion entry
+#define NVME_CSTS_READY (1u << 0)
+#define NVME_CSTS_FATAL (1u << 1)
+#define NVME_DOORBELL_BASE 0x1000
+// Polling iterations before controller or command is given up
+#define NVME_POLL_LIMIT 0x1000000
+
+/* -- Commands -- */
+#define NVME_ADMIN_CREATE_IO_SQ 0x01
+#define NVME_ADMIN_CREATE_IO_CQ 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_IO_WRITE 0x01
+#define NVME_IO_READ 0x02
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_QUEUE_PHYSICALLY_CONTIGUOUS 0x1
+#define NVME_NAMESPACE_ID 1
+
+/* -- Identify namespace byte offsets -- */
+#define NVME_IDENTIFY_NSZE 0
+#define NVME_IDENTIFY_FLBAS 26
+#define NVME_IDENTIFY_LBAF 128
+#define NVME_LBAF_LBADS 2 // Byte offset of log2 block size inside LBA format
+#define NVME_BLOCK_SIZE_SHIFT 9 // log2(BLOCK_SIZE)
+
+/* -- I/O slot state -- */
+#define NVME_SLOT_FREE 0
+#define NVME_SLOT_READ 1
+#define NVME_SLOT_WRITE 2
+
+/* -- Queue geometry -- */
+#define NVME_PAGE_SIZE 0x1000 // Memory page size 4 KiB, CC.MPS = 0
+#define NVME_ADMIN_QUEUE_SIZE 8
+#define NVME_IO_QUEUE_SIZE 64
+#define NVME_IO_QUEUE_ID 1
+#define NVME_MAX_BLOCK_PER_COMMAND 128
+// 64 KiB transfer not page aligned touch 17 pages, first one is PRP1
+#define NVME_PRP_LIST_ENTRY_COUNT 16
+
+/**
+ * NVMeRegister - Controller registers pointed by PCI BAR0
+ *
+ * @param capability_low           CAP bit 0-31, MQES
+ * @param capability_high          CAP bit 32-63, DSTRD
+ * @param controller_configuration CC, enable and queue entry sizes
+ * @param controller_status        CSTS, ready and fatal status
+ * @param admin_queue_attribute    AQA, admin queue sizes - 1
+ * @param admin_submission_queue   ASQ, admin submission queue base
+ * @param admin_completion_queue   ACQ, admin completion queue base
+ */
+struct NVMeRegister {
+  uint32_t capability_low;
+  uint32_t capability_high;
+  uint32_t version;
+  uint32_t interrupt_mask_set;
+  uint32_t interrupt_mask_clear;
+  uint32_t controller_configuration;
+  uint32_t reserved;
+  uint32_t controller_status;
+  uint32_t subsystem_reset;
+  uint32_t admin_queue_attribute;
+  uint64_t admin_submission_queue;
+  uint64_t admin_completion_queue;
+} __attribute__((packed));
+
+/**
+ * NVMeCommand - Submission queue entry
+ *
+ * @param opcode       Command opcode
+ * @param flag         Fused operation and PRP / SGL selection, 0 for PRP
+ * @param command_id   Identifier echoed in the completion
+ * @param namespace_id Target namespace
+ * @param prp1         First data page, may have offset
+ * @param prp2         Second data page or PRP list address
+ * @param dword        Command specific dword 10-15
+ */
+struct NVMeCommand {
+  uint8_t opcode;
+  uint8_t flag;
+  uint16_t command_id;
+  uint32_t namespace_id;
+  uint64_t reserved;
+  uint64_t metadata;
+  uint64_t prp1;
+  uint64_t prp2;
+  uint32_t dword[6];
+} __attribute__((packed));
+
+/**
+ * NVMeCompletion - Completion queue entry
+ *
+ * @param result     Command specific result
+ * @param sq_head    Submission queue head consumed by the controller
+ * @param sq_id      Submission queue of the command
+ * @param command_id Identifier of the command
+ * @param status     Phase tag (bit 0) and status field (bit 1-15)
+ */
+struct NVMeCompletion {
+  uint32_t result;
+  uint32_t reserved;
+  uint16_t sq_head;
+  uint16_t sq_id;
+  uint16_t command_id;
+  uint16_t status;
+} __attribute__((packed));
+
+/**
+ * NVMeQueue - Submission and completion queue pair
+ *
+ * @param submission  Submission queue entries
+ * @param completion  Completion queue entries
+ * @param size        Entries of each queue
+ * @param sq_tail     Next submission entry to fill
+ * @param cq_head     Next completion entry to reap
+ * @param phase       Phase tag of new completion entries, flip on wrap
+ * @param sq_doorbell Submission queue tail doorbell
+ * @param cq_doorbell Completion queue head doorbell
+ */
+struct NVMeQueue {
+  struct NVMeCommand *submission;
+  volatile struct NVMeCompletion *completion;
+  uint16_t size;
+  uint16_t sq_tail;
+  uint16_t cq_head;
+  uint16_t phase;
+  volatile uint32_t *sq_doorbell;
+  volatile uint32_t *cq_doorbell;
+};
+
+/**
+ * NVMeDriverState - Contain all NVMe driver states
+ *
+ * @param admin       Admin queue pair
+ * @param io          I/O queue pair
+ * @param in_flight   I/O commands submitted and not yet reaped
+ * @param unrung      I/O commands written but doorbell not yet rung
+ * @param slot        NVME_SLOT_* direction of each I/O command not yet reaped
+ * @param dead        Controller stopped completing, I/O fail without submission
+ * @param block_count Namespace size in blocks, clamped into 32-bit
+ * @param error_count I/O completions with non-zero status or timed out
+ */
+struct NVMeDriverState {
+  struct NVMeQueue admin;
+  struct NVMeQueue io;
+  uint16_t in_flight;
+  uint16_t unrung;
+  uint8_t slot[NVME_IO_QUEUE_SIZE];
+  bool dead;
+  uint32_t block_count;
+  uint32_t error_count;
+};
+
+// NVMe driver of namespace 1, one I/O queue pair reaped from completion queue memory
+extern const struct BlockDeviceOperation nvme_block_device;
+
+#endif
@@ -6,6 +6,18 @@
 #define PAGE_ENTRY_COUNT 1024
 #define PAGE_FRAME_SIZE (4 * 1024 * 1024)
 
+// Kernel higher half base, kernel memory is mapped linearly from physical address 0
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define KERNEL_VIRTUAL_TO_PHYSICAL(addr) ((uint32_t)(addr) - KERNEL_VIRTUAL_BASE)
+// Kernel memory mapped from KERNEL_VIRTUAL_BASE, user page frames start after
+// it. Keep in sync with the kernel size assertion in linker.ld
+#define KERNEL_PAGE_FRAME_COUNT 2
+#define KERNEL_MAPPED_SIZE (KERNEL_PAGE_FRAME_COUNT * PAGE_FRAME_SIZE)
+
+// Device memory-mapped registers and memory outside KERNEL_MAPPED_SIZE (e.g.
+// multiboot modules) are mapped upward from here, in 4 MiB pages
+#define KERNEL_MMIO_VIRTUAL_BASE 0xF0000000
+
 // Operating system page directory, using page size PAGE_FRAME_SIZE (4 MiB)
 extern struct PageDirectory _paging_kernel_page_directory;
 
@@ -75,10 +87,12 @@ struct PageDirectory
  * Containing page driver states
  *
  * @param last_available_physical_addr Pointer to last empty physical addr (multiple of 4 MiB)
+ * @param next_mmio_virtual_addr       Next free kernel virtual page for map_kernel_mmio() and map_kernel_memory()
  */
 struct PageDriverState
 {
     uint8_t *last_available_physical_addr;
+    uint8_t *next_mmio_virtual_addr;
 } __attribute__((packed));
 
 /**
@@ -108,4 +122,31 @@ void flush_single_tlb(void *virtual_addr);
  */
 int8_t allocate_single_user_page_frame(void *virtual_addr);
 
+/**
+ * Map 4 MiB physical page containing device registers into kernel virtual
+ * memory, with cache disabled. Registers must not cross the 4 MiB page
+ *
+ * @param  physical_addr Physical address of the registers
+ * @return void*         Kernel virtual address of physical_addr
+ */
+void *map_kernel_mmio(uint32_t physical_addr);
+
+/**
+ * Map physically contiguous memory into kernel virtual memory, cached and
+ * kernel only. Consecutive 4 MiB pages cover the whole range
+ *
+ * @param  physical_addr Physical address of the first byte
+ * @param  size          Size in bytes
+ * @return void*         Kernel virtual address of physical_addr
+ */
+void *map_kernel_memory(uint32_t physical_addr, uint32_t size);
+
+/**
+ * Keep physical memory below physical_end out of user page frames, for memory
+ * loaded by bootloader. Page frame allocation start from the next 4 MiB boundary
+ *
+ * @param physical_end Physical address after the last reserved byte
+ */
+void reserve_physical_memory(uint32_t physical_end);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "stdtype.h"
+
+/* -- PCI configuration mechanism #1 ports -- */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+/* -- PCI configuration space offsets -- */
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_PROG_IF        0x09
+#define PCI_SUBCLASS       0x0A
+#define PCI_CLASS          0x0B
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_BAR4           0x20
+#define PCI_BAR5           0x24
+#define PCI_INTERRUPT_LINE 0x3C
+
+/* -- PCI command register bits -- */
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+#define PCI_VENDOR_NONE    0xFFFF
+#define PCI_MAX_BUS        256
+#define PCI_MAX_DEVICE     32
+#define PCI_MAX_FUNCTION   8
+
+/* -- PCI class codes used by the kernel -- */
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE       0x01
+#define PCI_SUBCLASS_SATA      0x06
+#define PCI_PROG_IF_AHCI       0x01
+#define PCI_SUBCLASS_NVM       0x08
+#define PCI_PROG_IF_NVME       0x02
+
+/**
+ * PCIDevice, location of a function in PCI configuration space
+ *
+ * @param bus      Bus number
+ * @param device   Device (slot) number on the bus
+ * @param function Function number of the device
+ */
+struct PCIDevice
+{
+  uint8_t bus;
+  uint8_t device;
+  uint8_t function;
+} __attribute__((packed));
+
+/**
+ * Read 32-bit dword from PCI configuration space. Offset will be aligned down to 4 bytes
+ *
+ * @param dev    Target PCI function
+ * @param offset Register offset in configuration space
+ * @return       Dword value of the register
+ */
+uint32_t pci_config_read32(struct PCIDevice dev, uint8_t offset);
+
+// Read 16-bit word from PCI configuration space - @param offset must be 2-bytes aligned
+uint16_t pci_config_read16(struct PCIDevice dev, uint8_t offset);
+
+// Read single byte from PCI configuration space
+uint8_t pci_config_read8(struct PCIDevice dev, uint8_t offset);
+
+// Write 32-bit dword into PCI configuration space
+void pci_config_write32(struct PCIDevice dev, uint8_t offset, uint32_t value);
+
+// Write 16-bit word into PCI configuration space - @param offset must be 2-bytes aligned
+void pci_config_write16(struct PCIDevice dev, uint8_t offset, uint16_t value);
+
+/**
+ * Scan all PCI buses and find the first function with matching class and subclass
+ *
+ * @param class_code Base class code to find
+ * @param subclass   Subclass code to find
+ * @param result     Pointer to store the found function location
+ * @return           True if function found
+ */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct PCIDevice *result);
+
+/**
+ * Scan all PCI buses and find the first function with matching vendor and device id
+ *
+ * @param vendor_id Vendor id to find
+ * @param device_id Device id to find
+ * @param result    Pointer to store the found function location
+ * @return          True if function found
+ */
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct PCIDevice *result);
+
+/**
+ * Set I/O space, memory space and bus-master enable bit on a PCI function,
+ * needed before the device is allowed to do DMA into system memory
+ *
+ * @param dev Target PCI function
+ */
+void pci_enable_bus_master(struct PCIDevice dev);
+
+#endif
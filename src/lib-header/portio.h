@@ -23,4 +23,15 @@ uint8_t in(uint16_t port);
 void out16(uint16_t port, uint16_t data);
 uint16_t in16(uint16_t port);
 
+// 32-bit variant, used for PCI configuration space and bus-master registers
+void out32(uint16_t port, uint32_t data);
+uint32_t in32(uint16_t port);
+
+/** read_tsc:
+ *  Read CPU time-stamp counter, for measuring elapsed cycles
+ *
+ *  @return Cycle count since processor reset
+ */
+uint64_t read_tsc(void);
+
 #endif
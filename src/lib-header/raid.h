@@ -0,0 +1,68 @@
+#ifndef _RAID_H
+#define _RAID_H
+
+#include "stdtype.h"
+#include "blockdev.h"
+#include "disk.h"
+
+/* -- Stripe layout -- */
+#define RAID0_LAYOUT_MAGIC 0x30444952 // "RID0" little-endian
+#define RAID0_MAX_MEMBER ATA_DRIVE_COUNT
+// 8 KiB stripe unit, 4 FAT32 clusters go to one drive before moving to the next
+#define RAID0_STRIPE_BLOCK_COUNT 16
+
+/* -- Transfer round -- */
+// Bounce buffer is split between members, each member get one DMA command per round
+#define RAID0_MEMBER_BUFFER_BLOCK_COUNT (DMA_MAX_BLOCK_PER_COMMAND / RAID0_MAX_MEMBER)
+// Every piece hold at least one block
+#define RAID0_PIECE_COUNT (RAID0_MEMBER_BUFFER_BLOCK_COUNT * RAID0_MAX_MEMBER)
+
+/**
+ * RAID0Layout - Stripe layout persisted at BLOCK_VOLUME_LAYOUT_OFFSET of
+ * volume block 0, which is block 0 of member 0 (primary master)
+ *
+ * Volume block b is in stripe s = b / stripe_block_count, stored on member
+ * s % member_count at block (s / member_count) * stripe_block_count + b % stripe_block_count
+ *
+ * @param magic              RAID0_LAYOUT_MAGIC
+ * @param stripe_block_count Blocks per stripe unit
+ * @param member_count       Number of member drives
+ * @param member_drive       ATA drive index of each member, in stripe order
+ * @param member_block_count Blocks used on every member, multiple of stripe_block_count
+ */
+struct RAID0Layout {
+  uint32_t magic;
+  uint16_t stripe_block_count;
+  uint8_t member_count;
+  uint8_t member_drive[RAID0_MAX_MEMBER];
+  uint32_t member_block_count;
+} __attribute__((packed));
+
+/**
+ * RAID0MemberRun - Blocks of single member in a transfer round. Consecutive
+ * stripe units of a member are adjacent on the member, so a round touch
+ * one contiguous run per member
+ *
+ * @param logical_block_address First member block of the run
+ * @param block_count           Blocks staged in the member bounce buffer
+ */
+struct RAID0MemberRun {
+  uint32_t logical_block_address;
+  uint32_t block_count;
+};
+
+/**
+ * RAID0DriverState - Contain all RAID0 driver states
+ *
+ * @param layout      Stripe layout read from or written into volume block 0
+ * @param block_count Volume size, member_block_count * member_count clamped into 32-bit
+ */
+struct RAID0DriverState {
+  struct RAID0Layout layout;
+  uint32_t block_count;
+};
+
+// RAID0 volume striped over ATA drives, members on different channels transfer in parallel
+extern const struct BlockDeviceOperation raid0_block_device;
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _RAMDISK_H
+#define _RAMDISK_H
+
+#include "stdtype.h"
+#include "blockdev.h"
+
+/* -- RAM disk geometry -- */
+// Largest image accepted, bound the kernel virtual window and the dirty bitmap
+#define RAMDISK_MAX_SIZE (64 * 1024 * 1024)
+// Write-back granularity, dirty blocks are tracked in chunks of this many blocks
+#define RAMDISK_DIRTY_CHUNK_BLOCK_COUNT 128
+#define RAMDISK_DIRTY_BITMAP_SIZE (RAMDISK_MAX_SIZE / BLOCK_SIZE / RAMDISK_DIRTY_CHUNK_BLOCK_COUNT / 32)
+
+// Module line option, e.g. "module /boot/storage.bin writeback"
+#define RAMDISK_WRITE_BACK_OPTION "writeback"
+
+/**
+ * RAMDiskState - Contain all RAM disk states
+ *
+ * @param image        Disk image loaded by GRUB, mapped into kernel memory
+ * @param block_count  Image size in blocks
+ * @param write_back   Whether dirty chunks are written into ATA disk on shutdown
+ * @param dirty_bitmap Chunks written since boot, bit set means dirty
+ */
+struct RAMDiskState {
+  uint8_t *image;
+  uint32_t block_count;
+  bool write_back;
+  uint32_t dirty_bitmap[RAMDISK_DIRTY_BITMAP_SIZE];
+};
+
+// RAM disk over the first multiboot module, transfers are plain memory copies
+extern const struct BlockDeviceOperation ramdisk_block_device;
+
+#endif
@@ -2,9 +2,15 @@
 #define _STDTYPE
 
 /**
- * Unsigned integer representing object size
+ * Unsigned integer representing object size, compiler own type so hosted
+ * tools can include these headers next to the C library
 */
-typedef unsigned int size_t;
+typedef __SIZE_TYPE__ size_t;
+
+/**
+ * 64-bit unsigned integer
+ */
+typedef unsigned long long uint64_t;
 
 /**
  * 32-bit unsigned integer
@@ -0,0 +1,144 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include "stdtype.h"
+#include "blockdev.h"
+
+/* -- virtio PCI identification, transitional device with legacy interface -- */
+#define VIRTIO_PCI_VENDOR_ID 0x1AF4
+#define VIRTIO_PCI_DEVICE_BLOCK_LEGACY 0x1001
+
+/* -- Legacy virtio register offsets from BAR0 I/O space -- */
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_ADDRESS 0x08
+#define VIRTIO_QUEUE_SIZE 0x0C
+#define VIRTIO_QUEUE_SELECT 0x0E
+#define VIRTIO_QUEUE_NOTIFY 0x10
+#define VIRTIO_DEVICE_STATUS 0x12
+#define VIRTIO_ISR_STATUS 0x13
+#define VIRTIO_BLK_CAPACITY 0x14 // 64-bit sector count, MSI-X is not enabled
+
+/* -- Device status bits -- */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+/* -- Virtqueue flags -- */
+#define VIRTQ_DESC_F_NEXT 0x1
+#define VIRTQ_DESC_F_WRITE 0x2 // Buffer is written by device
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x1
+
+/* -- virtio-blk request -- */
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+
+/* -- Virtqueue geometry -- */
+// Legacy interface fix queue size from the device, larger queue is rejected
+#define VIRTQUEUE_MAX_SIZE 256
+#define VIRTQUEUE_ALIGN 0x1000
+// Descriptor table, available ring and page aligned used ring of VIRTQUEUE_MAX_SIZE entries
+#define VIRTQUEUE_BUFFER_SIZE (3 * VIRTQUEUE_ALIGN)
+
+// Requests kept in flight before waiting for completion
+#define VIRTIO_BLK_REQUEST_SLOT_COUNT 8
+// Data descriptors per request, header and status take 2 more
+#define VIRTIO_BLK_MAX_DATA_DESCRIPTOR 14
+#define VIRTIO_BLK_MAX_BLOCK_PER_REQUEST 128
+
+/**
+ * VirtqueueDescriptor - Single guest buffer of a request chain
+ *
+ * @param physical_address Physical address of the buffer
+ * @param length           Buffer size in bytes
+ * @param flag             VIRTQ_DESC_F_* bits
+ * @param next             Next descriptor index if VIRTQ_DESC_F_NEXT set
+ */
+struct VirtqueueDescriptor {
+  uint64_t physical_address;
+  uint32_t length;
+  uint16_t flag;
+  uint16_t next;
+} __attribute__((packed));
+
+/**
+ * VirtqueueAvailable - Ring of chain heads offered to the device
+ *
+ * @param flag  VIRTQ_AVAIL_F_* bits
+ * @param index Next free ring entry, free-running and wrap at 2^16
+ * @param ring  Head descriptor index, queue size entries
+ */
+struct VirtqueueAvailable {
+  uint16_t flag;
+  uint16_t index;
+  uint16_t ring[];
+} __attribute__((packed));
+
+/**
+ * VirtqueueUsedElement - Completed chain returned by the device
+ *
+ * @param id     Head descriptor index of the chain
+ * @param length Bytes written by the device into the chain
+ */
+struct VirtqueueUsedElement {
+  uint32_t id;
+  uint32_t length;
+} __attribute__((packed));
+
+/**
+ * VirtqueueUsed - Ring of completed chains
+ *
+ * @param flag  Device flags
+ * @param index Next ring entry written by the device, free-running
+ * @param ring  Completed chains, queue size entries
+ */
+struct VirtqueueUsed {
+  uint16_t flag;
+  uint16_t index;
+  struct VirtqueueUsedElement ring[];
+} __attribute__((packed));
+
+/**
+ * VirtioBlockRequestHeader - First, device-readable buffer of every request
+ *
+ * @param type     VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @param reserved Must be zero
+ * @param sector   First 512-bytes sector of the transfer
+ */
+struct VirtioBlockRequestHeader {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} __attribute__((packed));
+
+/**
+ * VirtioBlockDriverState - Contain all virtio-blk driver states
+ *
+ * @param io_base           I/O port base of legacy registers (BAR0)
+ * @param queue_size        Entries of request queue 0, set by device
+ * @param block_count       Device capacity in blocks, clamped into 32-bit
+ * @param descriptor        Descriptor table
+ * @param available         Available ring
+ * @param used              Used ring
+ * @param used_index        Used ring entries already consumed
+ * @param descriptor_count  Descriptors taken by the current batch
+ * @param slot_count        Requests queued in the current batch
+ */
+struct VirtioBlockDriverState {
+  uint16_t io_base;
+  uint16_t queue_size;
+  uint32_t block_count;
+  struct VirtqueueDescriptor *descriptor;
+  volatile struct VirtqueueAvailable *available;
+  volatile struct VirtqueueUsed *used;
+  uint16_t used_index;
+  uint16_t descriptor_count;
+  uint16_t slot_count;
+};
+
+// Legacy virtio-blk PCI driver, polls the used ring, requests are batched
+extern const struct BlockDeviceOperation virtio_blk_block_device;
+
+#endif
@@ -0,0 +1,406 @@
+#include "lib-header/nvme.h"
+#include "lib-header/pci.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+
+static struct NVMeDriverState nvme_driver_state;
+static volatile struct NVMeRegister *nvme_register;
+
+// Queue memory and PRP lists. Controller access them by physical address,
+// kernel memory is mapped linearly by 4 MiB pages so each static buffer is
+// physically contiguous and 4 KiB controller pages inside it are consecutive
+static struct NVMeCommand nvme_admin_submission[NVME_ADMIN_QUEUE_SIZE] __attribute__((aligned(NVME_PAGE_SIZE)));
+static struct NVMeCompletion nvme_admin_completion[NVME_ADMIN_QUEUE_SIZE] __attribute__((aligned(NVME_PAGE_SIZE)));
+static struct NVMeCommand nvme_io_submission[NVME_IO_QUEUE_SIZE] __attribute__((aligned(NVME_PAGE_SIZE)));
+static struct NVMeCompletion nvme_io_completion[NVME_IO_QUEUE_SIZE] __attribute__((aligned(NVME_PAGE_SIZE)));
+// One list per submission slot, list size alignment keep it inside single page
+static uint64_t nvme_prp_list[NVME_IO_QUEUE_SIZE][NVME_PRP_LIST_ENTRY_COUNT]
+    __attribute__((aligned(NVME_PRP_LIST_ENTRY_COUNT * sizeof(uint64_t))));
+
+/**
+ * Initialize queue pair bookkeeping, doorbells follow controller doorbell stride
+ *
+ * @param queue      Queue pair to initialize
+ * @param id         Queue identifier, 0 for admin
+ * @param submission Submission queue memory
+ * @param completion Completion queue memory
+ * @param size       Entries of each queue
+ * @param stride     Doorbell stride in bytes
+ */
+static void nvme_initialize_queue(struct NVMeQueue *queue, uint16_t id, struct NVMeCommand *submission,
+                                  struct NVMeCompletion *completion, uint16_t size, uint32_t stride)
+{
+  memset(submission, 0, sizeof(struct NVMeCommand) * size);
+  memset(completion, 0, sizeof(struct NVMeCompletion) * size);
+  queue->submission = submission;
+  queue->completion = completion;
+  queue->size = size;
+  queue->sq_tail = 0;
+  queue->cq_head = 0;
+  queue->phase = 1;
+
+  uint8_t *doorbell = (uint8_t *)nvme_register + NVME_DOORBELL_BASE;
+  queue->sq_doorbell = (volatile uint32_t *)(doorbell + (2 * id) * stride);
+  queue->cq_doorbell = (volatile uint32_t *)(doorbell + (2 * id + 1) * stride);
+}
+
+// Get next submission entry zeroed, command id is the entry index
+static struct NVMeCommand *nvme_next_command(struct NVMeQueue *queue)
+{
+  uint16_t slot = queue->sq_tail;
+  struct NVMeCommand *command = &queue->submission[slot];
+  memset(command, 0, sizeof(struct NVMeCommand));
+  command->command_id = slot;
+  queue->sq_tail = (slot + 1) % queue->size;
+  return command;
+}
+
+static void nvme_ring_submission(struct NVMeQueue *queue)
+{
+  __asm__ volatile("" : /* <Empty> */ : /* <Empty> */ : "memory");
+  *queue->sq_doorbell = queue->sq_tail;
+}
+
+/**
+ * Reap completion entries posted with current phase tag. Entries are read
+ * from completion queue memory, no controller register is polled, and the
+ * head doorbell is written once after the reaped batch
+ *
+ * @param queue Queue pair to reap
+ * @param slot  NVME_SLOT_* of each command id, cleared on reap and entry with
+ *              non-zero status reported to the block layer. 0 for admin queue
+ * @param error Pointer to count entries with non-zero status
+ * @return      Number of reaped entries
+ */
+static uint16_t nvme_reap_completion(struct NVMeQueue *queue, uint8_t *slot, uint32_t *error)
+{
+  uint16_t count = 0;
+  while ((queue->completion[queue->cq_head].status & 0x1) == queue->phase)
+  {
+    uint16_t command_id = queue->completion[queue->cq_head].command_id;
+    if (queue->completion[queue->cq_head].status >> 1)
+    {
+      (*error)++;
+      if (slot && command_id < queue->size)
+        block_device_report_error(slot[command_id] == NVME_SLOT_WRITE);
+    }
+    if (slot && command_id < queue->size)
+      slot[command_id] = NVME_SLOT_FREE;
+    queue->cq_head++;
+    if (queue->cq_head == queue->size)
+    {
+      queue->cq_head = 0;
+      queue->phase ^= 1;
+    }
+    count++;
+  }
+  if (count)
+    *queue->cq_doorbell = queue->cq_head;
+  return count;
+}
+
+/**
+ * Submit single admin command and spin on the admin completion queue.
+ * Only used while probing, before any I/O command exist
+ *
+ * @param command Filled command, copied into admin submission queue
+ * @return        True if command completed with zero status
+ */
+static bool nvme_admin_command(const struct NVMeCommand *command)
+{
+  struct NVMeQueue *admin = &nvme_driver_state.admin;
+  struct NVMeCommand *entry = nvme_next_command(admin);
+  uint16_t command_id = entry->command_id;
+  memcpy(entry, command, sizeof(struct NVMeCommand));
+  entry->command_id = command_id;
+  nvme_ring_submission(admin);
+
+  uint32_t error = 0;
+  for (uint32_t poll = 0; poll < NVME_POLL_LIMIT; poll++)
+    if (nvme_reap_completion(admin, 0, &error))
+      return error == 0;
+  return FALSE;
+}
+
+/**
+ * Give up every I/O command not yet reaped. Queue pointers no longer match
+ * the controller, so it is marked dead and later I/O fail immediately
+ */
+static void nvme_abandon_io(void)
+{
+  for (uint16_t i = 0; i < NVME_IO_QUEUE_SIZE; i++)
+  {
+    if (nvme_driver_state.slot[i] != NVME_SLOT_FREE)
+    {
+      nvme_driver_state.error_count++;
+      block_device_report_error(nvme_driver_state.slot[i] == NVME_SLOT_WRITE);
+      nvme_driver_state.slot[i] = NVME_SLOT_FREE;
+    }
+  }
+  nvme_driver_state.in_flight = 0;
+  nvme_driver_state.dead = TRUE;
+}
+
+/**
+ * Ring the doorbell for commands written since last ring, reap completions
+ * until every submitted command is done, then finish bounced reads.
+ * Command with error status, or not completed within NVME_POLL_LIMIT polls
+ * without progress, is reported to the block layer
+ */
+static void nvme_wait(void)
+{
+  struct NVMeQueue *io = &nvme_driver_state.io;
+  if (nvme_driver_state.unrung)
+  {
+    nvme_ring_submission(io);
+    nvme_driver_state.unrung = 0;
+  }
+  uint32_t poll = 0;
+  while (nvme_driver_state.in_flight)
+  {
+    uint16_t reaped = nvme_reap_completion(io, nvme_driver_state.slot, &nvme_driver_state.error_count);
+    nvme_driver_state.in_flight -= reaped;
+    poll = reaped ? 0 : poll + 1;
+    if (poll == NVME_POLL_LIMIT)
+      nvme_abandon_io();
+  }
+  block_bounce_release();
+}
+
+/**
+ * Fill PRP1 and PRP2 for physically contiguous buffer. PRP2 point to the
+ * second page when the buffer span two pages, else to the slot PRP list
+ *
+ * @param command Command to fill
+ * @param buf     Kernel buffer
+ * @param length  Buffer length in bytes, at most NVME_MAX_BLOCK_PER_COMMAND blocks
+ */
+static void nvme_set_prp(struct NVMeCommand *command, const void *buf, uint32_t length)
+{
+  uint32_t physical = KERNEL_VIRTUAL_TO_PHYSICAL(buf);
+  uint32_t first_length = NVME_PAGE_SIZE - (physical & (NVME_PAGE_SIZE - 1));
+  command->prp1 = physical;
+  if (length <= first_length)
+    return;
+
+  uint32_t next_page = physical + first_length;
+  if (length - first_length <= NVME_PAGE_SIZE)
+  {
+    command->prp2 = next_page;
+    return;
+  }
+
+  uint64_t *list = nvme_prp_list[command->command_id];
+  for (uint32_t i = 0; next_page < physical + length; i++, next_page += NVME_PAGE_SIZE)
+    list[i] = next_page;
+  command->prp2 = KERNEL_VIRTUAL_TO_PHYSICAL(list);
+}
+
+/**
+ * Write commands transferring consecutive blocks described by segment list
+ * into the I/O submission queue. Each contiguous piece of a segment become
+ * one command, pieces are not merged as PRP entries after the first must be
+ * page aligned. Doorbell is rung once per call, nvme_wait() is only called
+ * when the queue or bounce buffer run out
+ *
+ * @param segment               Segment list, read into if is_write is false
+ * @param segment_count         Number of segments
+ * @param logical_block_address First block of the transfer
+ * @param is_write              Transfer direction
+ */
+static void nvme_transfer(const struct BlockSegment *segment, uint32_t segment_count,
+                          uint32_t logical_block_address, bool is_write)
+{
+  struct NVMeQueue *io = &nvme_driver_state.io;
+  uint32_t index = 0;
+  uint32_t block_offset = 0;
+
+  while (index < segment_count)
+  {
+    // Dead controller may have been found by a wait inside this loop
+    if (nvme_driver_state.dead)
+    {
+      block_device_report_error(is_write);
+      return;
+    }
+    if (block_offset == segment[index].block_count)
+    {
+      index++;
+      block_offset = 0;
+      continue;
+    }
+    // Full submission queue keep one entry empty
+    if (nvme_driver_state.in_flight == io->size - 1)
+    {
+      nvme_wait();
+      continue;
+    }
+
+    // Read target is the caller buffer, const only hold for write
+    uint8_t *buf = (uint8_t *)segment[index].buf + block_offset * BLOCK_SIZE;
+    uint32_t piece = segment[index].block_count - block_offset;
+    if (piece > NVME_MAX_BLOCK_PER_COMMAND)
+      piece = NVME_MAX_BLOCK_PER_COMMAND;
+
+    // Bounce buffer exhausted, drain and retry
+    buf = block_bounce_map(buf, &piece, is_write);
+    if (!buf)
+    {
+      nvme_wait();
+      continue;
+    }
+
+    struct NVMeCommand *command = nvme_next_command(io);
+    nvme_driver_state.slot[command->command_id] = is_write ? NVME_SLOT_WRITE : NVME_SLOT_READ;
+    command->opcode = is_write ? NVME_IO_WRITE : NVME_IO_READ;
+    command->namespace_id = NVME_NAMESPACE_ID;
+    nvme_set_prp(command, buf, piece * BLOCK_SIZE);
+    command->dword[0] = logical_block_address;
+    command->dword[1] = 0;
+    command->dword[2] = piece - 1;
+    nvme_driver_state.in_flight++;
+    nvme_driver_state.unrung++;
+
+    block_offset += piece;
+    logical_block_address += piece;
+  }
+
+  if (nvme_driver_state.unrung)
+  {
+    nvme_ring_submission(io);
+    nvme_driver_state.unrung = 0;
+  }
+}
+
+static void nvme_read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  struct BlockSegment segment = {.buf = ptr, .block_count = block_count};
+  nvme_transfer(&segment, 1, logical_block_address, FALSE);
+  nvme_wait();
+}
+
+static void nvme_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                      uint32_t logical_block_address)
+{
+  nvme_transfer(segment, segment_count, logical_block_address, TRUE);
+  nvme_wait();
+}
+
+// Submitted writes are reaped by the next nvme_wait()
+static void nvme_submit_write_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                       uint32_t logical_block_address)
+{
+  nvme_transfer(segment, segment_count, logical_block_address, TRUE);
+}
+
+static uint32_t nvme_get_block_count(void)
+{
+  return nvme_driver_state.block_count;
+}
+
+/**
+ * Identify namespace 1 into the bounce buffer. Fill block_count, namespace
+ * must be formatted with BLOCK_SIZE blocks
+ *
+ * @return True if namespace usable
+ */
+static bool nvme_identify_namespace(void)
+{
+  struct NVMeCommand command = {0};
+  command.opcode = NVME_ADMIN_IDENTIFY;
+  command.namespace_id = NVME_NAMESPACE_ID;
+  command.prp1 = KERNEL_VIRTUAL_TO_PHYSICAL(block_device_bounce_buffer);
+  command.dword[0] = NVME_IDENTIFY_NAMESPACE;
+  if (!nvme_admin_command(&command))
+    return FALSE;
+
+  uint8_t *identify = block_device_bounce_buffer;
+  uint8_t format = identify[NVME_IDENTIFY_FLBAS] & 0xF;
+  if (identify[NVME_IDENTIFY_LBAF + 4 * format + NVME_LBAF_LBADS] != NVME_BLOCK_SIZE_SHIFT)
+    return FALSE;
+
+  // Clamp 64-bit size into 32-bit LBA used by the kernel
+  uint32_t size_low, size_high;
+  memcpy(&size_low, identify + NVME_IDENTIFY_NSZE, sizeof(uint32_t));
+  memcpy(&size_high, identify + NVME_IDENTIFY_NSZE + 4, sizeof(uint32_t));
+  nvme_driver_state.block_count = size_high ? 0xFFFFFFFF : size_low;
+  return nvme_driver_state.block_count != 0;
+}
+
+// Create I/O completion queue then its submission queue, interrupt disabled
+static bool nvme_create_io_queue(void)
+{
+  struct NVMeCommand command = {0};
+  uint32_t queue_attribute = ((uint32_t)(nvme_driver_state.io.size - 1) << 16) | NVME_IO_QUEUE_ID;
+
+  command.opcode = NVME_ADMIN_CREATE_IO_CQ;
+  command.prp1 = KERNEL_VIRTUAL_TO_PHYSICAL(nvme_io_completion);
+  command.dword[0] = queue_attribute;
+  command.dword[1] = NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+  if (!nvme_admin_command(&command))
+    return FALSE;
+
+  memset(&command, 0, sizeof(command));
+  command.opcode = NVME_ADMIN_CREATE_IO_SQ;
+  command.prp1 = KERNEL_VIRTUAL_TO_PHYSICAL(nvme_io_submission);
+  command.dword[0] = queue_attribute;
+  command.dword[1] = ((uint32_t)NVME_IO_QUEUE_ID << 16) | NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+  return nvme_admin_command(&command);
+}
+
+/**
+ * Find NVMe controller, map its registers, reset it with a fresh admin queue
+ * pair and create one I/O queue pair. Completion is reaped from queue memory
+ * by phase tag without interrupt
+ */
+static bool nvme_probe(void)
+{
+  struct PCIDevice controller;
+  if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_NVM, &controller) ||
+      pci_config_read8(controller, PCI_PROG_IF) != PCI_PROG_IF_NVME)
+    return FALSE;
+
+  // BAR0 must be memory space, 64-bit BAR must sit below 4 GiB
+  uint32_t bar0 = pci_config_read32(controller, PCI_BAR0);
+  if ((bar0 & 0x1) || ((bar0 & 0x6) == 0x4 && pci_config_read32(controller, PCI_BAR0 + 4)))
+    return FALSE;
+  pci_enable_bus_master(controller);
+  nvme_register = map_kernel_mmio(bar0 & 0xFFFFFFF0);
+
+  // Controller must be disabled before admin queue change
+  nvme_register->controller_configuration &= ~NVME_CC_ENABLE;
+  uint32_t poll = 0;
+  while ((nvme_register->controller_status & NVME_CSTS_READY) && poll < NVME_POLL_LIMIT)
+    poll++;
+  if (poll == NVME_POLL_LIMIT)
+    return FALSE;
+
+  memset(&nvme_driver_state, 0, sizeof(nvme_driver_state));
+  uint32_t stride = 4u << (nvme_register->capability_high & NVME_CAP_DSTRD_MASK);
+  uint32_t max_entry = (nvme_register->capability_low & NVME_CAP_MQES_MASK) + 1;
+  uint16_t io_size = max_entry < NVME_IO_QUEUE_SIZE ? max_entry : NVME_IO_QUEUE_SIZE;
+  nvme_initialize_queue(&nvme_driver_state.admin, 0, nvme_admin_submission, nvme_admin_completion,
+                        NVME_ADMIN_QUEUE_SIZE, stride);
+  nvme_initialize_queue(&nvme_driver_state.io, NVME_IO_QUEUE_ID, nvme_io_submission, nvme_io_completion,
+                        io_size, stride);
+
+  nvme_register->admin_queue_attribute = ((NVME_ADMIN_QUEUE_SIZE - 1) << 16) | (NVME_ADMIN_QUEUE_SIZE - 1);
+  nvme_register->admin_submission_queue = KERNEL_VIRTUAL_TO_PHYSICAL(nvme_admin_submission);
+  nvme_register->admin_completion_queue = KERNEL_VIRTUAL_TO_PHYSICAL(nvme_admin_completion);
+  nvme_register->controller_configuration = NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_ENABLE;
+  for (poll = 0; !(nvme_register->controller_status & NVME_CSTS_READY); poll++)
+    if ((nvme_register->controller_status & NVME_CSTS_FATAL) || poll == NVME_POLL_LIMIT)
+      return FALSE;
+
+  return nvme_identify_namespace() && nvme_create_io_queue();
+}
+
+const struct BlockDeviceOperation nvme_block_device = {
+    .name = "nvme",
+    .probe = nvme_probe,
+    .get_block_count = nvme_get_block_count,
+    .read_blocks = nvme_read_blocks,
+    .write_block_segments = nvme_write_block_segments,
+    .submit_write_segments = nvme_submit_write_segments,
+    .wait = nvme_wait,
+};
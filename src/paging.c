@@ -14,10 +14,17 @@ __attribute__((aligned(0x1000))) struct PageDirectory _paging_kernel_page_direct
             .lower_address = 0,
             .flag.use_pagesize_4_mb = 1,
         },
+        [0x301] = {
+            .flag.present_bit = 1,
+            .flag.write_bit = 1,
+            .lower_address = 1,
+            .flag.use_pagesize_4_mb = 1,
+        },
     }};
 
 static struct PageDriverState page_driver_state = {
-    .last_available_physical_addr = (uint8_t *)0 + PAGE_FRAME_SIZE,
+    .last_available_physical_addr = (uint8_t *)0 + KERNEL_MAPPED_SIZE,
+    .next_mmio_virtual_addr = (uint8_t *)KERNEL_MMIO_VIRTUAL_BASE,
 };
 
 void update_page_directory_entry(void *physical_addr, void *virtual_addr, struct PageDirectoryEntryFlag flag)
@@ -50,6 +57,57 @@ int8_t allocate_single_user_page_frame(void *virtual_addr)
     return 0;
 }
 
+void *map_kernel_mmio(uint32_t physical_addr)
+{
+    uint8_t *virtual_addr = page_driver_state.next_mmio_virtual_addr;
+    page_driver_state.next_mmio_virtual_addr += PAGE_FRAME_SIZE;
+
+    // Device registers must not be cached, kernel only
+    struct PageDirectoryEntryFlag flag;
+    flag.accessed_bit = 0;
+    flag.page_level_cache_disable_bit = 1;
+    flag.page_level_write_through_bit = 1;
+    flag.dirty_bit = 0;
+    flag.us_bit = 0;
+    flag.present_bit = 1;
+    flag.write_bit = 1;
+    flag.use_pagesize_4_mb = 1;
+
+    update_page_directory_entry((void *)(physical_addr & ~(PAGE_FRAME_SIZE - 1)), virtual_addr, flag);
+    return virtual_addr + (physical_addr & (PAGE_FRAME_SIZE - 1));
+}
+
+void *map_kernel_memory(uint32_t physical_addr, uint32_t size)
+{
+    uint32_t page_offset = physical_addr & (PAGE_FRAME_SIZE - 1);
+    uint32_t page_count = (page_offset + size + PAGE_FRAME_SIZE - 1) / PAGE_FRAME_SIZE;
+    uint8_t *virtual_addr = page_driver_state.next_mmio_virtual_addr;
+    page_driver_state.next_mmio_virtual_addr += page_count * PAGE_FRAME_SIZE;
+
+    struct PageDirectoryEntryFlag flag;
+    flag.accessed_bit = 0;
+    flag.page_level_cache_disable_bit = 0;
+    flag.page_level_write_through_bit = 0;
+    flag.dirty_bit = 0;
+    flag.us_bit = 0;
+    flag.present_bit = 1;
+    flag.write_bit = 1;
+    flag.use_pagesize_4_mb = 1;
+
+    uint32_t physical_page = physical_addr - page_offset;
+    for (uint32_t i = 0; i < page_count; i++)
+        update_page_directory_entry((void *)(physical_page + i * PAGE_FRAME_SIZE),
+                                    virtual_addr + i * PAGE_FRAME_SIZE, flag);
+    return virtual_addr + page_offset;
+}
+
+void reserve_physical_memory(uint32_t physical_end)
+{
+    uint32_t page_end = (physical_end + PAGE_FRAME_SIZE - 1) & ~(PAGE_FRAME_SIZE - 1);
+    if (page_end > (uint32_t)page_driver_state.last_available_physical_addr)
+        page_driver_state.last_available_physical_addr = (uint8_t *)page_end;
+}
+
 void flush_single_tlb(void *virtual_addr)
 {
     asm volatile("invlpg (%0)"
@@ -0,0 +1,110 @@
+#include "lib-header/pci.h"
+#include "lib-header/portio.h"
+
+static uint32_t pci_config_address(struct PCIDevice dev, uint8_t offset)
+{
+  return 0x80000000 | ((uint32_t)dev.bus << 16) | ((uint32_t)dev.device << 11) |
+         ((uint32_t)dev.function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(struct PCIDevice dev, uint8_t offset)
+{
+  out32(PCI_CONFIG_ADDRESS, pci_config_address(dev, offset));
+  return in32(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(struct PCIDevice dev, uint8_t offset)
+{
+  // Note : Shift the selected word of the dword into lower 16-bit
+  return (uint16_t)(pci_config_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_config_read8(struct PCIDevice dev, uint8_t offset)
+{
+  return (uint8_t)(pci_config_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_config_write32(struct PCIDevice dev, uint8_t offset, uint32_t value)
+{
+  out32(PCI_CONFIG_ADDRESS, pci_config_address(dev, offset));
+  out32(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(struct PCIDevice dev, uint8_t offset, uint16_t value)
+{
+  // Read-modify-write the dword, configuration space only accessed per dword
+  uint32_t shift = (offset & 2) * 8;
+  uint32_t dword = pci_config_read32(dev, offset);
+  dword = (dword & ~(0xFFFF << shift)) | ((uint32_t)value << shift);
+  pci_config_write32(dev, offset, dword);
+}
+
+/**
+ * Scan all PCI buses and find the first function accepted by match
+ *
+ * @param match  Predicate called on every present function
+ * @param key    Passed into match as is
+ * @param result Pointer to store the found function location
+ * @return       True if function found
+ */
+static bool pci_find(bool (*match)(struct PCIDevice, uint32_t), uint32_t key, struct PCIDevice *result)
+{
+  for (uint32_t bus = 0; bus < PCI_MAX_BUS; bus++)
+  {
+    for (uint32_t device = 0; device < PCI_MAX_DEVICE; device++)
+    {
+      struct PCIDevice dev = {.bus = bus, .device = device, .function = 0};
+      if (pci_config_read16(dev, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+        continue;
+
+      // Only scan other functions if the device is multi-function
+      uint8_t function_count =
+          (pci_config_read8(dev, PCI_HEADER_TYPE) & 0x80) ? PCI_MAX_FUNCTION : 1;
+
+      for (uint8_t function = 0; function < function_count; function++)
+      {
+        dev.function = function;
+        if (pci_config_read16(dev, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+          continue;
+
+        if (match(dev, key))
+        {
+          *result = dev;
+          return TRUE;
+        }
+      }
+    }
+  }
+  return FALSE;
+}
+
+// key : class code in bit 8-15, subclass in bit 0-7
+static bool pci_match_class(struct PCIDevice dev, uint32_t key)
+{
+  return pci_config_read8(dev, PCI_CLASS) == (uint8_t)(key >> 8) &&
+         pci_config_read8(dev, PCI_SUBCLASS) == (uint8_t)key;
+}
+
+// key : vendor id in bit 16-31, device id in bit 0-15
+static bool pci_match_id(struct PCIDevice dev, uint32_t key)
+{
+  return pci_config_read16(dev, PCI_VENDOR_ID) == (uint16_t)(key >> 16) &&
+         pci_config_read16(dev, PCI_DEVICE_ID) == (uint16_t)key;
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct PCIDevice *result)
+{
+  return pci_find(pci_match_class, ((uint32_t)class_code << 8) | subclass, result);
+}
+
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct PCIDevice *result)
+{
+  return pci_find(pci_match_id, ((uint32_t)vendor_id << 16) | device_id, result);
+}
+
+void pci_enable_bus_master(struct PCIDevice dev)
+{
+  uint16_t command = pci_config_read16(dev, PCI_COMMAND);
+  command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+  pci_config_write16(dev, PCI_COMMAND, command);
+}
@@ -30,3 +30,21 @@ uint16_t in16(uint16_t port) {
   __asm__ volatile("inw %1, %0" : "=a"(result) : "Nd"(port));
   return result;
 }
+
+void out32(uint16_t port, uint32_t data) {
+  __asm__ volatile("outl %0, %1"
+                   : // <Empty output operand>
+                   : "a"(data), "Nd"(port));
+}
+
+uint32_t in32(uint16_t port) {
+  uint32_t result;
+  __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(port));
+  return result;
+}
+
+uint64_t read_tsc(void) {
+  uint32_t low, high;
+  __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
@@ -0,0 +1,267 @@
+#include "lib-header/raid.h"
+#include "lib-header/stdmem.h"
+
+static struct RAID0DriverState raid0_driver_state;
+
+// Read pieces waiting to be copied out of member bounce buffers
+static struct BlockBounceCopy raid0_read_piece[RAID0_PIECE_COUNT];
+
+// Volume size clamped into 32-bit LBA used by the kernel
+static uint32_t raid0_volume_block_count(const struct RAID0Layout *layout)
+{
+  if (layout->member_block_count > 0xFFFFFFFF / layout->member_count)
+    return 0xFFFFFFFF - 0xFFFFFFFF % (layout->stripe_block_count * layout->member_count);
+  return layout->member_block_count * layout->member_count;
+}
+
+static uint8_t *raid0_member_buffer(uint8_t member)
+{
+  return block_device_bounce_buffer + member * RAID0_MEMBER_BUFFER_BLOCK_COUNT * BLOCK_SIZE;
+}
+
+/**
+ * Transfer staged run of every member. Members on different channels run
+ * concurrently, members sharing a channel take turns. Failed DMA is
+ * retried with PIO
+ *
+ * @param run      Run of each member, block_count 0 if member is not touched
+ * @param is_write Transfer direction
+ */
+static void raid0_issue(const struct RAID0MemberRun *run, bool is_write)
+{
+  const struct RAID0Layout *layout = &raid0_driver_state.layout;
+  bool done[RAID0_MAX_MEMBER] = {FALSE};
+  bool pending = TRUE;
+
+  while (pending)
+  {
+    int8_t started[ATA_CHANNEL_COUNT] = {-1, -1};
+    pending = FALSE;
+    for (uint8_t member = 0; member < layout->member_count; member++)
+    {
+      uint8_t drive = layout->member_drive[member];
+      if (run[member].block_count == 0 || done[member])
+        continue;
+      if (!ata_dma_available(drive))
+      {
+        ata_pio_transfer(drive, raid0_member_buffer(member), run[member].logical_block_address,
+                         run[member].block_count, is_write);
+        done[member] = TRUE;
+      }
+      else if (started[ATA_DRIVE_CHANNEL(drive)] < 0)
+      {
+        ata_dma_start(drive, raid0_member_buffer(member), run[member].logical_block_address,
+                      run[member].block_count, is_write);
+        started[ATA_DRIVE_CHANNEL(drive)] = member;
+      }
+      else
+        pending = TRUE;
+    }
+
+    for (uint8_t channel = 0; channel < ATA_CHANNEL_COUNT; channel++)
+    {
+      if (started[channel] < 0)
+        continue;
+      uint8_t member = started[channel];
+      uint8_t drive = layout->member_drive[member];
+      if (!ata_dma_finish(drive))
+        ata_pio_transfer(drive, raid0_member_buffer(member), run[member].logical_block_address,
+                         run[member].block_count, is_write);
+      done[member] = TRUE;
+    }
+  }
+}
+
+/**
+ * Split transfer of consecutive volume blocks into rounds. Each round walk
+ * the volume in order and stage stripe pieces into per-member bounce buffer
+ * until one of them is full, then every member transfer its run at once
+ *
+ * @param segment               Segment list, read into if is_write is false
+ * @param segment_count         Number of segments
+ * @param logical_block_address First volume block of the transfer
+ * @param is_write              Transfer direction
+ */
+static void raid0_transfer(const struct BlockSegment *segment, uint32_t segment_count,
+                           uint32_t logical_block_address, bool is_write)
+{
+  const struct RAID0Layout *layout = &raid0_driver_state.layout;
+  uint32_t stripe_block_count = layout->stripe_block_count;
+  uint32_t index = 0;
+  uint32_t block_offset = 0;
+
+  while (index < segment_count)
+  {
+    struct RAID0MemberRun run[RAID0_MAX_MEMBER] = {{0, 0}};
+    uint32_t piece_count = 0;
+    while (index < segment_count)
+    {
+      if (block_offset == segment[index].block_count)
+      {
+        index++;
+        block_offset = 0;
+        continue;
+      }
+
+      uint32_t stripe = logical_block_address / stripe_block_count;
+      uint32_t stripe_offset = logical_block_address % stripe_block_count;
+      uint8_t member = stripe % layout->member_count;
+      if (run[member].block_count == RAID0_MEMBER_BUFFER_BLOCK_COUNT)
+        break;
+      if (run[member].block_count == 0)
+        run[member].logical_block_address = (stripe / layout->member_count) * stripe_block_count + stripe_offset;
+
+      uint32_t piece = stripe_block_count - stripe_offset;
+      if (piece > segment[index].block_count - block_offset)
+        piece = segment[index].block_count - block_offset;
+      if (piece > RAID0_MEMBER_BUFFER_BLOCK_COUNT - run[member].block_count)
+        piece = RAID0_MEMBER_BUFFER_BLOCK_COUNT - run[member].block_count;
+
+      // Read target is the caller buffer, const only hold for write
+      uint8_t *memory = (uint8_t *)segment[index].buf + block_offset * BLOCK_SIZE;
+      uint8_t *staging = raid0_member_buffer(member) + run[member].block_count * BLOCK_SIZE;
+      if (is_write)
+        memcpy(staging, memory, piece * BLOCK_SIZE);
+      else
+      {
+        raid0_read_piece[piece_count].target = memory;
+        raid0_read_piece[piece_count].source = staging;
+        raid0_read_piece[piece_count].size = piece * BLOCK_SIZE;
+        piece_count++;
+      }
+
+      run[member].block_count += piece;
+      block_offset += piece;
+      logical_block_address += piece;
+    }
+
+    raid0_issue(run, is_write);
+    for (uint32_t i = 0; i < piece_count; i++)
+      memcpy(raid0_read_piece[i].target, raid0_read_piece[i].source, raid0_read_piece[i].size);
+  }
+}
+
+static void raid0_read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  struct BlockSegment segment = {.buf = ptr, .block_count = block_count};
+  raid0_transfer(&segment, 1, logical_block_address, FALSE);
+}
+
+static void raid0_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                       uint32_t logical_block_address)
+{
+  raid0_transfer(segment, segment_count, logical_block_address, TRUE);
+}
+
+static uint32_t raid0_get_block_count(void)
+{
+  return raid0_driver_state.block_count;
+}
+
+/**
+ * Check layout read from volume block 0 against the drives found. Member 0
+ * must be the primary master holding the layout, every member must be
+ * present, distinct and large enough
+ */
+static bool raid0_assemble(void)
+{
+  const struct RAID0Layout *layout = &raid0_driver_state.layout;
+  if (layout->member_count < 2 || layout->member_count > RAID0_MAX_MEMBER ||
+      layout->stripe_block_count == 0 || layout->member_drive[0] != 0)
+    return FALSE;
+
+  uint8_t seen = 0;
+  for (uint8_t member = 0; member < layout->member_count; member++)
+  {
+    uint8_t drive = layout->member_drive[member];
+    if (drive >= ATA_DRIVE_COUNT || (seen & (1u << drive)) != 0 ||
+        ata_get_drive_block_count(drive) < layout->member_block_count)
+      return FALSE;
+    seen |= 1u << drive;
+  }
+  raid0_driver_state.block_count = raid0_volume_block_count(layout);
+  return TRUE;
+}
+
+/**
+ * Read block 0 of a drive and check it is all zero
+ *
+ * @param drive  ATA drive index
+ * @param buffer Buffer receiving block 0
+ * @return       True if block 0 is blank
+ */
+static bool raid0_drive_blank(uint8_t drive, struct BlockBuffer *buffer)
+{
+  ata_pio_transfer(drive, buffer, 0, 1, FALSE);
+  for (uint32_t i = 0; i < BLOCK_SIZE; i++)
+    if (buffer->buf[i] != 0)
+      return FALSE;
+  return TRUE;
+}
+
+/**
+ * Stripe a blank volume over every blank ATA drive found, alternating
+ * channels so neighbouring stripe units sit on different channels, then
+ * persist the layout into volume block 0. Drive with anything in block 0
+ * may hold other data and is never taken as member
+ *
+ * @param boot_sector Content of primary master block 0, all zero
+ * @return            True if at least two blank drives found
+ */
+static bool raid0_create(struct BlockBuffer *boot_sector)
+{
+  struct RAID0Layout *layout = &raid0_driver_state.layout;
+  struct BlockBuffer member_sector;
+  memset(layout, 0, sizeof(struct RAID0Layout));
+  layout->member_block_count = 0xFFFFFFFF;
+  for (uint8_t position = 0; position < 2; position++)
+  {
+    for (uint8_t channel = 0; channel < ATA_CHANNEL_COUNT; channel++)
+    {
+      uint8_t drive = channel * 2 + position;
+      uint32_t drive_block_count = ata_get_drive_block_count(drive);
+      if (drive_block_count == 0 || (drive != 0 && !raid0_drive_blank(drive, &member_sector)))
+        continue;
+      layout->member_drive[layout->member_count++] = drive;
+      if (drive_block_count < layout->member_block_count)
+        layout->member_block_count = drive_block_count;
+    }
+  }
+  if (layout->member_count < 2)
+    return FALSE;
+
+  layout->magic = RAID0_LAYOUT_MAGIC;
+  layout->stripe_block_count = RAID0_STRIPE_BLOCK_COUNT;
+  layout->member_block_count -= layout->member_block_count % RAID0_STRIPE_BLOCK_COUNT;
+  memcpy(boot_sector->buf + BLOCK_VOLUME_LAYOUT_OFFSET, layout, sizeof(struct RAID0Layout));
+  ata_pio_transfer(0, boot_sector, 0, 1, TRUE);
+
+  raid0_driver_state.block_count = raid0_volume_block_count(layout);
+  return TRUE;
+}
+
+/**
+ * Identify ATA drives and read primary master block 0. Assemble the volume
+ * when it carry a stripe layout, create one when the drive is blank and
+ * other blank drives are attached. Otherwise primary master is used alone by ATA
+ */
+static bool raid0_probe(void)
+{
+  ata_block_device.probe();
+  if (ata_get_drive_block_count(0) == 0)
+    return FALSE;
+
+  struct BlockBuffer boot_sector;
+  if (raid0_drive_blank(0, &boot_sector))
+    return raid0_create(&boot_sector);
+  memcpy(&raid0_driver_state.layout, boot_sector.buf + BLOCK_VOLUME_LAYOUT_OFFSET, sizeof(struct RAID0Layout));
+  return raid0_driver_state.layout.magic == RAID0_LAYOUT_MAGIC && raid0_assemble();
+}
+
+const struct BlockDeviceOperation raid0_block_device = {
+    .name = "raid0",
+    .probe = raid0_probe,
+    .get_block_count = raid0_get_block_count,
+    .read_blocks = raid0_read_blocks,
+    .write_block_segments = raid0_write_block_segments,
+};
@@ -0,0 +1,113 @@
+#include "lib-header/ramdisk.h"
+#include "lib-header/disk.h"
+#include "lib-header/multiboot.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+
+static struct RAMDiskState ramdisk_state;
+
+static void ramdisk_read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  memcpy(ptr, ramdisk_state.image + logical_block_address * BLOCK_SIZE, block_count * BLOCK_SIZE);
+}
+
+static void ramdisk_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                         uint32_t logical_block_address)
+{
+  for (uint32_t i = 0; i < segment_count; i++)
+  {
+    if (segment[i].block_count == 0)
+      continue;
+    memcpy(ramdisk_state.image + logical_block_address * BLOCK_SIZE, segment[i].buf,
+           segment[i].block_count * BLOCK_SIZE);
+
+    uint32_t first_chunk = logical_block_address / RAMDISK_DIRTY_CHUNK_BLOCK_COUNT;
+    uint32_t last_chunk = (logical_block_address + segment[i].block_count - 1) / RAMDISK_DIRTY_CHUNK_BLOCK_COUNT;
+    for (uint32_t chunk = first_chunk; chunk <= last_chunk; chunk++)
+      ramdisk_state.dirty_bitmap[chunk / 32] |= 1u << (chunk % 32);
+    logical_block_address += segment[i].block_count;
+  }
+}
+
+static uint32_t ramdisk_get_block_count(void)
+{
+  return ramdisk_state.block_count;
+}
+
+/**
+ * Write dirty chunks back into the ATA primary master when the module line
+ * asked for it. Blocks beyond the drive capacity are dropped
+ */
+static void ramdisk_shutdown(void)
+{
+  if (!ramdisk_state.write_back)
+    return;
+
+  ata_block_device.probe();
+  uint32_t disk_block_count = ata_block_device.get_block_count();
+  for (uint32_t block = 0; block < ramdisk_state.block_count && block < disk_block_count;
+       block += RAMDISK_DIRTY_CHUNK_BLOCK_COUNT)
+  {
+    uint32_t chunk = block / RAMDISK_DIRTY_CHUNK_BLOCK_COUNT;
+    if ((ramdisk_state.dirty_bitmap[chunk / 32] & (1u << (chunk % 32))) == 0)
+      continue;
+
+    uint32_t end = block + RAMDISK_DIRTY_CHUNK_BLOCK_COUNT;
+    if (end > ramdisk_state.block_count)
+      end = ramdisk_state.block_count;
+    if (end > disk_block_count)
+      end = disk_block_count;
+    struct BlockSegment segment = {.buf = ramdisk_state.image + block * BLOCK_SIZE, .block_count = end - block};
+    ata_block_device.write_block_segments(&segment, 1, block);
+    ramdisk_state.dirty_bitmap[chunk / 32] &= ~(1u << (chunk % 32));
+  }
+}
+
+// Whether null-terminated module line contain option as a word
+static bool ramdisk_has_option(const char *line, const char *option, uint32_t option_length)
+{
+  for (uint32_t i = 0; line[i]; i++)
+  {
+    if ((i == 0 || line[i - 1] == ' ') && memcmp(line + i, option, option_length) == 0 &&
+        (line[i + option_length] == ' ' || line[i + option_length] == '\0'))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * Use the first multiboot module as disk image. Multiboot structures are in
+ * low memory covered by the kernel mapping, the image itself is mapped into
+ * the kernel window and kept away from user page frames
+ */
+static bool ramdisk_probe(void)
+{
+  if (_multiboot_info_physical_addr == 0 || _multiboot_info_physical_addr >= KERNEL_MAPPED_SIZE)
+    return FALSE;
+  struct MultibootInformation *info = (struct MultibootInformation *)(_multiboot_info_physical_addr + KERNEL_VIRTUAL_BASE);
+  if ((info->flag & MULTIBOOT_INFO_MODULE) == 0 || info->module_count == 0 || info->module_addr >= KERNEL_MAPPED_SIZE)
+    return FALSE;
+
+  struct MultibootModule *module = (struct MultibootModule *)(info->module_addr + KERNEL_VIRTUAL_BASE);
+  uint32_t size = module->end - module->start;
+  if (module->end <= module->start || size < BLOCK_SIZE || size > RAMDISK_MAX_SIZE)
+    return FALSE;
+
+  memset(&ramdisk_state, 0, sizeof(ramdisk_state));
+  reserve_physical_memory(module->end);
+  ramdisk_state.image = map_kernel_memory(module->start, size);
+  ramdisk_state.block_count = size / BLOCK_SIZE;
+  if (module->string != 0 && module->string < KERNEL_MAPPED_SIZE)
+    ramdisk_state.write_back = ramdisk_has_option((const char *)(module->string + KERNEL_VIRTUAL_BASE),
+                                                  RAMDISK_WRITE_BACK_OPTION, sizeof(RAMDISK_WRITE_BACK_OPTION) - 1);
+  return TRUE;
+}
+
+const struct BlockDeviceOperation ramdisk_block_device = {
+    .name = "ramdisk",
+    .probe = ramdisk_probe,
+    .get_block_count = ramdisk_get_block_count,
+    .read_blocks = ramdisk_read_blocks,
+    .write_block_segments = ramdisk_write_block_segments,
+    .shutdown = ramdisk_shutdown,
+};
@@ -3,6 +3,7 @@
 #include "lib-header/stdmem.h"
 #include "lib-header/framebuffer.h"
 #include "lib-header/bplustree.h"
+#include "lib-header/iostat.h"
 
 #define SHELL_BUFFER_SIZE 256
 #define COMMAND_MAX_SIZE 32
@@ -25,9 +26,9 @@ const char command_list[COMMAND_COUNT][COMMAND_MAX_SIZE] = {
     "rm\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
     "mv\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
     "whereis\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
-    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
-    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
-    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+    "iostat\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+    "shutdown\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+    "df\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
 
 };
@@ -36,7 +37,7 @@ struct CurrentDirectoryInfo
 {
     char paths[PATH_MAX_COUNT][DIRECTORY_NAME_LENGTH];
     uint32_t current_path_count;
-    uint16_t current_cluster_number;
+    uint32_t current_cluster_number;
     // char current_directory_name[8];
 };
 
@@ -269,132 +270,85 @@ uint8_t cd_command(char *buf, struct IndexInfo *indexes, struct CurrentDirectory
     {
         get_buffer_indexes(buf, param_indexes, '/', indexes->index, indexes->length);
 
-        int i = 0;
+        // Whole path is walked by the kernel in a single syscall
+        struct FAT32PathRequest request = {
+            .path = buf + indexes->index,
+            .path_length = indexes->length,
+            .start_cluster_number = temp_info.current_cluster_number,
+        };
 
-        while (i < get_words_count(param_indexes))
-        {
+        int8_t retcode;
 
-            if (param_indexes[i].length == 1 && buf[param_indexes[i].index] == '.')
-            {
-                i++;
-                continue;
-            }
-
-            else if (param_indexes[i].length == 2 && memcmp(buf + param_indexes[i].index, "..", 2) == 0)
-            {
-                // TODO :go to parent dir
+        syscall(13, (uint32_t)&request, (uint32_t)&retcode, 0);
 
-                if (temp_info.current_cluster_number != ROOT_CLUSTER_NUMBER)
-                {
-                    struct ClusterBuffer cl = {0};
-                    struct FAT32DriverRequest request = {
-                        .buf = &cl,
-                        .name = "\0\0\0\0\0\0\0\0",
-                        .ext = "\0\0\0",
-                        .parent_cluster_number = temp_info.current_cluster_number,
-                        .buffer_size = CLUSTER_SIZE,
-                    };
+        // Failing component start where the kernel stopped, a file at the end
+        // of the path is the last component
+        int failed_index = indexes->index + request.resolved_length;
+        int failed_length = 0;
+        if (retcode == 0 && get_words_count(param_indexes) > 0)
+        {
+            failed_index = param_indexes[get_words_count(param_indexes) - 1].index;
+            failed_length = param_indexes[get_words_count(param_indexes) - 1].length;
+        }
+        while (retcode != 0 && failed_index + failed_length < indexes->index + indexes->length &&
+               buf[failed_index + failed_length] != '/')
+            failed_length++;
 
-                    syscall(6, (uint32_t)&request, 0, 0);
+        if (retcode == 3)
+        {
+            char msg[] = "Directory name is too long: ";
+            syscall(5, (uint32_t)msg, 29, 0xF);
+            syscall(5, (uint32_t)buf + failed_index, failed_length, 0xF);
+            print_newline();
 
-                    struct FAT32DirectoryTable *dir_table = request.buf;
+            return 0;
+        }
 
-                    temp_info.current_cluster_number = dir_table->table->cluster_low;
-                    temp_info.current_path_count--;
-                }
-            }
+        if (retcode != 0 || request.entry.attribute != ATTR_SUBDIRECTORY)
+        {
+            char msg[] = "Failed to read directory ";
+            syscall(5, (uint32_t)msg, 26, 0xF);
+            syscall(5, (uint32_t)buf + failed_index, failed_length, 0xF);
+            print_newline();
 
-            else if (!(temp_info.current_cluster_number == ROOT_CLUSTER_NUMBER && memcmp("root\0\0\0\0", buf + param_indexes[i].index, param_indexes[i].length) == 0))
-            {
-                if (param_indexes[i].length > DIRECTORY_NAME_LENGTH)
-                {
-                    char msg[] = "Directory name is too long: ";
-                    syscall(5, (uint32_t)msg, 29, 0xF);
-                    syscall(5, (uint32_t)buf + param_indexes[i].index, param_indexes[i].length, 0xF);
-                    print_newline();
+            char errorMsg[] = "Error: directory not found\n";
+            syscall(5, (uint32_t)errorMsg, 28, 0xF);
 
-                    return 0;
-                }
-                struct ClusterBuffer cl[MAX_FOLDER_CLUSTER_SIZE];
+            return 0;
+        }
 
-                struct FAT32DriverRequest request = {
-                    .buf = &cl,
-                    .name = "root\0\0\0\0",
-                    .ext = "\0\0\0",
-                    .parent_cluster_number = temp_info.current_cluster_number,
-                    .buffer_size = CLUSTER_SIZE * MAX_FOLDER_CLUSTER_SIZE,
-                };
+        // Names shown in the prompt follow the same components
+        for (int i = 0; i < get_words_count(param_indexes); i++)
+        {
+            char *word = buf + param_indexes[i].index;
+            int length = param_indexes[i].length;
 
-                struct FAT32DirectoryTable *dir_table;
+            if (length == 1 && word[0] == '.')
+                continue;
 
+            if (length == 2 && memcmp(word, "..", 2) == 0)
+            {
                 if (temp_info.current_path_count > 0)
-                {
-                    syscall(6, (uint32_t)&request, 0, 0);
-
-                    dir_table = request.buf;
-
-                    memcpy(request.name, temp_info.paths[temp_info.current_path_count - 1], DIRECTORY_NAME_LENGTH);
-
-                    request.parent_cluster_number = dir_table->table->cluster_low;
-                }
-
-                int8_t retcode;
-
-                syscall(1, (uint32_t)&request, (uint32_t)&retcode, 0);
-
-                dir_table = request.buf;
-                uint32_t j = 0;
-                bool found = FALSE;
-
-                while (j < dir_table->table->filesize / CLUSTER_SIZE && !found)
-                {
-                    for (int k = 1; k < CLUSTER_SIZE / (int)sizeof(struct FAT32DirectoryEntry) && !found; k++)
-                    {
-                        struct FAT32DirectoryEntry *entry = &dir_table[j].table[k];
-
-                        if (entry->user_attribute != UATTR_NOT_EMPTY)
-                            continue;
-
-                        char name[DIRECTORY_NAME_LENGTH] = "\0\0\0\0\0\0\0\0";
-
-                        memcpy(name, buf + param_indexes[i].index, param_indexes[i].length);
-
-                        if (memcmp(entry->name, name, DIRECTORY_NAME_LENGTH) == 0 && entry->attribute == ATTR_SUBDIRECTORY)
-
-                        {
-                            if (temp_info.current_path_count == PATH_MAX_COUNT - 1)
-                            {
-                                char msg[] = "cd command reaches maximum depth\n";
-                                syscall(5, (uint32_t)msg, 34, 0xF);
-                                return 0;
-                            }
-
-                            temp_info.current_cluster_number = entry->cluster_low;
-                            memcpy(temp_info.paths[temp_info.current_path_count], name, DIRECTORY_NAME_LENGTH);
-                            temp_info.current_path_count++;
-                            found = TRUE;
-                        }
-                    }
-
-                    j++;
-                }
-
-                if (!found)
-                {
-                    char msg[] = "Failed to read directory ";
-                    syscall(5, (uint32_t)msg, 26, 0xF);
-                    syscall(5, (uint32_t)buf + param_indexes[i].index, param_indexes[i].length, 0xF);
-                    print_newline();
+                    temp_info.current_path_count--;
+                continue;
+            }
 
-                    char errorMsg[] = "Error: directory not found\n";
-                    syscall(5, (uint32_t)errorMsg, 28, 0xF);
+            if (temp_info.current_path_count == 0 && length == 4 && memcmp(word, "root", 4) == 0)
+                continue;
 
-                    return 0;
-                }
+            if (temp_info.current_path_count == PATH_MAX_COUNT - 1)
+            {
+                char msg[] = "cd command reaches maximum depth\n";
+                syscall(5, (uint32_t)msg, 34, 0xF);
+                return 0;
             }
 
-            i++;
+            memset(temp_info.paths[temp_info.current_path_count], 0, DIRECTORY_NAME_LENGTH);
+            memcpy(temp_info.paths[temp_info.current_path_count], word, length);
+            temp_info.current_path_count++;
         }
+
+        temp_info.current_cluster_number = request.cluster_number;
     }
 
     copy_directory_info(info, &temp_info);
@@ -413,74 +367,54 @@ void ls_command(char *buf, struct IndexInfo *indexes, struct CurrentDirectoryInf
             return;
     }
 
-    struct ClusterBuffer cl[MAX_FOLDER_CLUSTER_SIZE];
+    // Directory is read table by table, syscall 6 give the next table of its chain
+    struct FAT32DirectoryTable dir_table;
+    uint32_t table_cluster_number = temp_info.current_cluster_number;
     struct FAT32DriverRequest request = {
-        .buf = &cl,
+        .buf = &dir_table,
         .name = "root\0\0\0\0",
         .ext = "\0\0\0",
-        .parent_cluster_number = temp_info.current_cluster_number,
-        .buffer_size = CLUSTER_SIZE * MAX_FOLDER_CLUSTER_SIZE,
+        .buffer_size = CLUSTER_SIZE,
     };
 
-    if (temp_info.current_path_count > 0)
-    {
-        syscall(6, (uint32_t)&request, 0, 0);
-
-        struct FAT32DirectoryTable *dir_table = request.buf;
-
-        request.parent_cluster_number = dir_table->table->cluster_low;
-        memcpy(request.name, temp_info.paths[temp_info.current_path_count - 1], DIRECTORY_NAME_LENGTH);
-    }
-
-    int8_t retcode;
-
-    syscall(1, (uint32_t)&request, (uint32_t)&retcode, 0);
-
-    if (retcode == 0)
+    while (table_cluster_number != 0)
     {
-        struct FAT32DirectoryTable *dirTable = request.buf;
+        int8_t retcode;
+        request.parent_cluster_number = table_cluster_number;
+        syscall(6, (uint32_t)&request, (uint32_t)&retcode, (uint32_t)&table_cluster_number);
 
-        int i = 0;
-        int dir_table_count = dirTable->table->filesize / CLUSTER_SIZE;
-
-        while (i < dir_table_count)
+        if (retcode != 0)
         {
-            for (int j = 1; j < CLUSTER_SIZE / (int)sizeof(struct FAT32DirectoryEntry); j++)
-            {
-                if (dirTable[i].table[j].user_attribute != UATTR_NOT_EMPTY)
-                    continue;
+            char msg[] = "Failed to read directory\n";
+            syscall(5, (uint32_t)msg, 25, 0xF);
+            return;
+        }
 
-                uint32_t color;
+        for (int j = 1; j < CLUSTER_SIZE / (int)sizeof(struct FAT32DirectoryEntry); j++)
+        {
+            if (dir_table.table[j].user_attribute != UATTR_NOT_EMPTY)
+                continue;
 
-                if (dirTable[i].table[j].attribute == ATTR_SUBDIRECTORY)
-                    color = 0xa;
-                else
-                    color = 0xf;
-                syscall(5, (uint32_t)dirTable[i].table[j].name, DIRECTORY_NAME_LENGTH, color);
+            uint32_t color;
 
-                if (dirTable[i].table[j].attribute != ATTR_SUBDIRECTORY && memcmp(dirTable[i].table[j].ext, "\0\0\0", 3) != 0)
-                {
-                    char point_str[] = ".";
-                    syscall(5, (uint32_t)point_str, 1, color);
-                    syscall(5, (uint32_t)dirTable[i].table[j].ext, 3, color);
-                }
+            if (dir_table.table[j].attribute == ATTR_SUBDIRECTORY)
+                color = 0xa;
+            else
+                color = 0xf;
+            syscall(5, (uint32_t)dir_table.table[j].name, DIRECTORY_NAME_LENGTH, color);
 
-                print_space();
+            if (dir_table.table[j].attribute != ATTR_SUBDIRECTORY && memcmp(dir_table.table[j].ext, "\0\0\0", 3) != 0)
+            {
+                char point_str[] = ".";
+                syscall(5, (uint32_t)point_str, 1, color);
+                syscall(5, (uint32_t)dir_table.table[j].ext, 3, color);
             }
 
-            i++;
+            print_space();
         }
-
-        print_newline();
     }
 
-    else
-    {
-        char msg[] = "Failed to read directory ";
-        syscall(5, (uint32_t)msg, 26, 0xF);
-        syscall(5, (uint32_t)request.name, DIRECTORY_NAME_LENGTH, 0xF);
-        print_newline();
-    }
+    print_newline();
 }
 
 /**
@@ -535,67 +469,38 @@ uint8_t invoke_cd(char *buf,
     return 1;
 }
 
-uint32_t get_file_size(uint32_t current_cluster_number, char *current_folder_name, char *file_name, char *ext)
+uint32_t get_file_size(uint32_t current_cluster_number, char *file_name, char *ext)
 {
     // return 0 if not found
 
-    struct ClusterBuffer cl[MAX_FOLDER_CLUSTER_SIZE];
-
-    struct FAT32DriverRequest request = {
-        .buf = &cl,
-        .name = "root\0\0\0\0",
-        .ext = "\0\0\0",
-        .parent_cluster_number = current_cluster_number,
-        .buffer_size = CLUSTER_SIZE * MAX_FOLDER_CLUSTER_SIZE,
-    };
-
-    struct FAT32DirectoryTable *dir_table;
-
-    if (current_cluster_number > ROOT_CLUSTER_NUMBER)
+    // name.ext is resolved by the kernel, entry of the file come back with it
+    char path[DIRECTORY_NAME_LENGTH + 1 + EXTENSION_NAME_LENGTH];
+    uint32_t path_length = 0;
+    for (int i = 0; i < DIRECTORY_NAME_LENGTH && file_name[i] != '\0'; i++)
+        path[path_length++] = file_name[i];
+    if (ext[0] != '\0')
     {
-        syscall(6, (uint32_t)&request, 0, 0);
-
-        dir_table = request.buf;
-
-        memcpy(request.name, current_folder_name, DIRECTORY_NAME_LENGTH);
-
-        request.parent_cluster_number = dir_table->table->cluster_low;
+        path[path_length++] = '.';
+        for (int i = 0; i < EXTENSION_NAME_LENGTH && ext[i] != '\0'; i++)
+            path[path_length++] = ext[i];
     }
 
-    int8_t retcode;
-
-    syscall(1, (uint32_t)&request, (uint32_t)&retcode, 0);
-
-    dir_table = request.buf;
-    uint32_t j = 0;
-    struct FAT32DirectoryEntry *entry;
-    bool found = FALSE;
-
-    while (j < dir_table->table->filesize / CLUSTER_SIZE && !found)
-    {
-        for (int k = 1; k < CLUSTER_SIZE / (int)sizeof(struct FAT32DirectoryEntry) && !found; k++)
-        {
-            entry = &dir_table[j].table[k];
-
-            if (entry->user_attribute != UATTR_NOT_EMPTY)
-                continue;
-
-            if (memcmp(entry->name, file_name, DIRECTORY_NAME_LENGTH) == 0 && memcmp(entry->ext, ext, EXTENSION_NAME_LENGTH) == 0)
+    struct FAT32PathRequest request = {
+        .path = path,
+        .path_length = path_length,
+        .start_cluster_number = current_cluster_number,
+    };
 
-            {
-                found = TRUE;
-            }
-        }
+    int8_t retcode;
 
-        j++;
-    }
+    syscall(13, (uint32_t)&request, (uint32_t)&retcode, 0);
 
-    if (!found)
+    if (retcode != 0 || request.entry.attribute == ATTR_SUBDIRECTORY)
     {
         return 0;
     }
 
-    return entry->filesize;
+    return request.entry.filesize;
 }
 
 /**
@@ -713,19 +618,7 @@ void cat_command(char *buf, struct IndexInfo *indexes, struct CurrentDirectoryIn
     struct IndexInfo new_path_indexes[INDEXES_MAX_COUNT];
     parse_path_for_cd(buf, indexes, new_path_indexes);
 
-    struct ClusterBuffer cl_read_folder[5];
-    struct FAT32DriverRequest read_folder_request = {
-        .buf = &cl_read_folder,
-        .ext = EMPTY_EXTENSION,
-        .parent_cluster_number = target_directory.current_cluster_number,
-        .buffer_size = CLUSTER_SIZE * 5,
-    };
-
-    int8_t retcode_read_folder;
-    syscall(6, (uint32_t)&read_folder_request, (uint32_t)&retcode_read_folder, 0);
-    struct FAT32DirectoryTable *dir_table = read_folder_request.buf;
-
-    uint32_t file_size = get_file_size(target_directory.current_cluster_number, dir_table->table->name, target_file_name_parsed.word, target_file_name_extension.word);
+    uint32_t file_size = get_file_size(target_directory.current_cluster_number, target_file_name_parsed.word, target_file_name_extension.word);
 
     memcpy(read_request.name, target_file_name_parsed.word, target_file_name_parsed.length);
     memcpy(read_request.ext, target_file_name_extension.word, target_file_name_extension.length);
@@ -863,13 +756,7 @@ uint8_t cp_command(struct CurrentDirectoryInfo *source_dir,
         memcpy(file_name, name.word, name.length);
         memcpy(file_ext, ext.word, ext.length);
 
-        char source_dir_name[] = "root\0\0\0\0";
-
-        if (source_dir->current_cluster_number > ROOT_CLUSTER_NUMBER)
-        {
-            memcpy(source_dir_name, source_dir->paths[source_dir->current_path_count - 1], DIRECTORY_NAME_LENGTH);
-        }
-        uint32_t file_size = get_file_size(source_dir->current_cluster_number, source_dir_name, file_name, file_ext);
+        uint32_t file_size = get_file_size(source_dir->current_cluster_number, file_name, file_ext);
 
         // split source filename to name and extension
         splitcode = split_filename_extension(dest_name, &name, &ext);
@@ -1014,7 +901,7 @@ bool is_rm_safe(struct CurrentDirectoryInfo *target_dir, struct ParseString fold
     char name[] = EMPTY_NAME;
     memcpy(name, folder_name.word, folder_name.length);
 
-    uint16_t current_cluster_number = current_dir->current_cluster_number;
+    uint32_t current_cluster_number = current_dir->current_cluster_number;
     uint32_t path_count = current_dir->current_path_count;
 
     if (current_cluster_number == ROOT_CLUSTER_NUMBER)
@@ -1033,7 +920,7 @@ bool is_rm_safe(struct CurrentDirectoryInfo *target_dir, struct ParseString fold
         };
         syscall(6, (uint32_t)&request, 0, 0);
         struct FAT32DirectoryTable *dir_table = request.buf;
-        current_cluster_number = dir_table->table->cluster_low;
+        current_cluster_number = (dir_table->table->cluster_high << 16) + dir_table->table->cluster_low;
         found = (current_cluster_number == target_dir->current_cluster_number) && (memcmp(current_dir->paths[path_count - 1], name, DIRECTORY_NAME_LENGTH) == 0);
         path_count--;
     }
@@ -1203,6 +1090,111 @@ uint32_t whereis_command(struct ParseString *source_name)
     return 1;
 }
 
+void print_uint(uint32_t value)
+{
+    char digits[10];
+    int length = 0;
+    do
+    {
+        digits[9 - length] = '0' + value % 10;
+        value /= 10;
+        length++;
+    } while (value > 0);
+    syscall(5, (uint32_t)digits + 10 - length, length, 0xF);
+}
+
+void print_label(char *label, uint32_t length)
+{
+    syscall(5, (uint32_t)label, length, 0xF);
+}
+
+/**
+ * Print block layer and FAT32 entry point counters from syscall 10
+ *
+ * @param reset Whether counters are zeroed after being read
+ */
+void iostat_command(bool reset)
+{
+    const char operation_name[IOSTAT_OPERATION_COUNT][16] = {
+        "read_blocks    ", "write_blocks   ", "read_clusters  ", "write_clusters "};
+    const char entry_name[IOSTAT_ENTRY_COUNT][16] = {
+        "read           ", "read_directory ", "write          ", "delete         ", "resolve_path   ",
+        "other          "};
+
+    struct IOStatistic statistic;
+    syscall(10, (uint32_t)&statistic, 0, reset);
+
+    for (int i = 0; i < IOSTAT_OPERATION_COUNT; i++)
+    {
+        struct IOStatOperationCounter *counter = &statistic.operation[i];
+        syscall(5, (uint32_t)operation_name[i], 15, 0xF);
+        print_label("call ", 5);
+        print_uint(counter->call);
+        print_label(" KiB ", 5);
+        print_uint((uint32_t)(counter->byte >> 10));
+        print_newline();
+
+        // Latency histogram, only non-empty buckets as 2^bucket_shift:count
+        print_label("  cycles", 8);
+        for (int j = 0; j < IOSTAT_HISTOGRAM_BUCKET_COUNT; j++)
+        {
+            if (counter->histogram[j] == 0)
+                continue;
+            print_label(" 2^", 3);
+            print_uint(j + IOSTAT_HISTOGRAM_SHIFT);
+            print_label(":", 1);
+            print_uint(counter->histogram[j]);
+        }
+        print_newline();
+    }
+
+    print_label("entry          call rblk wblk rclu wclu KiB", 44);
+    print_newline();
+    for (int i = 0; i < IOSTAT_ENTRY_COUNT; i++)
+    {
+        struct IOStatEntryCounter *counter = &statistic.entry[i];
+        syscall(5, (uint32_t)entry_name[i], 15, 0xF);
+        print_uint(counter->call);
+        for (int j = 0; j < IOSTAT_OPERATION_COUNT; j++)
+        {
+            print_space();
+            print_uint(counter->operation[j]);
+        }
+        print_space();
+        print_uint((uint32_t)(counter->disk_byte >> 10));
+        print_newline();
+    }
+}
+
+/**
+ * Print volume size, free space and entry counts from syscall 12
+ */
+void df_command(void)
+{
+    struct FAT32VolumeStatistic statistic;
+    syscall(12, (uint32_t)&statistic, 0, 0);
+
+    uint32_t cluster_kib = statistic.cluster_size >> 10;
+    print_label("size KiB  ", 10);
+    print_uint(statistic.cluster_count * cluster_kib);
+    print_newline();
+    print_label("used KiB  ", 10);
+    print_uint((statistic.cluster_count - statistic.free_cluster_count) * cluster_kib);
+    print_newline();
+    print_label("free KiB  ", 10);
+    print_uint(statistic.free_cluster_count * cluster_kib);
+    print_newline();
+    print_label("cluster   ", 10);
+    print_uint(statistic.cluster_size);
+    print_newline();
+    print_label("files     ", 10);
+    print_uint(statistic.file_count);
+    print_newline();
+    print_label("dirs      ", 10);
+    print_uint(statistic.directory_count);
+    print_newline();
+}
+
 int main(void)
 {
     const int DIRECTORY_DISPLAY_OFFSET = 24;
@@ -1563,6 +1555,38 @@ int main(void)
 
                 else if (commandNumber == 8)
                 {
+                    // iostat, optional -r flag reset counters after printing
+                    if (argsCount == 1)
+                        iostat_command(FALSE);
+
+                    else if (argsCount == 2 && word_indexes[1].length == 2 && memcmp(buf + word_indexes[1].index, "-r", 2) == 0)
+                        iostat_command(TRUE);
+
+                    else
+                    {
+                        char invalid_flag_msg[] = "Invalid flag.\n";
+                        syscall(5, (uint32_t)invalid_flag_msg, 15, 0xF);
+                    }
+                }
+
+                else if (commandNumber == 9)
+                {
+                    // shutdown, kernel sync and power off, never return
+                    if (argsCount == 1)
+                        syscall(11, 0, 0, 0);
+
+                    else
+                        syscall(5, (uint32_t)too_many_args_msg, 20, 0xF);
+                }
+
+                else if (commandNumber == 10)
+                {
+                    // df, volume usage without walking the FAT
+                    if (argsCount == 1)
+                        df_command();
+
+                    else
+                        syscall(5, (uint32_t)too_many_args_msg, 20, 0xF);
                 }
             }
         }
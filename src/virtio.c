@@ -0,0 +1,231 @@
+#include "lib-header/virtio.h"
+#include "lib-header/pci.h"
+#include "lib-header/portio.h"
+#include "lib-header/paging.h"
+#include "lib-header/stdmem.h"
+
+static struct VirtioBlockDriverState virtio_blk_state;
+
+// Device access queue memory by physical address, kernel memory is mapped
+// linearly so static buffers are physically contiguous
+static uint8_t virtqueue_buffer[VIRTQUEUE_BUFFER_SIZE] __attribute__((aligned(VIRTQUEUE_ALIGN)));
+static struct VirtioBlockRequestHeader request_header[VIRTIO_BLK_REQUEST_SLOT_COUNT];
+static uint8_t request_status[VIRTIO_BLK_REQUEST_SLOT_COUNT];
+
+static void add_descriptor(const void *ptr, uint32_t length, uint16_t flag)
+{
+  uint16_t index = virtio_blk_state.descriptor_count++;
+  struct VirtqueueDescriptor *descriptor = &virtio_blk_state.descriptor[index];
+  descriptor->physical_address = KERNEL_VIRTUAL_TO_PHYSICAL(ptr);
+  descriptor->length = length;
+  descriptor->flag = flag;
+  descriptor->next = index + 1;
+}
+
+/**
+ * Notify the device of every request queued in the batch and poll the used
+ * ring until all of them complete, then finish bounced reads. Request whose
+ * status is not VIRTIO_BLK_S_OK is reported to the block layer. Descriptors,
+ * slots and bounce buffer are free for the next batch afterward
+ */
+static void virtio_blk_complete_batch(void)
+{
+  if (virtio_blk_state.slot_count == 0)
+    return;
+
+  __asm__ volatile("" : /* <Empty> */ : /* <Empty> */ : "memory");
+  out16(virtio_blk_state.io_base + VIRTIO_QUEUE_NOTIFY, 0);
+
+  uint16_t target = virtio_blk_state.used_index + virtio_blk_state.slot_count;
+  while (virtio_blk_state.used->index != target)
+    ;
+  virtio_blk_state.used_index = target;
+
+  // Status bytes are written by the device
+  __asm__ volatile("" : /* <Empty> */ : /* <Empty> */ : "memory");
+  for (uint16_t slot = 0; slot < virtio_blk_state.slot_count; slot++)
+    if (request_status[slot] != VIRTIO_BLK_S_OK)
+      block_device_report_error(request_header[slot].type == VIRTIO_BLK_T_OUT);
+
+  block_bounce_release();
+  virtio_blk_state.descriptor_count = 0;
+  virtio_blk_state.slot_count = 0;
+}
+
+/**
+ * Queue requests transferring consecutive blocks described by segment list.
+ * Device is notified once VIRTIO_BLK_REQUEST_SLOT_COUNT requests are queued or
+ * by virtio_blk_complete_batch(), so the device may process them in parallel.
+ * Each request scatter-gather through block_bounce_map()
+ *
+ * @param segment               Segment list, read into if is_write is false
+ * @param segment_count         Number of segments
+ * @param logical_block_address First block of the transfer
+ * @param is_write              Transfer direction
+ */
+static void virtio_blk_transfer(const struct BlockSegment *segment, uint32_t segment_count,
+                                uint32_t logical_block_address, bool is_write)
+{
+  uint32_t index = 0;
+  uint32_t block_offset = 0;
+  uint16_t data_flag = VIRTQ_DESC_F_NEXT | (is_write ? 0 : VIRTQ_DESC_F_WRITE);
+
+  while (index < segment_count)
+  {
+    if (block_offset == segment[index].block_count)
+    {
+      index++;
+      block_offset = 0;
+      continue;
+    }
+    if (virtio_blk_state.slot_count == VIRTIO_BLK_REQUEST_SLOT_COUNT)
+      virtio_blk_complete_batch();
+
+    uint16_t slot = virtio_blk_state.slot_count;
+    uint16_t head = virtio_blk_state.descriptor_count;
+    request_header[slot].type = is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    request_header[slot].reserved = 0;
+    request_header[slot].sector = logical_block_address;
+    add_descriptor(&request_header[slot], sizeof(struct VirtioBlockRequestHeader), VIRTQ_DESC_F_NEXT);
+
+    uint32_t request_block = 0;
+    uint32_t data_count = 0;
+    while (index < segment_count && data_count < VIRTIO_BLK_MAX_DATA_DESCRIPTOR &&
+           request_block < VIRTIO_BLK_MAX_BLOCK_PER_REQUEST)
+    {
+      if (block_offset == segment[index].block_count)
+      {
+        index++;
+        block_offset = 0;
+        continue;
+      }
+
+      // Read target is the caller buffer, const only hold for write
+      uint8_t *buf = (uint8_t *)segment[index].buf + block_offset * BLOCK_SIZE;
+      uint32_t piece = segment[index].block_count - block_offset;
+      if (piece > VIRTIO_BLK_MAX_BLOCK_PER_REQUEST - request_block)
+        piece = VIRTIO_BLK_MAX_BLOCK_PER_REQUEST - request_block;
+
+      buf = block_bounce_map(buf, &piece, is_write);
+      if (!buf)
+        break;
+
+      add_descriptor(buf, piece * BLOCK_SIZE, data_flag);
+      data_count++;
+      request_block += piece;
+      block_offset += piece;
+    }
+
+    // Bounce buffer exhausted before any data, drop the header and drain
+    if (request_block == 0)
+    {
+      virtio_blk_state.descriptor_count--;
+      virtio_blk_complete_batch();
+      continue;
+    }
+
+    request_status[slot] = 0xFF;
+    add_descriptor(&request_status[slot], 1, VIRTQ_DESC_F_WRITE);
+
+    volatile struct VirtqueueAvailable *available = virtio_blk_state.available;
+    available->ring[available->index % virtio_blk_state.queue_size] = head;
+    __asm__ volatile("" : /* <Empty> */ : /* <Empty> */ : "memory");
+    available->index++;
+
+    virtio_blk_state.slot_count++;
+    logical_block_address += request_block;
+  }
+}
+
+static void virtio_blk_read_blocks(void *ptr, uint32_t logical_block_address, uint32_t block_count)
+{
+  struct BlockSegment segment = {.buf = ptr, .block_count = block_count};
+  virtio_blk_transfer(&segment, 1, logical_block_address, FALSE);
+  virtio_blk_complete_batch();
+}
+
+static void virtio_blk_write_block_segments(const struct BlockSegment *segment, uint32_t segment_count,
+                                            uint32_t logical_block_address)
+{
+  virtio_blk_transfer(segment, segment_count, logical_block_address, TRUE);
+  virtio_blk_complete_batch();
+}
+
+// Queued writes are left for the next batch completion
+static void virtio_blk_transfer_write(const struct BlockSegment *segment, uint32_t segment_count,
+                                      uint32_t logical_block_address)
+{
+  virtio_blk_transfer(segment, segment_count, logical_block_address, TRUE);
+}
+
+static uint32_t virtio_blk_get_block_count(void)
+{
+  return virtio_blk_state.block_count;
+}
+
+/**
+ * Find legacy virtio-blk PCI function, reset it, accept no optional feature
+ * and set up request queue 0. Used ring is polled, device interrupt is suppressed
+ */
+static bool virtio_blk_probe(void)
+{
+  struct PCIDevice virtio_device;
+  if (!pci_find_device(VIRTIO_PCI_VENDOR_ID, VIRTIO_PCI_DEVICE_BLOCK_LEGACY, &virtio_device))
+    return FALSE;
+
+  uint32_t bar0 = pci_config_read32(virtio_device, PCI_BAR0);
+  if (!(bar0 & 0x1))
+    return FALSE;
+  pci_enable_bus_master(virtio_device);
+  uint16_t io_base = (uint16_t)(bar0 & 0xFFFC);
+
+  out(io_base + VIRTIO_DEVICE_STATUS, 0);
+  out(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  out(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+  out32(io_base + VIRTIO_GUEST_FEATURES, 0);
+
+  // Full batch must fit in the queue, static queue memory bound the other side
+  out16(io_base + VIRTIO_QUEUE_SELECT, 0);
+  uint16_t queue_size = in16(io_base + VIRTIO_QUEUE_SIZE);
+  if (queue_size < VIRTIO_BLK_REQUEST_SLOT_COUNT * (VIRTIO_BLK_MAX_DATA_DESCRIPTOR + 2) ||
+      queue_size > VIRTQUEUE_MAX_SIZE)
+  {
+    out(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+    return FALSE;
+  }
+
+  // Legacy layout : descriptor table, available ring, used ring on next page boundary
+  memset(virtqueue_buffer, 0, VIRTQUEUE_BUFFER_SIZE);
+  uint32_t used_offset = sizeof(struct VirtqueueDescriptor) * queue_size +
+                         sizeof(struct VirtqueueAvailable) + sizeof(uint16_t) * (queue_size + 1);
+  used_offset = (used_offset + VIRTQUEUE_ALIGN - 1) & ~(VIRTQUEUE_ALIGN - 1);
+
+  memset(&virtio_blk_state, 0, sizeof(virtio_blk_state));
+  virtio_blk_state.io_base = io_base;
+  virtio_blk_state.queue_size = queue_size;
+  virtio_blk_state.descriptor = (struct VirtqueueDescriptor *)virtqueue_buffer;
+  virtio_blk_state.available = (struct VirtqueueAvailable *)(virtqueue_buffer +
+                                                             sizeof(struct VirtqueueDescriptor) * queue_size);
+  virtio_blk_state.used = (struct VirtqueueUsed *)(virtqueue_buffer + used_offset);
+  virtio_blk_state.available->flag = VIRTQ_AVAIL_F_NO_INTERRUPT;
+  out32(io_base + VIRTIO_QUEUE_ADDRESS, KERNEL_VIRTUAL_TO_PHYSICAL(virtqueue_buffer) / VIRTQUEUE_ALIGN);
+
+  // Clamp 64-bit capacity into 32-bit LBA used by the kernel
+  uint32_t capacity_low = in32(io_base + VIRTIO_BLK_CAPACITY);
+  uint32_t capacity_high = in32(io_base + VIRTIO_BLK_CAPACITY + 4);
+  virtio_blk_state.block_count = capacity_high ? 0xFFFFFFFF : capacity_low;
+
+  out(io_base + VIRTIO_DEVICE_STATUS,
+      VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+  return TRUE;
+}
+
+const struct BlockDeviceOperation virtio_blk_block_device = {
+    .name = "virtio-blk",
+    .probe = virtio_blk_probe,
+    .get_block_count = virtio_blk_get_block_count,
+    .read_blocks = virtio_blk_read_blocks,
+    .write_block_segments = virtio_blk_write_block_segments,
+    .submit_write_segments = virtio_blk_transfer_write,
+    .wait = virtio_blk_complete_batch,
+};